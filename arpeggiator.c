@@ -0,0 +1,166 @@
+/**
+ * Arpeggiator
+ *
+ * Plays the held chord as an arpeggio on the looper clock, so every target
+ * gets one and not only those with an arpeggiator of their own (MODX,
+ * SEQTRAK). The looper tick calls arpeggiator_step() on each step, from the
+ * internal timer or the external MIDI clock alike; on a step of the arp grid
+ * the next note goes to the note scheduler with its note off at the gate
+ * length, odd notes delayed by the swing.
+ *
+ * The chord is sorted and spread over the octaves once when it is played,
+ * a step only advances an index. Random mode uses a seeded generator, so an
+ * arpeggio replays the same after a reset.
+ */
+#include "arpeggiator.h"
+
+#include "looper.h"
+#include "note_scheduler.h"
+
+#define ARP_MAX_NOTES (ARP_STRINGS * ARP_MAX_OCTAVES)
+#define ARP_MAX_GATE  95  // a note always ends before the next one starts
+#define ARP_SEED      1
+
+static arp_config_t config;
+static uint8_t strings[ARP_STRINGS];
+static uint8_t notes[ARP_MAX_NOTES];  // the chord over the octaves, lowest first
+static uint8_t note_count = 0;
+static uint8_t position = 0;          // in the mode's sequence
+static bool running = false;
+
+static uint32_t rng_state = ARP_SEED;
+
+// xorshift32, the same generator the ghost notes use.
+static uint32_t rng_next(void) {
+    uint32_t x = rng_state;
+
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    rng_state = x;
+    return x;
+}
+
+void arpeggiator_play(const uint8_t *chord, const arp_config_t *arp_config) {
+    uint8_t sorted[ARP_STRINGS];
+    uint8_t count = 0;
+
+    config = *arp_config;
+    if (config.rate == 0)
+        config.rate = 1;
+    if (config.gate > ARP_MAX_GATE)
+        config.gate = ARP_MAX_GATE;
+    if (config.octaves == 0)
+        config.octaves = 1;
+    if (config.octaves > ARP_MAX_OCTAVES)
+        config.octaves = ARP_MAX_OCTAVES;
+
+    // Strings sounding the same pitch play it once.
+    for (uint8_t s = 0; s < ARP_STRINGS; s++) {
+        uint8_t note = chord[s];
+        uint8_t n = count;
+
+        strings[s] = note;
+        if (note == 0)
+            continue;
+        while (n > 0 && sorted[n - 1] > note)
+            n--;
+        if (n > 0 && sorted[n - 1] == note)
+            continue;
+        for (uint8_t i = count; i > n; i--)
+            sorted[i] = sorted[i - 1];
+        sorted[n] = note;
+        count++;
+    }
+
+    // A guitar voicing spans about two octaves, each octave up only adds
+    // what lies above the notes so far.
+    note_count = 0;
+    for (uint8_t octave = 0; octave < config.octaves; octave++) {
+        for (uint8_t i = 0; i < count && sorted[i] + 12 * octave <= 127; i++) {
+            if (note_count == 0 || sorted[i] + 12 * octave > notes[note_count - 1])
+                notes[note_count++] = sorted[i] + 12 * octave;
+        }
+    }
+
+    position = 0;
+    running = note_count > 0 && (config.mode != ARP_PATTERN || config.pattern_len > 0);
+}
+
+void arpeggiator_stop(void) {
+    running = false;
+    note_scheduler_cancel_messages(0x90);
+}
+
+bool arpeggiator_running(void) {
+    return running;
+}
+
+// The note off takes its slot first: with the scheduler full the step is
+// skipped, and a note on without a slot leaves only a harmless note off.
+// arpeggiator_stop() cancels the note ons, so each one has its note off.
+static void schedule(uint64_t on_us, uint32_t gate_us, int note) {
+    if (note == 0 || note > 127)
+        return;
+    if (!note_scheduler_schedule_message(on_us + gate_us, 0x80, (uint8_t)note, 0))
+        return;
+    note_scheduler_schedule_message(on_us, 0x90, (uint8_t)note, config.velocity);
+}
+
+void arpeggiator_step(uint64_t step_start_us) {
+    if (!running)
+        return;
+
+    looper_status_t *status = looper_status_get();
+    if (status->current_step % config.rate != 0)
+        return;
+
+    uint32_t note_us = config.rate * status->step_period_ms * 1000;
+    uint32_t gate_us = note_us / 100 * config.gate;
+    uint64_t on_us = step_start_us;
+
+    // Arp notes pair up like the drum steps, the second of a pair swings.
+    if ((status->current_step / config.rate) & 1)
+        on_us += (uint64_t)(2.0f * note_us * (config.swing - 0.5f));
+
+    switch (config.mode) {
+        case ARP_UP:
+            schedule(on_us, gate_us, notes[position]);
+            position = (position + 1) % note_count;
+            break;
+        case ARP_DOWN:
+            schedule(on_us, gate_us, notes[note_count - 1 - position]);
+            position = (position + 1) % note_count;
+            break;
+        case ARP_UP_DOWN: {
+            uint8_t length = note_count > 1 ? 2 * note_count - 2 : 1;
+            schedule(on_us, gate_us, notes[position < note_count ? position : length - position]);
+            position = (position + 1) % length;
+            break;
+        }
+        case ARP_RANDOM:
+            schedule(on_us, gate_us, notes[((uint64_t)rng_next() * note_count) >> 32]);
+            break;
+        case ARP_PATTERN: {
+            // Steps without strings are skipped, as in a strummed pattern.
+            uint8_t length = config.pattern_len * config.octaves;
+            for (uint8_t tries = 0; tries < length; tries++) {
+                const uint8_t *step = config.pattern[position % config.pattern_len];
+                uint8_t octave = position / config.pattern_len;
+                bool played = false;
+
+                position = (position + 1) % length;
+                for (uint8_t i = 0; i < ARP_STRINGS; i++) {
+                    int string = ARP_STRINGS - step[i];
+                    if (step[i] == 0 || string < 0 || strings[string] == 0)
+                        continue;
+                    schedule(on_us, gate_us, strings[string] + 12 * octave);
+                    played = true;
+                }
+                if (played)
+                    break;
+            }
+            break;
+        }
+    }
+}
@@ -0,0 +1,41 @@
+#ifndef ARPEGGIATOR_H_
+#define ARPEGGIATOR_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define ARP_STRINGS     6
+#define ARP_MAX_OCTAVES 4
+
+typedef enum {
+    ARP_UP,
+    ARP_DOWN,
+    ARP_UP_DOWN,  // the top and bottom notes are not repeated
+    ARP_RANDOM,
+    ARP_PATTERN,  // the strings of each pattern step together
+} arp_mode_t;
+
+typedef struct {
+    arp_mode_t mode;
+    uint8_t rate;      // looper steps per arp note
+    uint8_t gate;      // note length in percent of the arp note, up to 95
+    uint8_t octaves;   // 1 to ARP_MAX_OCTAVES, the pattern moves up an octave per pass
+    uint8_t velocity;
+    float swing;       // 0.5 straight, as ghost_parameters_t.swing_ratio
+    const uint8_t (*pattern)[ARP_STRINGS];  // ARP_PATTERN: guitar string numbers, 1 the high E, 0 none
+    uint8_t pattern_len;
+} arp_config_t;
+
+// Core 0: arpeggiates the chord, a note per string and 0 for an unused one,
+// from the next looper step on the arp grid.
+void arpeggiator_play(const uint8_t *strings, const arp_config_t *config);
+
+// Core 0: stops the arpeggio, notes already sounding still get their note off.
+void arpeggiator_stop(void);
+
+bool arpeggiator_running(void);
+
+// Looper tick, internal or external clock: schedules the notes of the step.
+void arpeggiator_step(uint64_t step_start_us);
+
+#endif  // ARPEGGIATOR_H_
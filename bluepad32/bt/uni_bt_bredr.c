@@ -239,6 +239,15 @@ void uni_bt_bredr_process_fsm(uni_hid_device_t* d) {
         return;
     }
 
+    // Known device (see uni_bt_bredr_connect_known_device()) that beat us to it and connected by itself.
+    // Name, VID/PID and HID descriptor were restored from the cache, there is nothing left to query.
+    if (state == UNI_BT_CONN_STATE_L2CAP_INTERRUPT_CONNECTED && uni_hid_device_is_incoming(d) &&
+        d->sdp_query_type == SDP_QUERY_NOT_NEEDED) {
+        logi("uni_bt_process_fsm: Known device is ready\n");
+        uni_hid_device_set_ready(d);
+        return;
+    }
+
     if (state == UNI_BT_CONN_STATE_REMOTE_NAME_FETCHED) {
         // TODO: Move comparison to DS4 code
         if (strcmp("Wireless Controller", d->name) == 0) {
@@ -321,6 +330,44 @@ void uni_bt_bredr_process_fsm(uni_hid_device_t* d) {
     }
 }
 
+uni_hid_device_t* uni_bt_bredr_connect_known_device(bd_addr_t addr,
+                                                    uint32_t cod,
+                                                    const char* name,
+                                                    uint16_t vendor_id,
+                                                    uint16_t product_id,
+                                                    const uint8_t* hid_descriptor,
+                                                    int hid_descriptor_len) {
+    uni_hid_device_t* d;
+
+    d = uni_hid_device_get_instance_for_address(addr);
+    if (d) {
+        logi("Known device %s already in progress (state=0x%02x)\n", bd_addr_to_str(addr), d->conn.state);
+        return d;
+    }
+
+    d = uni_hid_device_create(addr);
+    if (d == NULL) {
+        loge("Error: cannot create known device, no more available slots\n");
+        return NULL;
+    }
+
+    // Restore what inquiry, remote name request and SDP would have fetched,
+    // and let the VID/PID pick the parser right away.
+    uni_hid_device_set_cod(d, cod);
+    uni_hid_device_set_name(d, name);
+    uni_hid_device_set_vendor_id(d, vendor_id);
+    uni_hid_device_set_product_id(d, product_id);
+    if (hid_descriptor_len > 0)
+        uni_hid_device_set_hid_descriptor(d, hid_descriptor, hid_descriptor_len);
+    uni_hid_device_guess_controller_type_from_pid_vid(d);
+    d->sdp_query_type = SDP_QUERY_NOT_NEEDED;
+
+    logi("Paging known device %s\n", bd_addr_to_str(addr));
+    uni_bt_conn_set_state(&d->conn, UNI_BT_CONN_STATE_SDP_HID_DESCRIPTOR_FETCHED);
+    l2cap_create_control_connection(d);
+    return d;
+}
+
 void uni_bt_bredr_on_l2cap_incoming_connection(uint16_t channel, const uint8_t* packet, uint16_t size) {
     bd_addr_t event_addr;
     uni_hid_device_t* device;
@@ -0,0 +1,402 @@
+// Liberlive / Sonic Master notifications.
+// The BTstack callback only decodes a notification into a compact event; the
+// controller globals, config changes and tempo/key SysEx are applied when the
+// main loop drains the queue in uni_bt_le_liberlive_process_events(), inside
+// the async context's lock.
+// Kept apart from uni_bt_le.c so it builds without BTstack, see
+// tools/host_test for the replay test against the old decoder.
+
+#include "bt/uni_bt_le_liberlive.h"
+
+#include <stddef.h>
+#include <string.h>
+#include <pico/cyw43_arch.h>
+#include <hardware/sync.h>
+
+void gamepad_bluetooth_handle_data();
+void metrics_hid_report(bool ble, bool changed);
+void config_guitar(uint8_t mode);
+void midi_modx_tempo(int tempo);
+void midi_seqtrak_key(uint8_t key);
+void midi_seqtrak_tempo(int tempo);
+
+extern int applied_velocity;
+extern int transpose;
+
+extern uint8_t but0;
+extern uint8_t but1;
+extern uint8_t but2;
+extern uint8_t but3;
+extern uint8_t but4;
+extern uint8_t but6;
+extern uint8_t but7;
+extern uint8_t but9;
+
+extern uint8_t mbut0;
+extern uint8_t mbut1;
+extern uint8_t mbut2;
+extern uint8_t mbut3;
+
+extern uint8_t dpad_left;
+extern uint8_t dpad_right;
+extern uint8_t dpad_up;
+extern uint8_t dpad_down;
+
+extern bool joy_up;
+extern bool joy_down;
+extern bool knob_up;
+extern bool knob_down;
+
+extern uint8_t green;
+extern uint8_t red;
+extern uint8_t yellow;
+extern uint8_t blue;
+extern uint8_t orange;
+extern uint8_t starpower;
+extern uint8_t pitch;
+extern uint8_t left;
+extern uint8_t right;
+extern uint8_t logo;
+extern uint8_t joystick_up;
+extern uint8_t joystick_down;
+
+extern bool enable_seqtrak;
+extern bool enable_modx;
+
+#define LL_NOTIFICATION_LEN 16
+#define LL_EVENT_QUEUE_LEN 16
+#define LL_KEY_NONE 0xFF
+
+#define LL_EVENT_CONFIG  0x01	// tap tempo + mode key: switch configuration
+#define LL_EVENT_NEUTRAL 0x02	// paddle back in neutral after firing
+#define LL_EVENT_STYLE   0x04	// stop/config + mode key: strum style
+#define LL_EVENT_CHORD   0x08	// chord key held
+#define LL_EVENT_FIRE    0x10	// paddle moved: hand the state to the guitar handler
+
+#define LL_BUT0 0x01	// red
+#define LL_BUT1 0x02	// green
+#define LL_BUT2 0x04	// yellow
+#define LL_BUT3 0x08	// blue
+#define LL_BUT4 0x10	// orange
+
+typedef struct {
+	uint8_t flags;
+	uint8_t config_mode;
+	uint8_t tempo;			// byte 7
+	uint8_t key;			// semitones from C, LL_KEY_NONE if not reported
+	uint8_t buttons;		// LL_BUT* of the chord or strum style
+	uint8_t paddle;			// byte 5
+	uint8_t paddle_a;		// byte 9
+	uint8_t paddle_b;		// byte 10
+} liberlive_event_t;
+
+typedef struct {
+	uint8_t index;
+	uint8_t value;
+	uint8_t buttons;
+} liberlive_chord_key_t;
+
+// Mode keys report a single bit in byte 4, these tables are indexed by its position.
+static const uint8_t ll_config_modes[8] = {
+	0,
+	1,		// ketron arranger
+	2,		// ample guitar
+	3,		// midi drums
+	4,		// yamaha seqtrak
+	5,		// yamaha modx/montage
+	11,		// mpc sample
+	19,		// wav trigger pro
+};
+
+static const uint8_t ll_style_buttons[8] = {
+	0,
+	LL_BUT1,	// full chord up/down
+	LL_BUT0,	// chord up/root note down
+	LL_BUT2,	// root note up/down
+	LL_BUT3,	// 3rd note up/root note down
+	LL_BUT4,	// 5th note up/root note down
+	0,
+	0,
+};
+
+static const uint8_t ll_keys[7] = {0, 2, 4, 5, 7, 9, 11};	// C D E F G A B
+
+// Checked in order, the first match wins.
+static const liberlive_chord_key_t ll_chord_keys[] = {
+	{4, 2,   LL_BUT2 | LL_BUT0},					// 7b
+	{2, 8,   LL_BUT1 | LL_BUT0 | LL_BUT2 | LL_BUT3},	// 7
+	{3, 4,   LL_BUT2 | LL_BUT1 | LL_BUT0},			// 5b
+	{4, 4,   LL_BUT0},								// 6m
+	{2, 16,  LL_BUT0 | LL_BUT2 | LL_BUT3},			// 6
+	{3, 8,   LL_BUT0 | LL_BUT2 | LL_BUT3},			// 6
+	{4, 8,   LL_BUT1},								// 5
+	{2, 32,  LL_BUT1 | LL_BUT2},					// 5sus
+	{3, 16,  LL_BUT1 | LL_BUT0},					// 5/7
+	{4, 16,  LL_BUT2},								// 1
+	{2, 64,  LL_BUT2 | LL_BUT4},					// 1sus
+	{3, 32,  LL_BUT2 | LL_BUT3},					// 1/3
+	{4, 32,  LL_BUT4},								// 4
+	{2, 128, LL_BUT4 | LL_BUT3 | LL_BUT0},			// 3b
+	{3, 64,  LL_BUT4 | LL_BUT3},					// 4/6
+	{4, 64,  LL_BUT3},								// 2m
+	{3, 1,   LL_BUT3 | LL_BUT0},					// 2
+	{3, 128, LL_BUT4 | LL_BUT0},					// 4m
+	{4, 128, LL_BUT1 | LL_BUT3},					// 3m
+	{3, 2,   LL_BUT1 | LL_BUT2 | LL_BUT3},			// 3
+	{4, 1,   LL_BUT1 | LL_BUT4},					// 5m
+};
+
+static liberlive_event_t ll_events[LL_EVENT_QUEUE_LEN];
+static volatile uint8_t ll_event_head = 0;		// advanced by the main loop
+static volatile uint8_t ll_event_tail = 0;		// advanced by the BTstack callback
+static uint32_t ll_events_dropped = 0;
+
+static uint8_t ll_last_notification[LL_NOTIFICATION_LEN];
+static bool ll_last_valid = false;
+static bool ll_have_fired = false;
+
+static int ll_mode_bit(uint8_t value) {
+	if (value == 0 || (value & (value - 1)) != 0) return -1;
+	return __builtin_ctz(value);
+}
+
+static void liberlive_push_event(const liberlive_event_t *ev) {
+	uint8_t next = (ll_event_tail + 1) % LL_EVENT_QUEUE_LEN;
+
+	if (next == ll_event_head) {
+		ll_events_dropped++;
+		return;
+	}
+
+	ll_events[ll_event_tail] = *ev;
+	__dmb();
+	ll_event_tail = next;
+
+	// The main loop checks the queue on every wakeup.
+	__sev();
+}
+
+void uni_bt_le_liberlive_on_notification(const uint8_t *value, uint32_t value_length) {
+	uint8_t d[LL_NOTIFICATION_LEN] = {0};
+	liberlive_event_t ev = {0};
+	int bit;
+
+	if (value_length > LL_NOTIFICATION_LEN) value_length = LL_NOTIFICATION_LEN;
+	memcpy(d, value, value_length);
+
+	// An unchanged notification would only rebuild the same controller state.
+	bool changed = !ll_last_valid || memcmp(d, ll_last_notification, sizeof(d)) != 0;
+	metrics_hid_report(true, changed);
+	if (!changed) return;
+	memcpy(ll_last_notification, d, sizeof(d));
+	ll_last_valid = true;
+
+	// detect config changes - tap tempo pressed
+
+	bit = ll_mode_bit(d[4]);
+
+	if (d[1] >= 16 && d[5] == 0 && bit > 0) {
+		ev.flags |= LL_EVENT_CONFIG;
+		ev.config_mode = ll_config_modes[bit];
+	}
+
+	// detect paddle neutral
+
+	if (ll_have_fired && d[5] == 0) {
+		ll_have_fired = false;
+		ll_last_valid = false;		// the rest was not decoded, let a repeat through
+		ev.flags |= LL_EVENT_NEUTRAL;
+		liberlive_push_event(&ev);
+		return;
+	}
+
+	ev.tempo = d[7];
+	ev.key = d[1] < sizeof(ll_keys) ? ll_keys[d[1]] : LL_KEY_NONE;
+	ev.paddle = d[5];
+	ev.paddle_a = d[9];
+	ev.paddle_b = d[10];
+
+	// detect strum style - stop/config pressed, otherwise a chord key
+
+	if (d[5] == 64) {
+		ev.flags |= LL_EVENT_STYLE;
+		ev.buttons = bit >= 0 ? ll_style_buttons[bit] : 0;
+	} else {
+		for (size_t i = 0; i < sizeof(ll_chord_keys) / sizeof(ll_chord_keys[0]); i++) {
+			if (d[ll_chord_keys[i].index] == ll_chord_keys[i].value) {
+				ev.flags |= LL_EVENT_CHORD;
+				ev.buttons = ll_chord_keys[i].buttons;
+				break;
+			}
+		}
+	}
+
+	bool handling_required = d[5] == 64 || d[5] == 15 || d[5] == 12 || d[5] == 3;
+
+	if (handling_required && !ll_have_fired) {
+		ll_have_fired = true;
+		ev.flags |= LL_EVENT_FIRE;
+	}
+
+	liberlive_push_event(&ev);
+}
+
+void uni_bt_le_liberlive_reset(void) {
+	ll_have_fired = false;
+	ll_last_valid = false;
+}
+
+static void liberlive_reset_controls(void) {
+	joy_up = false;
+	joy_down = false;
+	knob_up = false;
+	knob_down = false;
+
+	but0 = 0;
+	but1 = 0;
+	but2 = 0;
+	but3 = 0;
+	but4 = 0;
+	but6 = 0;
+	but7 = 0;
+	but9 = 0;
+
+	dpad_left = 0;
+	dpad_right = 0;
+	dpad_up = 0;
+	dpad_down = 0;
+
+	mbut0 = 0;
+	mbut1 = 0;
+	mbut2 = 0;
+	mbut3 = 0;
+}
+
+static void liberlive_apply_buttons(uint8_t buttons) {
+	if (buttons & LL_BUT0) {but0 = 1; red = 0;}
+	if (buttons & LL_BUT1) {but1 = 1; green = 0;}
+	if (buttons & LL_BUT2) {but2 = 1; yellow = 0;}
+	if (buttons & LL_BUT3) {but3 = 1; blue = 0;}
+	if (buttons & LL_BUT4) {but4 = 1; orange = 0;}
+}
+
+// Runs in the main loop, but what an event changes is shared with the looper
+// tick and the rest of the async context: each one is applied holding the
+// context's lock, so the looper editors still run one at a time.
+void uni_bt_le_liberlive_process_events(void) {
+	static int current_tempo = 0;
+	async_context_t *context = cyw43_arch_async_context();
+
+	while (ll_event_head != ll_event_tail) {
+		liberlive_event_t ev = ll_events[ll_event_head];
+		__dmb();
+		ll_event_head = (ll_event_head + 1) % LL_EVENT_QUEUE_LEN;
+
+		async_context_acquire_lock_blocking(context);
+		liberlive_reset_controls();
+
+		if (ev.flags & LL_EVENT_CONFIG) config_guitar(ev.config_mode);
+
+		if (ev.flags & LL_EVENT_NEUTRAL) {
+			cyw43_arch_gpio_put(CYW43_WL_GPIO_LED_PIN, false);
+
+			left = 1;
+			green = 0; red = 0; yellow = 0; blue = 0; orange = 0;
+			gamepad_bluetooth_handle_data();
+			async_context_release_lock(context);
+			continue;
+		}
+
+		// detect tempo changes
+
+		if (ev.tempo != current_tempo) {
+			current_tempo = ev.tempo;
+
+			if (enable_seqtrak) midi_seqtrak_tempo(current_tempo);
+			if (enable_modx) 	midi_modx_tempo(current_tempo);
+		}
+
+		// detect key change
+
+		uint8_t old_key = transpose;
+
+		if (ev.key != LL_KEY_NONE) transpose = ev.key;
+
+		if (old_key != transpose && ev.paddle == 0)
+		{
+			if (enable_seqtrak) midi_seqtrak_key(transpose);
+		}
+
+		if (ev.flags & LL_EVENT_STYLE) {
+			but6 = 1; pitch = 0;
+		}
+
+		liberlive_apply_buttons(ev.buttons);
+		bool chord_selected = (ev.flags & LL_EVENT_CHORD) != 0;
+
+		if (ev.paddle == 15) {											// Paddle A+B
+			if (ev.paddle_b < 48) { 									// UP
+				mbut0 = 1; logo = 0;
+			}
+			else
+
+			if (ev.paddle_b > 58) { 									// DOWN
+				mbut0 = 1; logo = 0;
+			}
+		}
+		else
+
+		if (ev.paddle == 12) {											// Paddle A
+			if (ev.paddle_a < 48) { 									// UP
+				applied_velocity = (50 - ev.paddle_a) / 50;
+
+				if (chord_selected) {
+					dpad_right = 1; right = 0;
+				} else {
+					joy_down = true; joystick_down = 0;					// break
+				}
+			}
+			else
+
+			if (ev.paddle_a > 58) { 									// DOWN
+				applied_velocity = ev.paddle_a / 50;
+
+				if (chord_selected) {
+					dpad_left = 1;	left = 0;
+				} else {
+					joy_up = true; joystick_up = 0;						// fill
+				}
+			}
+		}
+		else
+
+		if (ev.paddle == 3) {											// Paddle B
+			if (ev.paddle_b < 48) { 									// UP
+				applied_velocity = (50 - ev.paddle_b) / 50;
+
+				if (chord_selected) {
+					dpad_right = 1; right = 0;
+				} else {
+					dpad_down = 1; starpower = 0; orange = 0; but4 = 1;	// prev style
+				}
+			}
+			else
+
+			if (ev.paddle_b > 58) { 									// DOWN
+				applied_velocity = ev.paddle_b / 50;
+
+				if (chord_selected) {
+					dpad_left = 1;	left = 0;
+				} else {
+					dpad_down = 1; starpower = 0; 						// next style
+				}
+			}
+		}
+
+		if (ev.flags & LL_EVENT_FIRE) {
+			gamepad_bluetooth_handle_data();
+			cyw43_arch_gpio_put(CYW43_WL_GPIO_LED_PIN, true);
+		}
+		async_context_release_lock(context);
+	}
+}
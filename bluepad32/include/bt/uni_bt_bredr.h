@@ -34,6 +34,17 @@ bool uni_bt_bredr_is_enabled(void);
 void uni_bt_bredr_l2cap_create_control_connection(uni_hid_device_t* d);
 void uni_bt_bredr_process_fsm(uni_hid_device_t* d);
 
+// Pages an already bonded device directly, without inquiry, remote name request or SDP query.
+// The caller provides what those steps would have fetched, usually from a cache filled
+// in a previous session. Must be called from the BTstack context.
+uni_hid_device_t* uni_bt_bredr_connect_known_device(bd_addr_t addr,
+                                                    uint32_t cod,
+                                                    const char* name,
+                                                    uint16_t vendor_id,
+                                                    uint16_t product_id,
+                                                    const uint8_t* hid_descriptor,
+                                                    int hid_descriptor_len);
+
 void uni_bt_bredr_on_l2cap_incoming_connection(uint16_t channel, const uint8_t* packet, uint16_t size);
 void uni_bt_bredr_on_l2cap_channel_opened(uint16_t channel, const uint8_t* packet, uint16_t size);
 void uni_bt_bredr_on_l2cap_channel_closed(uint16_t channel, const uint8_t* packet, uint16_t size);
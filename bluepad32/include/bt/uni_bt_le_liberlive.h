@@ -0,0 +1,26 @@
+// Liberlive / Sonic Master notifications, decoded apart from BTstack.
+
+#ifndef UNI_BT_LE_LIBERLIVE_H
+#define UNI_BT_LE_LIBERLIVE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// BTstack callback: decodes a notification and queues the event.
+void uni_bt_le_liberlive_on_notification(const uint8_t* value, uint32_t value_length);
+
+// A new connection starts with the paddle in neutral and nothing seen yet.
+void uni_bt_le_liberlive_reset(void);
+
+// Applies queued Liberlive notifications, call from the main loop.
+void uni_bt_le_liberlive_process_events(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // UNI_BT_LE_LIBERLIVE_H
@@ -42,13 +42,10 @@ static void print_track(const track_t *track, uint8_t track_number, bool is_sele
     else
         printf("#track %u _ %-11s ", track_number + 1, track->name);
 
-    ghost_parameters_t *params = ghost_note_parameters();
-    for (int i = 0; i < LOOPER_TOTAL_STEPS; ++i) {
+    for (int i = 0; i < looper_geometry_get()->total_steps; ++i) {
         bool note_on = track->pattern[i];
-        bool ghost_on =
-            ((float)track->ghost_notes[i].probability / 100.0f) * params->ghost_intensity >
-            (float)track->ghost_notes[i].rand_sample / 100.0f;
-        bool fill_on = track->fill_pattern[i];
+        bool ghost_on = looper_step_bit(track->ghost_mask, i);
+        bool fill_on = looper_step_bit(track->fill_mask, i);
         if (note_on)
             printf("*");
         else if (fill_on)
@@ -63,7 +60,7 @@ static void print_track(const track_t *track, uint8_t track_number, bool is_sele
 
 static void print_step(uint8_t current_step) {
     printf("#step                  ");
-    for (int i = 0; i < LOOPER_TOTAL_STEPS; ++i) {
+    for (int i = 0; i < looper_geometry_get()->total_steps; ++i) {
         if (i == current_step)
             printf("^");
         else
@@ -0,0 +1,127 @@
+/**
+ * Event-driven main loop
+ *
+ * Interrupts, async_context callbacks and core 1 flag the work they leave
+ * for the core 0 main loop with event_loop_signal(), which also executes SEV.
+ * The main loop sleeps in WFE while nothing is flagged. A SEV issued between
+ * the check and the WFE leaves the event register set, so the WFE returns at
+ * once and no wakeup is lost.
+ *
+ * Time spent in WFE is accounted per core to report the load. Building with
+ * EVENT_LOOP_MEASURE_WAKEUP also records the time from the first signal to
+ * the main loop picking it up.
+ */
+#include "event_loop.h"
+
+#include "hardware/sync.h"
+#include "pico/platform.h"
+#include "pico/sync.h"
+#include "pico/time.h"
+
+#include "debug.h"
+
+static critical_section_t events_cs;
+static volatile uint32_t pending_events = 0;
+
+static uint64_t start_us;
+static volatile uint64_t idle_us[2];
+static uint32_t wakeups = 0;
+
+#ifdef EVENT_LOOP_MEASURE_WAKEUP
+static uint32_t signalled_us;
+static uint32_t latency_max_us = 0;
+static uint32_t latency_hist[EVENT_LOOP_LATENCY_BUCKETS];
+static uint32_t last_report_us = 0;
+
+static const uint32_t latency_limits_us[EVENT_LOOP_LATENCY_BUCKETS - 1] = {10, 50, 100, 500, 1000};
+
+static void record_latency(uint32_t signalled, uint32_t now) {
+    uint32_t latency = now - signalled;
+    size_t bucket = 0;
+
+    while (bucket < EVENT_LOOP_LATENCY_BUCKETS - 1 && latency >= latency_limits_us[bucket])
+        bucket++;
+    latency_hist[bucket]++;
+    if (latency > latency_max_us)
+        latency_max_us = latency;
+
+    if (now - last_report_us >= 1000000) {
+        last_report_us = now;
+        PICO_INFO("[LOOP] wakeup latency max %lu us, <10:%lu <50:%lu <100:%lu <500:%lu <1000:%lu >=1000:%lu\n",
+                  (unsigned long)latency_max_us, (unsigned long)latency_hist[0], (unsigned long)latency_hist[1],
+                  (unsigned long)latency_hist[2], (unsigned long)latency_hist[3], (unsigned long)latency_hist[4],
+                  (unsigned long)latency_hist[5]);
+    }
+}
+#endif
+
+void event_loop_init(void) {
+    critical_section_init(&events_cs);
+    start_us = time_us_64();
+}
+
+void event_loop_signal(uint32_t events) {
+    critical_section_enter_blocking(&events_cs);
+#ifdef EVENT_LOOP_MEASURE_WAKEUP
+    if (pending_events == 0)
+        signalled_us = time_us_32();
+#endif
+    pending_events |= events;
+    critical_section_exit(&events_cs);
+    __sev();
+}
+
+static uint32_t take_events(uint32_t *signalled) {
+    critical_section_enter_blocking(&events_cs);
+    uint32_t events = pending_events;
+    pending_events = 0;
+#ifdef EVENT_LOOP_MEASURE_WAKEUP
+    *signalled = signalled_us;
+#else
+    (void)signalled;
+#endif
+    critical_section_exit(&events_cs);
+    return events;
+}
+
+uint32_t event_loop_wait(void) {
+    uint32_t signalled = 0;
+    uint32_t events = take_events(&signalled);
+
+    if (events == 0) {
+        event_loop_idle();
+        events = take_events(&signalled);
+        if (events == 0)
+            return 0;
+    }
+
+#ifdef EVENT_LOOP_MEASURE_WAKEUP
+    record_latency(signalled, time_us_32());
+#endif
+    wakeups++;
+    return events;
+}
+
+void event_loop_idle(void) {
+    uint core = get_core_num();
+    uint64_t start = time_us_64();
+
+    __wfe();
+    idle_us[core] += time_us_64() - start;
+}
+
+void event_loop_get_stats(event_loop_stats_t *stats) {
+    uint64_t total = time_us_64() - start_us;
+
+    stats->wakeups = wakeups;
+    for (int core = 0; core < 2; core++) {
+        uint64_t idle = idle_us[core];
+        stats->total_us[core] = total;
+        stats->busy_us[core] = idle < total ? total - idle : 0;
+    }
+#ifdef EVENT_LOOP_MEASURE_WAKEUP
+    stats->latency_max_us = latency_max_us;
+    for (int i = 0; i < EVENT_LOOP_LATENCY_BUCKETS; i++)
+        stats->latency_hist[i] = latency_hist[i];
+#endif
+}
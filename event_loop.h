@@ -0,0 +1,40 @@
+#ifndef EVENT_LOOP_H_
+#define EVENT_LOOP_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Work for the core 0 main loop, set from interrupts, callbacks or core 1.
+#define EVENT_LOOP_UART_RX     0x01  // bytes in the UART MIDI RX ring
+#define EVENT_LOOP_MIDI_INPUT  0x02  // bytes from the USB host queued by core 1
+#define EVENT_LOOP_NOTE_DUE    0x04  // a scheduled note is pending
+#define EVENT_LOOP_PREFERENCES 0x08  // preferences need saving
+
+#define EVENT_LOOP_LATENCY_BUCKETS 6
+
+typedef struct {
+    uint32_t wakeups;      // event_loop_wait() returned with work
+    uint64_t busy_us[2];   // per core, time outside event_loop_idle()
+    uint64_t total_us[2];
+#ifdef EVENT_LOOP_MEASURE_WAKEUP
+    // signal -> main loop running, buckets <10, <50, <100, <500, <1000, >=1000 us
+    uint32_t latency_max_us;
+    uint32_t latency_hist[EVENT_LOOP_LATENCY_BUCKETS];
+#endif
+} event_loop_stats_t;
+
+void event_loop_init(void);
+
+// Any core or interrupt: flag work and wake core 0.
+void event_loop_signal(uint32_t events);
+
+// Core 0 main loop: sleep until signalled, return and clear the pending events.
+// May return 0 after a wakeup that carried no flag.
+uint32_t event_loop_wait(void);
+
+// Sleep the calling core until the next event or interrupt.
+void event_loop_idle(void);
+
+void event_loop_get_stats(event_loop_stats_t *stats);
+
+#endif  // EVENT_LOOP_H_
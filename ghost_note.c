@@ -11,13 +11,44 @@
 
 #include "looper.h"
 
+#include "trace.h"
+
 #define DENSITY_WIN_HALF 8
-#define CHANCE(p) ((rand() / (RAND_MAX + 1.0)) < (p))
+#define DENSITY_WIN_LEN (DENSITY_WIN_HALF * 2 + 1)
+
+#define GHOST_NOTE_TRACKS 14
+#define GHOST_FILL_TRACKS 2               // kick and snare
+#define GHOST_RNG_FILL GHOST_NOTE_TRACKS  // stream for where fills start
+#define GHOST_JOB_ITEMS_PER_STEP 2
+
+// Pattern notes within DENSITY_WIN_HALF steps of each step, taken from the
+// looper pattern pool. Counted again only when the track's revision moved on.
+static uint8_t *note_density_track_window[GHOST_NOTE_TRACKS];
+static uint16_t density_revision[GHOST_NOTE_TRACKS];
+static bool density_stale[GHOST_NOTE_TRACKS];
 
-static float note_density_track_window[14][LOOPER_TOTAL_STEPS];
+// xorshift32 per track plus one for the fills, so a seed replays the same
+// ghost notes whatever the other tracks do.
+static uint32_t rng_state[GHOST_NOTE_TRACKS + 1];
 
 static bool pending_fill_request = false;
 
+// Staging of the background job, from the looper pattern pool as well.
+static ghost_note_t *next_ghost[GHOST_NOTE_TRACKS];
+static uint32_t *next_ghost_mask[GHOST_NOTE_TRACKS];
+static uint16_t next_ghost_revision[GHOST_NOTE_TRACKS];
+static uint16_t next_ghost_intensity[GHOST_NOTE_TRACKS];  // intensity_revision of the mask
+static ghost_note_t *next_fill_ghost[GHOST_FILL_TRACKS];
+static bool *next_fill[GHOST_FILL_TRACKS];
+static uint16_t next_fill_revision[GHOST_FILL_TRACKS];
+static size_t next_fill_start;
+static bool fill_staged = false;
+static size_t job_item = 0;  // fill tracks first, then ghost tracks
+
+// Bumped by ghost_note_set_intensity(), the masks follow on the next step.
+static uint16_t intensity_revision = 0;
+static bool intensity_changed = false;
+
 static ghost_parameters_t parameters = {
     .ghost_intensity = 0.843,
     .swing_ratio = 0.5,
@@ -87,30 +118,41 @@ float ghost_note_modulate_swing_ratio(float lfo) {
     return swing;
 }
 
-static double rand_standard_normal(void) {
-    static int has_spare = 0;
-    static double spare;
-    if (has_spare) {
-        has_spare = 0;
-        return spare;
+// Seeds every stream from one value; each gets a different, non-zero state.
+void ghost_note_seed(uint32_t seed) {
+    for (size_t i = 0; i <= GHOST_NOTE_TRACKS; i++) {
+        uint32_t z = seed + (uint32_t)(i + 1) * 0x9E3779B9u;  // splitmix32
+        z = (z ^ (z >> 16)) * 0x85EBCA6Bu;
+        z = (z ^ (z >> 13)) * 0xC2B2AE35u;
+        z ^= z >> 16;
+        rng_state[i] = z ? z : 0x6D2B79F5u;
     }
-    has_spare = 1;
-
-    double u, v, s;
-    do {
-        u = rand() / (double)RAND_MAX * 2.0 - 1.0;
-        v = rand() / (double)RAND_MAX * 2.0 - 1.0;
-        s = u * u + v * v;
-    } while (s >= 1.0 || s == 0.0);
-
-    s = sqrt(-2.0 * log(s) / s);
-    spare = v * s;
-    return u * s;
 }
 
-static double rand_normal(double mu, double sigma2) {
-    double sigma = sqrt(sigma2);
-    return mu + sigma * rand_standard_normal();
+static inline uint32_t rng_next(size_t stream) {
+    uint32_t x = rng_state[stream];
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    rng_state[stream] = x;
+    return x;
+}
+
+// 0 .. n - 1, by multiply and shift rather than a division.
+static inline uint32_t rng_below(size_t stream, uint32_t n) {
+    return (uint32_t)(((uint64_t)rng_next(stream) * n) >> 32);
+}
+
+static inline bool rng_chance(size_t stream, float p) {
+    return (rng_next(stream) >> 8) * (1.0f / 16777216.0f) < p;
+}
+
+// Normal deviate from the sum of four uniform bytes (Irwin-Hall), close
+// enough for placing a fill, without log() or a rejection loop.
+static float rand_normal(size_t stream, float mu, float sigma) {
+    uint32_t x = rng_next(stream);
+    int32_t sum = (x & 0xFF) + ((x >> 8) & 0xFF) + ((x >> 16) & 0xFF) + (x >> 24);
+    return mu + sigma * (sum - 510) * (1.0f / 147.8f);
 }
 
 static inline int clamp_int(int x, int lo, int hi) {
@@ -121,6 +163,15 @@ static inline int clamp_int(int x, int lo, int hi) {
     return x;
 }
 
+// Step index moved back into the loop, without a division.
+static inline size_t wrap_step(int pos, int total_steps) {
+    while (pos < 0)
+        pos += total_steps;
+    while (pos >= total_steps)
+        pos -= total_steps;
+    return (size_t)pos;
+}
+
 // Count existing user notes
 static uint8_t count_user_notes(const bool note_pattern[], size_t len) {
     uint8_t n = 0;
@@ -143,170 +194,305 @@ static uint8_t calculate_extra_note_count(uint8_t current) {
 }
 
 // Apply the ghost notes
-static void apply_euclidean_ghost_notes(track_t *track, uint8_t total_notes, uint8_t offset) {
+static void apply_euclidean_ghost_notes(track_t *track, size_t t, uint8_t total_notes, uint8_t offset) {
     euclidean_parameters_t *euclid = &parameters.euclidean;
-    float density = total_notes / (float)LOOPER_TOTAL_STEPS;
+    uint16_t total_steps = looper_geometry_get()->total_steps;
+    float density = total_notes / (float)total_steps;
     uint32_t euclid_accumulator = 0;
 
-    for (size_t i = 0; i < LOOPER_TOTAL_STEPS; i++) {
+    for (size_t i = 0; i < total_steps; i++) {
         euclid_accumulator += total_notes;
-        if (euclid_accumulator >= LOOPER_TOTAL_STEPS) {
-            euclid_accumulator -= LOOPER_TOTAL_STEPS;
-            size_t pos = (i + offset) % LOOPER_TOTAL_STEPS;
+        if (euclid_accumulator >= total_steps) {
+            euclid_accumulator -= total_steps;
+            size_t pos = wrap_step(i + offset, total_steps);
 
             if (!track->pattern[pos] && track->ghost_notes[pos].rand_sample == 0) {
                 float probability = euclid->probability * (1.0f - density);
                 uint8_t prob = (uint8_t)roundf(clamp_int(probability * 100.0f, 0, 100));
                 track->ghost_notes[pos].probability = prob;
-                track->ghost_notes[pos].rand_sample = rand() % 100;
+                track->ghost_notes[pos].rand_sample = rng_below(t, 100);
             }
         }
     }
 }
 
 // Add Euclidean ghost notes to the track
-static void add_euclidean_ghost_notes(track_t *track) {
+static void add_euclidean_ghost_notes(track_t *track, size_t t) {
     euclidean_parameters_t *euclid = &parameters.euclidean;
+    uint16_t total_steps = looper_geometry_get()->total_steps;
 
-    uint8_t n = count_user_notes(track->pattern, LOOPER_TOTAL_STEPS);
-    if (n == 0 || n >= LOOPER_TOTAL_STEPS)
+    uint8_t n = count_user_notes(track->pattern, total_steps);
+    if (n == 0 || n >= total_steps)
         return;
 
     uint8_t extra_note_count = calculate_extra_note_count(n);
     uint8_t target_note_count = clamp_int(n + extra_note_count, 1, euclid->k_max);
 
-    uint8_t phase_step_count = LOOPER_TOTAL_STEPS / target_note_count;
-    uint8_t phase_offset = rand() % phase_step_count;
+    uint8_t phase_step_count = total_steps / target_note_count;
+    if (phase_step_count == 0)
+        return;
+    uint8_t phase_offset = rng_below(t, phase_step_count);
 
-    apply_euclidean_ghost_notes(track, target_note_count, phase_offset);
+    apply_euclidean_ghost_notes(track, t, target_note_count, phase_offset);
 }
 
 // 1/16th positions around the user input
-static void add_boundary_notes(track_t *track) {
+static void add_boundary_notes(track_t *track, size_t t) {
     boundary_parameters_t *boundary = &parameters.boundary;
+    uint16_t total_steps = looper_geometry_get()->total_steps;
+
+    for (size_t i = 0; i < total_steps; i++) {
+        size_t before = i == 0 ? (size_t)total_steps - 1 : i - 1;
+        size_t after = i + 1 == total_steps ? 0 : i + 1;
 
-    for (size_t i = 0; i < LOOPER_TOTAL_STEPS; i++) {
-        if (track->pattern[i] &&
-            !track->pattern[(LOOPER_TOTAL_STEPS + i - 1) % LOOPER_TOTAL_STEPS] &&
-            !track->ghost_notes[i].rand_sample) {
-            track->ghost_notes[(LOOPER_TOTAL_STEPS + i - 1) % LOOPER_TOTAL_STEPS].probability =
-                (uint8_t)(boundary->before_probability * 100);
-            track->ghost_notes[(LOOPER_TOTAL_STEPS + i - 1) % LOOPER_TOTAL_STEPS].rand_sample =
-                rand() % 100;
+        if (track->pattern[i] && !track->pattern[before] && !track->ghost_notes[i].rand_sample) {
+            track->ghost_notes[before].probability = (uint8_t)(boundary->before_probability * 100);
+            track->ghost_notes[before].rand_sample = rng_below(t, 100);
         }
-        if (track->pattern[i] && !track->pattern[(i + 1) % LOOPER_TOTAL_STEPS] &&
-            !track->ghost_notes[i].rand_sample) {
-            track->ghost_notes[(i + 1) % LOOPER_TOTAL_STEPS].probability =
-                (uint8_t)(boundary->after_probability * 100);
-            track->ghost_notes[(i + 1) % LOOPER_TOTAL_STEPS].rand_sample = rand() % 100;
+        if (track->pattern[i] && !track->pattern[after] && !track->ghost_notes[i].rand_sample) {
+            track->ghost_notes[after].probability = (uint8_t)(boundary->after_probability * 100);
+            track->ghost_notes[after].rand_sample = rng_below(t, 100);
         }
     }
 }
 
-static float track_window_density(track_t *track, uint8_t step, uint8_t window) {
-    uint8_t n = 0;
-    for (int i = -window; i <= window; i++) {
-        size_t pos = (LOOPER_TOTAL_STEPS + step + i) % LOOPER_TOTAL_STEPS;
-        n += (uint8_t)track->pattern[pos];
+// Ghost notes firing at the current intensity, leaving out the steps of
+// `fill_pattern` when given.
+static void build_ghost_mask(const ghost_note_t *ghost_notes, const bool *fill_pattern, uint32_t *mask) {
+    uint16_t total_steps = looper_geometry_get()->total_steps;
+    float intensity = parameters.ghost_intensity;
+
+    memset(mask, 0, LOOPER_MASK_WORDS(total_steps) * sizeof(uint32_t));
+    for (uint16_t i = 0; i < total_steps; i++) {
+        bool ghost_on = ((float)ghost_notes[i].probability / 100.0f) * intensity >
+                        (float)ghost_notes[i].rand_sample / 100.0f;
+        if (ghost_on && !(fill_pattern && fill_pattern[i]))
+            mask[i >> 5] |= 1u << (i & 31);
     }
-    return (float)n / (float)(window * 2 + 1);
 }
 
-static void update_density_track_window(void) {
-    size_t num_tracks;
-    track_t *tracks = looper_tracks_get(&num_tracks);
-    for (size_t t = 0; t < num_tracks; t++) {
-        for (size_t i = 0; i < LOOPER_TOTAL_STEPS; i++) {
-            note_density_track_window[t][i] = track_window_density(&tracks[t], i, DENSITY_WIN_HALF);
+/*
+ * Rebuilds the bits the tick tests for a track, after its ghost notes or
+ * fills changed. The probability test only needs redoing when they or
+ * the intensity change, not on every step.
+ */
+void ghost_note_update_masks(track_t *track) {
+    uint16_t total_steps = looper_geometry_get()->total_steps;
+
+    build_ghost_mask(track->ghost_notes, track->fill_pattern, track->ghost_mask);
+    memset(track->fill_mask, 0, LOOPER_MASK_WORDS(total_steps) * sizeof(uint32_t));
+    for (uint16_t i = 0; i < total_steps; i++) {
+        if (track->fill_pattern[i])
+            track->fill_mask[i >> 5] |= 1u << (i & 31);
+    }
+}
+
+// Takes effect on the next step, with the ghost layer kept as it is.
+void ghost_note_set_intensity(float intensity) {
+    parameters.ghost_intensity = intensity;
+    intensity_revision++;
+    intensity_changed = true;
+}
+
+// Slides the window along the loop: one note enters and one leaves per step.
+static void count_density_window(const track_t *track, uint8_t *window) {
+    int total_steps = looper_geometry_get()->total_steps;
+    size_t enter = wrap_step(DENSITY_WIN_HALF + 1, total_steps);
+    size_t leave = wrap_step(-DENSITY_WIN_HALF, total_steps);
+    int n = 0;
+
+    for (int i = -DENSITY_WIN_HALF; i <= DENSITY_WIN_HALF; i++)
+        n += track->pattern[wrap_step(i, total_steps)];
+
+    for (int i = 0; i < total_steps; i++) {
+        window[i] = (uint8_t)n;
+        n += (int)track->pattern[enter] - (int)track->pattern[leave];
+        if (++enter == (size_t)total_steps)
+            enter = 0;
+        if (++leave == (size_t)total_steps)
+            leave = 0;
+    }
+}
+
+static void update_density_track_window(size_t t, const track_t *track) {
+    if (t >= GHOST_NOTE_TRACKS || (!density_stale[t] && density_revision[t] == track->revision))
+        return;
+
+    count_density_window(track, note_density_track_window[t]);
+    density_revision[t] = track->revision;
+    density_stale[t] = false;
+}
+
+// Fill-in notes for one track from `fill_start` to the end of the loop.
+static void add_fillin_track(track_t *track, size_t t, size_t fill_start) {
+    fill_parameters_t *fill = &parameters.fill;
+    uint16_t total_steps = looper_geometry_get()->total_steps;
+
+    update_density_track_window(t, track);
+
+    for (size_t i = fill_start; i < total_steps; i++) {
+        bool ghost_on = (float)(track->ghost_notes[i].probability / 100.0f) *
+                            parameters.ghost_intensity >
+                        (float)track->ghost_notes[i].rand_sample / 100.0f;
+        if (!ghost_on) {
+            track->ghost_notes[i].probability =
+                (uint8_t)((1.0f - note_density_track_window[t][i] / (float)DENSITY_WIN_LEN) * 25.0f);
+            track->ghost_notes[i].rand_sample = rng_below(t, 100);
         }
+        if (((float)track->ghost_notes[i].probability / 100.0f) *
+                parameters.ghost_intensity >
+            (float)(track->ghost_notes[i].rand_sample / 100))
+            track->fill_pattern[i] = rng_chance(t, fill->probability * parameters.ghost_intensity);
     }
 }
 
-// Add ghost fill-in notes based on track density and randomized start
-static void add_fillin_notes(void) {
+// Randomized start of the next fill.
+static size_t draw_fill_start(void) {
+    fill_parameters_t *fill = &parameters.fill;
+    uint16_t total_steps = looper_geometry_get()->total_steps;
+
+    // The fill start has always been drawn with start_sd as the variance.
+    int fill_start = total_steps - abs((int8_t)rand_normal(GHOST_RNG_FILL, fill->start_mean, sqrtf(fill->start_sd)));
+    return fill_start < 0 ? 0 : (size_t)fill_start;
+}
+
+static void add_fillin_notes_now(void) {
+    looper_status_t *looper_status = looper_status_get();
     size_t num_tracks;
     track_t *tracks = looper_tracks_get(&num_tracks);
-    fill_parameters_t *fill = &parameters.fill;
 
-    update_density_track_window();
+    for (size_t t = 0; t < num_tracks && t < GHOST_FILL_TRACKS; t++) {
+        add_fillin_track(&tracks[t], t, looper_status->current_step);
+        ghost_note_update_masks(&tracks[t]);
+    }
+    fill_staged = false;  // it was drawn over the ghost notes just changed
+}
+
+/*
+ * Background job: the next ghost layer and the next fill are prepared a
+ * track or two per step, into staging storage, so the first step of a bar
+ * only copies them in. Staging starts over after each new ghost layer:
+ * the fill first, as it is due first and drawn over the current layer,
+ * then the ghost notes of every track. A track edited since it was staged,
+ * or staging not finished in a very short loop, is generated on the spot.
+ */
+static void ghost_job_run(track_t *tracks, size_t num_tracks) {
+    uint16_t total_steps = looper_geometry_get()->total_steps;
+
+    for (int n = 0; n < GHOST_JOB_ITEMS_PER_STEP && job_item < GHOST_FILL_TRACKS + num_tracks; n++, job_item++) {
+        if (job_item < GHOST_FILL_TRACKS) {
+            size_t t = job_item;
+            if (t >= num_tracks)
+                continue;
+            if (t == 0)
+                next_fill_start = draw_fill_start();
+
+            track_t view = tracks[t];
+            view.ghost_notes = next_fill_ghost[t];
+            view.fill_pattern = next_fill[t];
+            memcpy(view.ghost_notes, tracks[t].ghost_notes, total_steps * sizeof(ghost_note_t));
+            memset(view.fill_pattern, 0, total_steps * sizeof(bool));
+            add_fillin_track(&view, t, next_fill_start);
+            next_fill_revision[t] = tracks[t].revision;
+            fill_staged = true;
+        } else {
+            size_t t = job_item - GHOST_FILL_TRACKS;
+
+            track_t view = tracks[t];
+            view.ghost_notes = next_ghost[t];
+            ghost_note_create(&view, t);
+            // Fills are cleared on the step the layer goes live.
+            build_ghost_mask(view.ghost_notes, NULL, next_ghost_mask[t]);
+            next_ghost_revision[t] = tracks[t].revision;
+            next_ghost_intensity[t] = intensity_revision;
+        }
+    }
+}
+
+// First step of the creation bar: the staged ghost layer goes live.
+static void ghost_layer_swap(track_t *tracks, size_t num_tracks) {
+    uint16_t total_steps = looper_geometry_get()->total_steps;
 
-    uint16_t fill_start =
-        LOOPER_TOTAL_STEPS - abs((int8_t)rand_normal(fill->start_mean, fill->start_sd));
     for (size_t t = 0; t < num_tracks; t++) {
-        if (t != 0 && t != 1)
-            continue;
-
-        for (size_t i = fill_start; i < LOOPER_TOTAL_STEPS; i++) {
-            bool ghost_on = (float)(tracks[t].ghost_notes[i].probability / 100.0f) *
-                                parameters.ghost_intensity >
-                            (float)tracks[t].ghost_notes[i].rand_sample / 100.0f;
-            if (!ghost_on) {
-                tracks[t].ghost_notes[i].probability =
-                    (uint8_t)((1.0 - note_density_track_window[t][i]) * 0.25 * 100.0f);
-                tracks[t].ghost_notes[i].rand_sample = rand() % 100;
-            }
-            if (((float)tracks[t].ghost_notes[i].probability / 100.0f) *
-                    parameters.ghost_intensity >
-                (float)(tracks[t].ghost_notes[i].rand_sample / 100))
-                tracks[t].fill_pattern[i] = CHANCE(fill->probability * parameters.ghost_intensity);
+        bool staged = job_item > GHOST_FILL_TRACKS + t && next_ghost_revision[t] == tracks[t].revision;
+
+        if (staged) {
+            memcpy(tracks[t].ghost_notes, next_ghost[t], total_steps * sizeof(ghost_note_t));
+            if (next_ghost_intensity[t] == intensity_revision)
+                memcpy(tracks[t].ghost_mask, next_ghost_mask[t], LOOPER_MASK_WORDS(total_steps) * sizeof(uint32_t));
+            else
+                ghost_note_update_masks(&tracks[t]);
+        } else {
+            ghost_note_create(&tracks[t], t);
+            ghost_note_update_masks(&tracks[t]);
         }
     }
+    job_item = 0;
+    fill_staged = false;
 }
 
-static void add_fillin_notes_now(void) {
-    looper_status_t *looper_status = looper_status_get();
+// First step of the fill-in bar: the staged fill goes live.
+static void add_fillin_notes(void) {
     size_t num_tracks;
     track_t *tracks = looper_tracks_get(&num_tracks);
-    fill_parameters_t *fill = &parameters.fill;
+    uint16_t total_steps = looper_geometry_get()->total_steps;
+    size_t fill_start = job_item > 0 ? next_fill_start : draw_fill_start();
 
-    update_density_track_window();
+    for (size_t t = 0; t < num_tracks && t < GHOST_FILL_TRACKS; t++) {
+        bool staged = fill_staged && job_item > t && next_fill_revision[t] == tracks[t].revision;
 
-    uint16_t fill_start = looper_status->current_step;
-    for (size_t t = 0; t < num_tracks; t++) {
-        if (t != 0 && t != 1)
-            continue;
-
-        for (size_t i = fill_start; i < LOOPER_TOTAL_STEPS; i++) {
-            bool ghost_on = (float)(tracks[t].ghost_notes[i].probability / 100.0f) *
-                                parameters.ghost_intensity >
-                            (float)tracks[t].ghost_notes[i].rand_sample / 100.0f;
-            if (!ghost_on) {
-                tracks[t].ghost_notes[i].probability =
-                    (uint8_t)((1.0 - note_density_track_window[t][i]) * 0.25 * 100.0f);
-                tracks[t].ghost_notes[i].rand_sample = rand() % 100;
-            }
-            if (((float)tracks[t].ghost_notes[i].probability / 100.0f) *
-                    parameters.ghost_intensity >
-                (float)(tracks[t].ghost_notes[i].rand_sample / 100))
-                tracks[t].fill_pattern[i] = CHANCE(fill->probability * parameters.ghost_intensity);
+        if (staged) {
+            memcpy(tracks[t].ghost_notes, next_fill_ghost[t], total_steps * sizeof(ghost_note_t));
+            memcpy(tracks[t].fill_pattern, next_fill[t], total_steps * sizeof(bool));
+        } else {
+            add_fillin_track(&tracks[t], t, fill_start);
         }
+        ghost_note_update_masks(&tracks[t]);
     }
+    fill_staged = false;
 }
 
 static float pattern_density(void) {
     size_t num_tracks;
     track_t *tracks = looper_tracks_get(&num_tracks);
-    uint8_t n = 0;
+    uint16_t total_steps = looper_geometry_get()->total_steps;
+    uint32_t n = 0;
 
     for (size_t t = 0; t < num_tracks; t++) {
-        for (size_t i = 0; i < LOOPER_TOTAL_STEPS; i++) n += (uint8_t)tracks[t].pattern[i];
+        for (size_t i = 0; i < total_steps; i++) n += (uint8_t)tracks[t].pattern[i];
     }
-    return n / (float)(num_tracks * LOOPER_TOTAL_STEPS);
+    return n / (float)(num_tracks * total_steps);
 }
 
-void ghost_note_create(track_t *track) {
-    memset(track->ghost_notes, 0, sizeof(track->ghost_notes));
+// Called by the looper after it carved up its pool for a new geometry.
+void ghost_note_resize(size_t num_tracks) {
+    uint16_t total_steps = looper_geometry_get()->total_steps;
 
-    add_euclidean_ghost_notes(track);
-    add_boundary_notes(track);
+    for (size_t t = 0; t < num_tracks && t < GHOST_NOTE_TRACKS; t++) {
+        note_density_track_window[t] = looper_pool_alloc(total_steps * sizeof(uint8_t));
+        density_stale[t] = true;
+        next_ghost[t] = looper_pool_alloc(total_steps * sizeof(ghost_note_t));
+        next_ghost_mask[t] = looper_pool_alloc(LOOPER_MASK_WORDS(total_steps) * sizeof(uint32_t));
+    }
+    for (size_t t = 0; t < GHOST_FILL_TRACKS; t++) {
+        next_fill_ghost[t] = looper_pool_alloc(total_steps * sizeof(ghost_note_t));
+        next_fill[t] = looper_pool_alloc(total_steps * sizeof(bool));
+    }
+    job_item = 0;
+    fill_staged = false;
 }
 
-static inline bool is_first_step(looper_status_t *s) { return s->current_step == 0; }
+void ghost_note_create(track_t *track, size_t track_num) {
+    memset(track->ghost_notes, 0, looper_geometry_get()->total_steps * sizeof(ghost_note_t));
 
-static inline bool is_bar_start(looper_status_t *s) {
-    return s->current_step % (LOOPER_BEATS_PER_BAR * LOOPER_STEPS_PER_BEAT) == 0;
+    add_euclidean_ghost_notes(track, track_num);
+    add_boundary_notes(track, track_num);
 }
 
+static inline bool is_first_step(looper_status_t *s) { return s->current_step == 0; }
+
+static inline bool is_bar_start(looper_status_t *s) { return s->bar_step == 0; }
+
 static inline bool is_creation_bar(looper_status_t *s) { return s->ghost_bar_counter == 0; }
 
 static inline bool is_fillin_bar(looper_status_t *s) {
@@ -317,24 +503,32 @@ static inline bool is_fillin_bar(looper_status_t *s) {
 void ghost_note_set_pending_fill_request(void) { pending_fill_request = true; }
 
 void ghost_note_maintenance_step(void) {
+    TRACE(TRACE_GHOST_BEGIN, looper_status_get()->current_step, 0);
     looper_status_t *looper_status = looper_status_get();
     size_t num_tracks;
     track_t *tracks = looper_tracks_get(&num_tracks);
     fill_parameters_t *fill = &parameters.fill;
+    // Ghost notes and fills only change on the first step or on request.
+    bool edited = is_first_step(looper_status) || pending_fill_request || intensity_changed;
 
     if (is_bar_start(looper_status))
         looper_status->ghost_bar_counter =
             (looper_status->ghost_bar_counter + 1) % fill->interval_bar;
 
     if (is_first_step(looper_status)) {
-        for (size_t i = 0; i < num_tracks; i++)
-            memset(tracks[i].fill_pattern, 0, sizeof(tracks[i].fill_pattern));
-    }
+        uint16_t total_steps = looper_geometry_get()->total_steps;
 
-    if (is_creation_bar(looper_status) && is_first_step(looper_status)) {
         for (size_t i = 0; i < num_tracks; i++) {
-            ghost_note_create(&tracks[i]);
+            memset(tracks[i].fill_pattern, 0, total_steps * sizeof(bool));
+            memset(tracks[i].fill_mask, 0, LOOPER_MASK_WORDS(total_steps) * sizeof(uint32_t));
         }
+        // Only these can have had a fill keeping their ghost notes quiet.
+        for (size_t i = 0; i < num_tracks && i < GHOST_FILL_TRACKS; i++)
+            build_ghost_mask(tracks[i].ghost_notes, NULL, tracks[i].ghost_mask);
+    }
+
+    if (is_creation_bar(looper_status) && is_first_step(looper_status)) {
+        ghost_layer_swap(tracks, num_tracks);
     } else if (is_fillin_bar(looper_status) && is_first_step(looper_status) &&
                looper_status->state == LOOPER_STATE_PLAYING) {
         if (pattern_density() > 0)
@@ -343,6 +537,16 @@ void ghost_note_maintenance_step(void) {
         add_fillin_notes_now();
         pending_fill_request = false;
     }
+    if (intensity_changed) {
+        for (size_t i = 0; i < num_tracks; i++)
+            ghost_note_update_masks(&tracks[i]);
+        intensity_changed = false;
+    }
+    if (edited)
+        looper_publish();
+    else
+        ghost_job_run(tracks, num_tracks);
 
     parameters.swing_ratio = ghost_note_modulate_swing_ratio(looper_status->lfo_phase);
+    TRACE(TRACE_GHOST_END, looper_status->current_step, 0);
 }
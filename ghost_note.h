@@ -41,7 +41,15 @@ uint8_t ghost_note_modulate_base_velocity(uint8_t track_num, uint8_t default_vel
 
 float ghost_note_modulate_swing_ratio(float lfo);
 
-void ghost_note_create(track_t *track);
+void ghost_note_create(track_t *track, size_t track_num);
+
+void ghost_note_resize(size_t num_tracks);
+
+void ghost_note_seed(uint32_t seed);
+
+void ghost_note_update_masks(track_t *track);
+
+void ghost_note_set_intensity(float intensity);
 
 void ghost_note_maintenance_step(void);
 
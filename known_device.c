@@ -0,0 +1,164 @@
+/**
+ * Known-device cache – fast reconnect for the last bonded controller
+ *
+ * After a controller has been set up once, its address, class of device,
+ * name, VID/PID and HID descriptor are kept in the BTstack TLV flash bank
+ * next to the link key BTstack already stores there. On the next boot the
+ * controller is paged directly instead of going through inquiry, remote
+ * name request and SDP, and the VID/PID selects the report parser before
+ * the first packet arrives. If the page does not succeed in time, the
+ * regular scan-and-autoconnect is started.
+ */
+#include "known_device.h"
+
+#include <string.h>
+
+#include <bt/uni_bt.h>
+#include <bt/uni_bt_bredr.h>
+#include <btstack.h>
+#include <btstack_tlv.h>
+#include "pico/time.h"
+
+#include "debug.h"
+
+#define KNOWN_DEVICE_TLV_TAG 0x4f524e4b  // 'ORNK'
+#define KNOWN_DEVICE_VERSION 1
+#define KNOWN_DEVICE_NAME_LEN 64
+#define KNOWN_DEVICE_PAGE_TIMEOUT_MS 5000
+
+typedef struct {
+    uint8_t version;
+    bd_addr_t addr;
+    uint32_t cod;
+    uint16_t vendor_id;
+    uint16_t product_id;
+    char name[KNOWN_DEVICE_NAME_LEN];
+    uint16_t hid_descriptor_len;
+    uint8_t hid_descriptor[HID_MAX_DESCRIPTOR_LEN];
+} known_device_record_t;
+
+static known_device_record_t record;
+static bool record_valid = false;
+
+static btstack_timer_source_t page_timer;
+static bool paging = false;
+
+static uint32_t connect_start_us = 0;
+static bool waiting_first_report = false;
+static known_device_stats_t stats;
+
+static bool tlv_get_instance(const btstack_tlv_t **impl, void **context) {
+    btstack_tlv_get_instance(impl, context);
+    return *impl != NULL && *context != NULL;
+}
+
+static bool load_record(void) {
+    const btstack_tlv_t *tlv_impl;
+    void *tlv_context;
+
+    if (!tlv_get_instance(&tlv_impl, &tlv_context))
+        return false;
+
+    int read = tlv_impl->get_tag(tlv_context, KNOWN_DEVICE_TLV_TAG, (uint8_t *)&record, sizeof(record));
+    record_valid = read == (int)sizeof(record) && record.version == KNOWN_DEVICE_VERSION &&
+                   record.hid_descriptor_len <= HID_MAX_DESCRIPTOR_LEN;
+    return record_valid;
+}
+
+static void page_timeout_handler(btstack_timer_source_t *ts) {
+    (void)ts;
+    if (!paging)
+        return;
+
+    paging = false;
+    stats.fallback_scans++;
+    PICO_INFO("[BT] Known controller did not answer, scanning\n");
+    uni_bt_start_scanning_and_autoconnect_unsafe();
+}
+
+bool known_device_reconnect(void) {
+    link_key_t link_key;
+    link_key_type_t link_key_type;
+
+    connect_start_us = time_us_32();
+    waiting_first_report = true;
+
+    if (!record_valid && !load_record())
+        return false;
+
+    // Without the link key the controller would have to pair again anyway.
+    if (!gap_get_link_key_for_bd_addr(record.addr, link_key, &link_key_type))
+        return false;
+
+    if (uni_bt_bredr_connect_known_device(record.addr, record.cod, record.name, record.vendor_id, record.product_id,
+                                          record.hid_descriptor, record.hid_descriptor_len) == NULL)
+        return false;
+
+    paging = true;
+    btstack_run_loop_set_timer_handler(&page_timer, page_timeout_handler);
+    btstack_run_loop_set_timer(&page_timer, KNOWN_DEVICE_PAGE_TIMEOUT_MS);
+    btstack_run_loop_add_timer(&page_timer);
+    return true;
+}
+
+void known_device_remember(uni_hid_device_t *d) {
+    const btstack_tlv_t *tlv_impl;
+    void *tlv_context;
+    known_device_record_t current;
+
+    // BLE controllers reconnect through their own bonding, nothing to page.
+    if (d->conn.protocol == UNI_BT_CONN_PROTOCOL_BLE)
+        return;
+
+    memset(&current, 0, sizeof(current));
+    current.version = KNOWN_DEVICE_VERSION;
+    bd_addr_copy(current.addr, d->conn.btaddr);
+    current.cod = d->cod;
+    current.vendor_id = d->vendor_id;
+    current.product_id = d->product_id;
+    strncpy(current.name, d->name, KNOWN_DEVICE_NAME_LEN - 1);
+    current.hid_descriptor_len = d->hid_descriptor_len;
+    memcpy(current.hid_descriptor, d->hid_descriptor, d->hid_descriptor_len);
+
+    // Flash is only touched when a different controller (or firmware) shows up.
+    if (record_valid && memcmp(&record, &current, sizeof(current)) == 0)
+        return;
+
+    if (!tlv_get_instance(&tlv_impl, &tlv_context))
+        return;
+
+    if (tlv_impl->store_tag(tlv_context, KNOWN_DEVICE_TLV_TAG, (const uint8_t *)&current, sizeof(current)) != 0) {
+        PICO_ERROR("[BT] Failed to store known controller\n");
+        return;
+    }
+    record = current;
+    record_valid = true;
+}
+
+void known_device_on_connection_lost(void) {
+    connect_start_us = time_us_32();
+    waiting_first_report = true;
+}
+
+void known_device_on_ready(void) {
+    if (paging) {
+        paging = false;
+        btstack_run_loop_remove_timer(&page_timer);
+        stats.fast_reconnects++;
+    }
+    stats.last_connect_us = time_us_32() - connect_start_us;
+}
+
+void known_device_on_report(void) {
+    if (!waiting_first_report)
+        return;
+
+    waiting_first_report = false;
+    stats.last_first_report_us = time_us_32() - connect_start_us;
+    PICO_INFO("[BT] Connected in %lu us, first report after %lu us\n", (unsigned long)stats.last_connect_us,
+              (unsigned long)stats.last_first_report_us);
+}
+
+void known_device_get_stats(known_device_stats_t *stats_out) {
+    *stats_out = stats;
+}
@@ -0,0 +1,24 @@
+#ifndef KNOWN_DEVICE_H_
+#define KNOWN_DEVICE_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <uni_hid_device.h>
+
+typedef struct {
+    uint32_t fast_reconnects;       // known controller paged directly
+    uint32_t fallback_scans;        // page timed out, fell back to inquiry
+    uint32_t last_connect_us;       // boot/disconnect -> device ready
+    uint32_t last_first_report_us;  // boot/disconnect -> first controller report
+} known_device_stats_t;
+
+// All functions must be called from the BTstack context.
+bool known_device_reconnect(void);
+void known_device_remember(uni_hid_device_t *d);
+void known_device_on_connection_lost(void);
+void known_device_on_ready(void);
+void known_device_on_report(void);
+void known_device_get_stats(known_device_stats_t *stats);
+
+#endif  // KNOWN_DEVICE_H_
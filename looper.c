@@ -1,8 +1,8 @@
 /*
  * looper.c
  *
- * Core looper module: Implements a 2-bar step sequencer driven by timer ticks
- * and button input. Exposes functions for processing sequencer steps,
+ * Core looper module: Implements a step sequencer driven by timer ticks
+ * and button input, 2 bars of 4/4 unless set otherwise at runtime. Exposes functions for processing sequencer steps,
  * handling timer ticks, and handling user input events.
  *
  * Copyright 2025, Hiroyuki OYAMA
@@ -11,16 +11,21 @@
  */
 #include "looper.h"
 #include <math.h>
+#include <stdatomic.h>
 #include <stdlib.h>
 #include <string.h>
 #include "tusb.h"
+#include "pico/sync.h"
 #include "async_timer.h"
 #include "button.h"
 #include "display.h"
 #include "storage.h"
 #include "ghost_note.h"
 #include "note_scheduler.h"
+#include "arpeggiator.h"
 #include "tap_tempo.h"
+#include "metrics.h"
+#include "trace.h"
 
 enum {
     MIDI_CHANNEL1 = 0,
@@ -46,25 +51,75 @@ enum {
 	COW_BELL = 56,
 };
 
-looper_status_t looper_status = {.bpm = LOOPER_DEFAULT_BPM, .state = LOOPER_STATE_WAITING};
-
-static track_t tracks[] = {
-    {"Bass", BASS_DRUM, MIDI_CHANNEL10, {0}, {0}},
-    {"Snare", SNARE_DRUM, MIDI_CHANNEL10, {0}, {0}},
-    {"Closed Hi-hat", CLOSED_HIHAT, MIDI_CHANNEL10, {0}, {0}},
-    {"Low Floor Tom", LOW_FLOOR_TOM, MIDI_CHANNEL10, {0}, {0}},
-    {"Low Tom", LOW_TOM, MIDI_CHANNEL10, {0}, {0}},	
-    {"Open Hi-hat", OPEN_HIHAT, MIDI_CHANNEL10, {0}, {0}},	
-    {"Hi Mid Tom", HI_MID_TOM, MIDI_CHANNEL10, {0}, {0}},
-    {"Crash Cymbal", CRASH_CYMBAL, MIDI_CHANNEL10, {0}, {0}},	
-    {"Ride Cymbal", RIDE_CYMBAL, MIDI_CHANNEL10, {0}, {0}},	
-    {"Vibraslap", VIBRASLAP, MIDI_CHANNEL10, {0}, {0}},
-    {"Hi Bongo", HI_BONGO, MIDI_CHANNEL10, {0}, {0}},
-    {"Low Bongo", LOW_BONGO, MIDI_CHANNEL10, {0}, {0}},
-    {"Mute Conga", MUTE_CONGA, MIDI_CHANNEL10, {0}, {0}},
-    {"Low Conga", LOW_CONGA, MIDI_CHANNEL10, {0}, {0}},
+looper_status_t looper_status = {.bpm = LOOPER_DEFAULT_BPM,
+                                  .state = LOOPER_STATE_WAITING,
+                                  .record_mode = LOOPER_RECORD_EVENTS,
+                                  .quantize_strength = LOOPER_DEFAULT_QUANTIZE};
+
+static const track_t track_defaults[] = {
+    {"Bass", BASS_DRUM, MIDI_CHANNEL10},
+    {"Snare", SNARE_DRUM, MIDI_CHANNEL10},
+    {"Closed Hi-hat", CLOSED_HIHAT, MIDI_CHANNEL10},
+    {"Low Floor Tom", LOW_FLOOR_TOM, MIDI_CHANNEL10},
+    {"Low Tom", LOW_TOM, MIDI_CHANNEL10},	
+    {"Open Hi-hat", OPEN_HIHAT, MIDI_CHANNEL10},	
+    {"Hi Mid Tom", HI_MID_TOM, MIDI_CHANNEL10},
+    {"Crash Cymbal", CRASH_CYMBAL, MIDI_CHANNEL10},	
+    {"Ride Cymbal", RIDE_CYMBAL, MIDI_CHANNEL10},	
+    {"Vibraslap", VIBRASLAP, MIDI_CHANNEL10},
+    {"Hi Bongo", HI_BONGO, MIDI_CHANNEL10},
+    {"Low Bongo", LOW_BONGO, MIDI_CHANNEL10},
+    {"Mute Conga", MUTE_CONGA, MIDI_CHANNEL10},
+    {"Low Conga", LOW_CONGA, MIDI_CHANNEL10},
 };
-static const size_t NUM_TRACKS = sizeof(tracks) / sizeof(track_t);
+#define NUM_TRACKS (sizeof(track_defaults) / sizeof(track_t))
+
+#define LOOPER_BANKS 3
+#define LOOPER_BANK_FRESH 0x80  // middle_bank was published after the tick took one
+
+// Per step of a track: pattern, ghost_notes and fill_pattern of each bank, the
+// shared hold_pattern, and the ghost note density window and staging (ghost
+// layer, fill ghost notes and fill pattern), plus rounding of the
+// allocations to words.
+#define LOOPER_STEP_BYTES                                                                   \
+    (LOOPER_BANKS * (2 * sizeof(bool) + sizeof(ghost_note_t)) + sizeof(bool) + sizeof(uint8_t) + \
+     2 * sizeof(ghost_note_t) + sizeof(bool))
+// Per track: ghost_mask and fill_mask of each bank and the staged ghost mask.
+#define LOOPER_MASK_BYTES ((LOOPER_BANKS * 2 + 1) * LOOPER_MASK_WORDS(LOOPER_MAX_STEPS) * sizeof(uint32_t))
+#define LOOPER_POOL_WORDS \
+    (NUM_TRACKS * (LOOPER_MAX_STEPS * LOOPER_STEP_BYTES + LOOPER_MASK_BYTES + (LOOPER_BANKS * 5 + 6) * 3) / 4)
+
+// Pattern storage, carved up again whenever the geometry changes, so a short
+// loop leaves the rest free and an 8-bar loop needs no reflash.
+static uint32_t pool[LOOPER_POOL_WORDS];
+static size_t pool_used = 0;
+
+static looper_geometry_t geometry;
+
+/*
+ * Everything a step plays from. Editors (button events, styles, the ghost
+ * note generator; all on core 0 at the async context priority, so one at a
+ * time) change the back bank and publish it with looper_publish(). The tick
+ * takes the newest published bank when a step starts and plays it unchanged,
+ * without a lock. Three banks let an edit finish while the tick still plays
+ * the previous one.
+ */
+typedef struct {
+    track_t tracks[NUM_TRACKS];
+    // Recorded hits of all tracks, sorted by tick. Playback walks them with
+    // a cursor, so a step costs only the hits due in it.
+    looper_hit_t hits[LOOPER_MAX_HITS];
+    size_t hit_count;
+} looper_bank_t;
+
+static looper_bank_t banks[LOOPER_BANKS];
+static uint8_t back_bank = 0;            // editors only
+static uint8_t front_bank = 1;           // tick only
+static _Atomic uint8_t middle_bank = 2;  // last published, handed over by exchange
+static track_t *tracks = banks[0].tracks;                 // the back bank
+static const looper_bank_t *playing = &banks[1];          // the front bank
+static size_t hit_cursor = 0;                             // into playing->hits
+static critical_section_t geometry_cs;
 
 static uint16_t drum_styles[5][5][32] = {
 	{
@@ -100,7 +155,9 @@ static uint16_t drum_styles[5][5][32] = {
 	}
 };
 	
-static uint32_t midi_clock_tick_count = 0;
+#define MIDI_CLOCK_PPQN 24
+
+static uint32_t midi_clock_tick_count = 0;  // MIDI clock pulses into the current step
 static uint64_t midi_clock_last_tick_us = 0;
 
 extern bool enable_midi_drums;
@@ -120,8 +177,9 @@ static bool looper_perform_ready(void) {
 // Send a note event to the output destination.
 void looper_perform_note(uint8_t channel, uint8_t note, uint8_t velocity) {
     uint8_t const cable_num = 0;
-    // Send Note On for current position at full velocity (127) on channel 1.
-    uint8_t note_on[] = {0x90 | channel, note, sample_drum_velocity};			// use global drum velocity
+    // The global drum velocity is the level of a full velocity (127) note.
+    uint8_t level = (uint8_t)((velocity * sample_drum_velocity + 63) / 127);
+    uint8_t note_on[] = {0x90 | channel, note, level > 0 ? level : 1};
 	midi_n_stream_write(0, 0, note_on, sizeof(note_on));	
 
     // Send Note Off for previous note.
@@ -134,14 +192,14 @@ static void looper_schedule_note_now(uint8_t channel, uint8_t note, uint8_t velo
     note_scheduler_schedule_note(time_us, channel, note, velocity);
 }
 
-// Sends a MIDI click at specific steps to indicate rhythm.
+// Sends a MIDI click on every beat to indicate rhythm, accented on the loop start.
 static void send_click_if_needed(void) {
-    if ((looper_status.current_step % LOOPER_CLICK_DIV) == 0 && looper_status.current_step == 0) {
+    if (looper_status.current_step == 0) {
         looper_schedule_note_now(MIDI_CHANNEL10, COW_BELL, 0x2F);
     }
 	else 
 		
-	if ((looper_status.current_step % LOOPER_CLICK_DIV) == 0) {
+	if (looper_status.beat_step == 0) {
         looper_schedule_note_now(MIDI_CHANNEL10, COW_BELL, 0x0F);
 	}
 }
@@ -151,24 +209,77 @@ static uint64_t looper_get_swing_offset_us(uint8_t step_index) {
     float swing_ratio = params->swing_ratio;
     float pair_length = looper_status.step_period_ms * 2.0f;
 
-    if (step_index % 2 == 1) {
+    // Steps pair up within a beat, the count per beat is even when they swing.
+    if (geometry.swing && (step_index & 1)) {
         float offset_ms = pair_length * (swing_ratio - 0.5f);
         return (uint64_t)(offset_ms * 1000.0f);  // ms → us
     }
     return 0;
 }
 
+// Tick of the (swung) step nearest to `tick`.
+static int32_t looper_grid_tick(uint16_t tick) {
+    int32_t ticks_per_step = geometry.ticks_per_step;
+    int32_t step = (tick + ticks_per_step / 2) / ticks_per_step;
+
+    if (geometry.swing && (step & 1)) {
+        float swing_ratio = ghost_note_parameters()->swing_ratio;
+        return step * ticks_per_step + (int32_t)(2 * ticks_per_step * (swing_ratio - 0.5f));
+    }
+    return step * ticks_per_step;
+}
+
+// Schedule the recorded hits falling into the current step, pulled toward the
+// step grid by the quantize strength. `step_start_us` is when the step began.
+static void looper_perform_hits(uint64_t step_start_us) {
+    int32_t window_start = looper_status.current_step * geometry.ticks_per_step;
+    int32_t window_end = window_start + geometry.ticks_per_step;
+    float tick_us = looper_status.step_period_ms * 1000.0f / geometry.ticks_per_step;
+    const looper_hit_t *hits = playing->hits;
+    const track_t *play = playing->tracks;
+
+    if (looper_status.current_step == 0)
+        hit_cursor = 0;
+    while (hit_cursor < playing->hit_count && hits[hit_cursor].tick < window_start)
+        hit_cursor++;
+
+    while (hit_cursor < playing->hit_count && hits[hit_cursor].tick < window_end) {
+        const looper_hit_t *hit = &hits[hit_cursor++];
+        if (!play[hit->track].events)
+            continue;
+
+        int32_t grid = looper_grid_tick(hit->tick);
+        int32_t tick = hit->tick + (grid - hit->tick) * looper_status.quantize_strength / 100;
+        uint64_t offset_us = (uint64_t)((tick - window_start) * tick_us);
+
+        note_scheduler_schedule_note(step_start_us + offset_us, play[hit->track].channel, play[hit->track].note,
+                                     hit->velocity);
+    }
+}
+
+// Start of a step, and again before playing it in case the step itself
+// published a style: play the newest published bank from here on.
+static void looper_take_published(void) {
+    if (atomic_load(&middle_bank) & LOOPER_BANK_FRESH) {
+        front_bank = atomic_exchange(&middle_bank, front_bank) & ~LOOPER_BANK_FRESH;
+        playing = &banks[front_bank];
+        hit_cursor = 0;  // the step skips ahead to its own hits
+    }
+}
+
 // Perform all note events for the current step across all tracks.
 // If the current track is active, also update the status LED.
 static void looper_perform_step(void) {
-    ghost_parameters_t *params = ghost_note_parameters();
-
+    looper_take_published();
+    const track_t *tracks = playing->tracks;
     uint64_t now = time_us_64();
     uint64_t swing_offset_us = looper_get_swing_offset_us(looper_status.current_step);
 
+    looper_perform_hits(now);
+
     for (uint8_t i = 0; i < NUM_TRACKS; i++) {
         bool note_on = tracks[i].pattern[looper_status.current_step];
-        if (note_on) {
+        if (note_on && !tracks[i].events) {
             uint8_t velocity = ghost_note_modulate_base_velocity(i, 0x7f, looper_status.lfo_phase);
             note_scheduler_schedule_note(now + swing_offset_us, tracks[i].channel, tracks[i].note,
                                          velocity);
@@ -180,15 +291,12 @@ static void looper_perform_step(void) {
             // LED OFF ??
         }
         uint8_t *ghost_note_velocity = ghost_note_velocity_table();
-        bool ghost_note_on =
-            ((float)tracks[i].ghost_notes[looper_status.current_step].probability / 100.0f) *
-                params->ghost_intensity >
-            (float)tracks[i].ghost_notes[looper_status.current_step].rand_sample / 100.0f;
 
-        if (ghost_note_on && !tracks[i].fill_pattern[looper_status.current_step])
+        // The masks already weigh the ghost notes against the intensity.
+        if (looper_step_bit(tracks[i].ghost_mask, looper_status.current_step))
             note_scheduler_schedule_note(now + swing_offset_us, tracks[i].channel, tracks[i].note,
                                          ghost_note_velocity[i]);
-        if (tracks[i].fill_pattern[looper_status.current_step] && !note_on)
+        if (looper_step_bit(tracks[i].fill_mask, looper_status.current_step) && !note_on)
             note_scheduler_schedule_note(now + swing_offset_us, tracks[i].channel, tracks[i].note,
                                          0x7f);
     }
@@ -197,32 +305,66 @@ static void looper_perform_step(void) {
 // Perform note events for the current step while recording.
 // In recording mode, the status LED is always turned on.
 static void looper_perform_step_recording(void) {
+    looper_take_published();
+    const track_t *tracks = playing->tracks;
     uint64_t now = time_us_64();
     uint64_t swing_offset_us = looper_get_swing_offset_us(looper_status.current_step);
 
     //led_set(1);
+    looper_perform_hits(now);
+
     for (uint8_t i = 0; i < NUM_TRACKS; i++) {
-        bool note_on = tracks[i].pattern[looper_status.current_step];		
+        bool note_on = tracks[i].pattern[looper_status.current_step] && !tracks[i].events;
         if (note_on) note_scheduler_schedule_note(now + swing_offset_us, tracks[i].channel, tracks[i].note, 0x7f);
     }
 }
 
-// Copies static style to pattern memory
+// Copies static style to pattern memory, the 32 steps of a style repeat to fill the loop.
+// Called on every bar while a style plays, so only tracks that change count as edited.
 void looper_copy_style(uint8_t group, uint8_t style) {
-	
-    for (int s = 0; s < LOOPER_TOTAL_STEPS; s++) 
+	bool changed[NUM_TRACKS] = {false};
+	bool published = false;
+
+    for (int s = 0, style_step = 0; s < geometry.total_steps; s++) 
 	{		
 		for (int i = 0; i < NUM_TRACKS; i++) {	
-			int drum = (int) pow(2, i);
-			tracks[i].pattern[s] = (drum_styles[group][style][s] > 0) && ((drum_styles[group][style][s] & drum) == drum);
+			int drum = 1 << i;
+			bool hit = (drum_styles[group][style][style_step] > 0) && ((drum_styles[group][style][style_step] & drum) == drum);
+			if (tracks[i].pattern[s] != hit) {
+				tracks[i].pattern[s] = hit;
+				changed[i] = true;
+			}
 		}
+		if (++style_step == 32) style_step = 0;
 	}
+
+	// The style replaces the recording, its hits stay unplayed until recorded over.
+	for (int i = 0; i < NUM_TRACKS; i++) {
+		if (!changed[i] && !tracks[i].events) continue;
+		tracks[i].events = false;
+		tracks[i].revision++;
+		published = true;
+	}
+	if (published) looper_publish();
 }
 
 // Updates the current step index and timestamp based on current loop progress.
+// The beat and bar positions count along, so no step needs a division.
 static void looper_advance_step(uint64_t now_us) {
     looper_status.timing.last_step_time_us = now_us;
-    looper_status.current_step = (looper_status.current_step + 1) % LOOPER_TOTAL_STEPS;
+    if (++looper_status.current_step == geometry.total_steps)
+        looper_status.current_step = 0;
+    if (++looper_status.beat_step == geometry.steps_per_beat)
+        looper_status.beat_step = 0;
+    if (++looper_status.bar_step == geometry.steps_per_bar)
+        looper_status.bar_step = 0;
+}
+
+// Back to the first step of the loop.
+void looper_rewind(void) {
+    looper_status.current_step = 0;
+    looper_status.beat_step = 0;
+    looper_status.bar_step = 0;
 }
 
 /*
@@ -230,26 +372,82 @@ static void looper_advance_step(uint64_t now_us) {
  * The result is quantized to the nearest step relative to the last tick.
  */
 static uint8_t looper_quantize_step() {
-    uint8_t previous_step =
-        (looper_status.current_step + LOOPER_TOTAL_STEPS - 1) % LOOPER_TOTAL_STEPS;
+    uint16_t total_steps = geometry.total_steps;
+    uint8_t previous_step = (looper_status.current_step + total_steps - 1) % total_steps;
     int64_t delta_us =
         looper_status.timing.button_press_start_us - looper_status.timing.last_step_time_us;
 
     float step_period_ms = looper_status.step_period_ms;
     // Convert to step offset using rounding (nearest step)
     int32_t relative_steps = (int32_t)round((double)delta_us / 1000.0 / step_period_ms);
-    uint8_t estimated_step =
-        (previous_step + relative_steps + LOOPER_TOTAL_STEPS) % LOOPER_TOTAL_STEPS;
-    return estimated_step;
+    int32_t estimated_step = (previous_step + relative_steps) % total_steps;
+    return (uint8_t)(estimated_step < 0 ? estimated_step + total_steps : estimated_step);
+}
+
+/*
+ * Returns the tick nearest to the stored `button_press_start_us` timestamp,
+ * counted from the start of the loop.
+ */
+static uint16_t looper_press_tick(void) {
+    uint8_t previous_step =
+        (looper_status.current_step + geometry.total_steps - 1) % geometry.total_steps;
+    int64_t delta_us =
+        looper_status.timing.button_press_start_us - looper_status.timing.last_step_time_us;
+
+    float tick_period_ms = (float)looper_status.step_period_ms / geometry.ticks_per_step;
+    int32_t relative_ticks = (int32_t)round((double)delta_us / 1000.0 / tick_period_ms);
+    int32_t tick = (previous_step * geometry.ticks_per_step + relative_ticks) % geometry.total_ticks;
+    return (uint16_t)(tick < 0 ? tick + geometry.total_ticks : tick);
+}
+
+// Insert a hit behind those on the same tick. Full arena drops the hit.
+static void looper_record_hit(uint8_t track, uint16_t tick, uint8_t velocity) {
+    looper_bank_t *bank = &banks[back_bank];
+
+    if (bank->hit_count < LOOPER_MAX_HITS) {
+        size_t i = bank->hit_count;
+        while (i > 0 && bank->hits[i - 1].tick > tick)
+            i--;
+        memmove(&bank->hits[i + 1], &bank->hits[i], (bank->hit_count - i) * sizeof(bank->hits[0]));
+        bank->hits[i] = (looper_hit_t){.tick = tick, .track = track, .velocity = velocity};
+        bank->hit_count++;
+    }
+}
+
+// Remove the hits of one track, or of all tracks for NUM_TRACKS.
+static void looper_clear_hits(size_t track) {
+    looper_bank_t *bank = &banks[back_bank];
+    size_t kept = 0;
+
+    for (size_t i = 0; i < bank->hit_count; i++) {
+        if (track != NUM_TRACKS && bank->hits[i].track != track)
+            bank->hits[kept++] = bank->hits[i];
+    }
+    bank->hit_count = kept;
+}
+
+// Turn a step-recorded track into hits on its steps, to overdub it with events.
+static void looper_track_to_hits(uint8_t track_num) {
+    looper_clear_hits(track_num);
+    for (uint16_t s = 0; s < geometry.total_steps; s++) {
+        if (tracks[track_num].pattern[s])
+            looper_record_hit(track_num, s * geometry.ticks_per_step, 0x7f);
+    }
+    tracks[track_num].events = true;
 }
 
 // Clear all patterns in every track
 void looper_clear_all_tracks() {
     for (size_t i = 0; i < NUM_TRACKS; i++) {
-        memset(tracks[i].pattern, 0, sizeof(tracks[i].pattern));
-        memset(tracks[i].ghost_notes, 0, sizeof(tracks[i].ghost_notes));
-        memset(tracks[i].fill_pattern, 0, sizeof(tracks[i].fill_pattern));
+        memset(tracks[i].pattern, 0, geometry.total_steps * sizeof(bool));
+        memset(tracks[i].ghost_notes, 0, geometry.total_steps * sizeof(ghost_note_t));
+        memset(tracks[i].fill_pattern, 0, geometry.total_steps * sizeof(bool));
+        ghost_note_update_masks(&tracks[i]);
+        tracks[i].events = false;
+        tracks[i].revision++;
     }
+    looper_clear_hits(NUM_TRACKS);
+    looper_publish();
 	
 	//storage_store_tracks();	
 }
@@ -270,6 +468,157 @@ static tap_result_t taptempo_handle_button_event(button_event_t event) {
     return result;
 }
 
+void looper_set_record_mode(looper_record_mode_t mode) { looper_status.record_mode = mode; }
+
+void looper_set_quantize_strength(uint8_t percent) {
+    looper_status.quantize_strength = percent > 100 ? 100 : percent;
+}
+
+// Recorded hits as edited, sorted by tick. For editors only.
+const looper_hit_t *looper_hits_get(size_t *count) {
+    *count = banks[back_bank].hit_count;
+    return banks[back_bank].hits;
+}
+
+static void looper_bank_copy(looper_bank_t *to, const looper_bank_t *from) {
+    for (size_t i = 0; i < NUM_TRACKS; i++) {
+        memcpy(to->tracks[i].pattern, from->tracks[i].pattern, geometry.total_steps * sizeof(bool));
+        memcpy(to->tracks[i].ghost_notes, from->tracks[i].ghost_notes,
+               geometry.total_steps * sizeof(ghost_note_t));
+        memcpy(to->tracks[i].fill_pattern, from->tracks[i].fill_pattern, geometry.total_steps * sizeof(bool));
+        memcpy(to->tracks[i].ghost_mask, from->tracks[i].ghost_mask,
+               LOOPER_MASK_WORDS(geometry.total_steps) * sizeof(uint32_t));
+        memcpy(to->tracks[i].fill_mask, from->tracks[i].fill_mask,
+               LOOPER_MASK_WORDS(geometry.total_steps) * sizeof(uint32_t));
+        to->tracks[i].events = from->tracks[i].events;
+        to->tracks[i].revision = from->tracks[i].revision;
+    }
+    memcpy(to->hits, from->hits, from->hit_count * sizeof(looper_hit_t));
+    to->hit_count = from->hit_count;
+}
+
+/*
+ * Hands the edited tracks and hits to the tick, which plays them from the
+ * next step on, and goes on editing a copy. Editors call it once their
+ * change is complete.
+ */
+void looper_publish(void) {
+    uint8_t published = back_bank;
+
+    back_bank = atomic_exchange(&middle_bank, published | LOOPER_BANK_FRESH) & ~LOOPER_BANK_FRESH;
+    looper_bank_copy(&banks[back_bank], &banks[published]);
+    tracks = banks[back_bank].tracks;
+}
+
+// Word-aligned storage from the pattern pool, valid until the geometry changes.
+void *looper_pool_alloc(size_t size) {
+    size_t words = (size + 3) / 4;
+
+    if (pool_used + words > LOOPER_POOL_WORDS)
+        return NULL;
+    void *p = &pool[pool_used];
+    pool_used += words;
+    return p;
+}
+
+/*
+ * Sets the loop length and time signature, e.g. (2, 6, 8, 2) for two bars of
+ * 6/8 in 16th notes. The pool is carved up again for the new length, which
+ * clears the patterns and recorded hits and starts over at the first step.
+ * Returns false, keeping the current loop, when the geometry does not fit the
+ * pool or a step does not take a whole number of MIDI clock pulses.
+ */
+bool looper_set_geometry(uint8_t bars, uint8_t beats_per_bar, uint8_t beat_unit, uint8_t steps_per_beat) {
+    uint32_t steps_per_bar = beats_per_bar * steps_per_beat;
+    uint32_t total_steps = bars * steps_per_bar;
+    uint32_t steps_per_whole = steps_per_beat * beat_unit;
+
+    // MIDI clock pulses must fall on steps, LOOPER_PPQN is a multiple of it.
+    if (total_steps == 0 || total_steps > LOOPER_MAX_STEPS || steps_per_whole % 4 != 0 ||
+        MIDI_CLOCK_PPQN % (steps_per_whole / 4) != 0)
+        return false;
+
+    critical_section_enter_blocking(&geometry_cs);
+
+    geometry = (looper_geometry_t){
+        .bars = bars,
+        .beats_per_bar = beats_per_bar,
+        .beat_unit = beat_unit,
+        .steps_per_beat = steps_per_beat,
+        .steps_per_quarter = steps_per_whole / 4,
+        .steps_per_bar = steps_per_bar,
+        .total_steps = total_steps,
+        .ticks_per_step = LOOPER_PPQN / (steps_per_whole / 4),
+        .clocks_per_step = MIDI_CLOCK_PPQN / (steps_per_whole / 4),
+        .total_ticks = total_steps * (LOOPER_PPQN / (steps_per_whole / 4)),
+        .lfo_rate = 65536 / (4 * steps_per_bar),
+        .swing = (steps_per_beat & 1) == 0,
+    };
+
+    pool_used = 0;
+    memset(pool, 0, sizeof(pool));
+    for (size_t i = 0; i < NUM_TRACKS; i++) {
+        bool *hold_pattern = looper_pool_alloc(total_steps * sizeof(bool));
+
+        for (size_t b = 0; b < LOOPER_BANKS; b++) {
+            track_t *track = &banks[b].tracks[i];
+            *track = track_defaults[i];
+            track->pattern = looper_pool_alloc(total_steps * sizeof(bool));
+            track->hold_pattern = hold_pattern;  // editors only
+            track->ghost_notes = looper_pool_alloc(total_steps * sizeof(ghost_note_t));
+            track->fill_pattern = looper_pool_alloc(total_steps * sizeof(bool));
+            track->ghost_mask = looper_pool_alloc(LOOPER_MASK_WORDS(total_steps) * sizeof(uint32_t));
+            track->fill_mask = looper_pool_alloc(LOOPER_MASK_WORDS(total_steps) * sizeof(uint32_t));
+        }
+    }
+    ghost_note_resize(NUM_TRACKS);
+
+    // Recorded ticks belong to the old loop.
+    for (size_t b = 0; b < LOOPER_BANKS; b++)
+        banks[b].hit_count = 0;
+    back_bank = 0;
+    front_bank = 1;
+    atomic_store(&middle_bank, 2);
+    tracks = banks[back_bank].tracks;
+    playing = &banks[front_bank];
+    hit_cursor = 0;
+    looper_status.recording_step_count = 0;
+    looper_rewind();
+    looper_status.step_period_ms = 60000 / (looper_status.bpm * geometry.steps_per_quarter);
+
+    critical_section_exit(&geometry_cs);
+    return true;
+}
+
+const looper_geometry_t *looper_geometry_get(void) { return &geometry; }
+
+// Runtime controls, each steps through a few common settings. Like any
+// geometry change they start the loop over, empty.
+void looper_cycle_bars(void) {
+    uint8_t bars = geometry.bars < 8 ? geometry.bars * 2 : 1;  // 1, 2, 4, 8
+
+    if (!looper_set_geometry(bars, geometry.beats_per_bar, geometry.beat_unit, geometry.steps_per_beat))
+        looper_set_geometry(1, geometry.beats_per_bar, geometry.beat_unit, geometry.steps_per_beat);
+}
+
+void looper_cycle_time_signature(void) {
+    // 4/4 and 3/4 in 16th notes, 6/8 in 16th notes
+    if (geometry.beat_unit == 4 && geometry.beats_per_bar == 4)
+        looper_set_geometry(geometry.bars, 3, 4, 4);
+    else if (geometry.beat_unit == 4 && geometry.beats_per_bar == 3)
+        looper_set_geometry(geometry.bars, 6, 8, 2);
+    else
+        looper_set_geometry(geometry.bars, 4, 4, 4);
+}
+
+// Sets up the default loop before controllers or timers can touch the tracks.
+void looper_init(void) {
+    critical_section_init(&geometry_cs);
+    ghost_note_seed(LOOPER_GHOST_SEED);
+    looper_set_geometry(LOOPER_DEFAULT_BARS, LOOPER_DEFAULT_BEATS_PER_BAR, LOOPER_DEFAULT_BEAT_UNIT,
+                        LOOPER_DEFAULT_STEPS_PER_BEAT);
+}
+
 // Return a pointer to the current looper status.
 looper_status_t *looper_status_get(void) { return &looper_status; }
 
@@ -281,26 +630,27 @@ track_t *looper_tracks_get(size_t *num) {
 // Update the looper BPM and recalculate the step duration.
 void looper_update_bpm(uint32_t bpm) {
     looper_status.bpm = bpm;
-    looper_status.step_period_ms = 60000 / (bpm * LOOPER_STEPS_PER_BEAT);
+    looper_status.step_period_ms = 60000 / (bpm * geometry.steps_per_quarter);
 	midi_seqtrak_tempo(bpm);
 }
 
 // Processes the looper's main state machine, called by the step timer.
 void looper_process_state(uint64_t start_us) {
     bool ready = looper_perform_ready();
-    display_update_looper_status(ready, &looper_status, tracks, NUM_TRACKS);
+    looper_take_published();
+    display_update_looper_status(ready, &looper_status, playing->tracks, NUM_TRACKS);
     if (!ready) looper_status.state = LOOPER_STATE_WAITING;
 	
     switch (looper_status.state) {
         case LOOPER_STATE_WAITING:
             if (ready) {
-                looper_status.current_step = 0;
+                looper_rewind();
             }
-            //led_set((looper_status.current_step % (LOOPER_CLICK_DIV * 4)) == 0);
+            //led_set(looper_status.bar_step == 0);
             looper_advance_step(start_us);
             break;
         case LOOPER_STATE_PLAYING:
-			if ((looper_status.current_step % (LOOPER_CLICK_DIV * 4)) == 0) {
+			if (looper_status.bar_step == 0) {
 				if (style_group > -1) looper_copy_style(style_group, style_section % 5);				
 			}
             looper_perform_step();
@@ -310,7 +660,7 @@ void looper_process_state(uint64_t start_us) {
             send_click_if_needed();
             looper_perform_step_recording();
 			
-            if (looper_status.recording_step_count >= LOOPER_TOTAL_STEPS) {
+            if (looper_status.recording_step_count >= geometry.total_steps) {
 				looper_status.recording_step_count = 0;
             } else {
 				looper_status.recording_step_count++;				
@@ -326,7 +676,7 @@ void looper_process_state(uint64_t start_us) {
             break;
         case LOOPER_STATE_TAP_TEMPO:
             send_click_if_needed();
-            //led_set((looper_status.current_step % LOOPER_CLICK_DIV) == 0);
+            //led_set(looper_status.beat_step == 0);
             looper_advance_step(start_us);
             break;
         case LOOPER_STATE_CLEAR_TRACKS:
@@ -340,21 +690,22 @@ void looper_process_state(uint64_t start_us) {
             break;
     }
 
-    looper_status.lfo_phase += LFO_RATE;
+    looper_status.lfo_phase += geometry.lfo_rate;
     ghost_note_maintenance_step();
 }
 
 static void looper_process_state_external_clock(uint64_t start_us) {
     bool ready = looper_perform_ready();
-    display_update_looper_status(ready, &looper_status, tracks, NUM_TRACKS);
+    looper_take_published();
+    display_update_looper_status(ready, &looper_status, playing->tracks, NUM_TRACKS);
     if (!ready) looper_status.state = LOOPER_STATE_WAITING;
 	
     switch (looper_status.state) {
         case LOOPER_STATE_WAITING:
             if (ready) {
-                looper_status.current_step = 0;
+                looper_rewind();
             }
-            //led_set((looper_status.current_step % (LOOPER_CLICK_DIV * 4)) == 0);
+            //led_set(looper_status.bar_step == 0);
             looper_advance_step(start_us);
             break;
         case LOOPER_STATE_SYNC_PLAYING:
@@ -370,7 +721,7 @@ static void looper_process_state_external_clock(uint64_t start_us) {
             break;
     }
 
-    looper_status.lfo_phase += LFO_RATE;
+    looper_status.lfo_phase += geometry.lfo_rate;
     ghost_note_maintenance_step();
 }
 
@@ -384,7 +735,7 @@ void looper_handle_button_event(button_event_t event) {
             looper_status.timing.button_press_start_us = time_us_64();
             looper_schedule_note_now(track->channel, track->note, 0x7f);
             // Backup track pattern in case this press becomes a long-press (undo)
-            memcpy(track->hold_pattern, track->pattern, LOOPER_TOTAL_STEPS);
+            memcpy(track->hold_pattern, track->pattern, geometry.total_steps);
             break;
         case BUTTON_EVENT_CLICK_RELEASE:
             // Short press release: quantize and record step
@@ -392,17 +743,34 @@ void looper_handle_button_event(button_event_t event) {
             if (looper_status.state != LOOPER_STATE_RECORDING) {
                 looper_status.recording_step_count = 0;
                 looper_status.state = LOOPER_STATE_RECORDING;
-                memset(track->pattern, 0, LOOPER_TOTAL_STEPS);
-                memset(track->ghost_notes, 0, sizeof(track->ghost_notes));
-                memset(track->fill_pattern, 0, LOOPER_TOTAL_STEPS);
+                memset(track->pattern, 0, geometry.total_steps);
+                memset(track->ghost_notes, 0, geometry.total_steps * sizeof(ghost_note_t));
+                memset(track->fill_pattern, 0, geometry.total_steps);
+                ghost_note_update_masks(track);
+                looper_clear_hits(looper_status.current_track);
+                track->events = false;
 				//storage_erase_tracks();
             }
+            // The pattern marks the step either way, ghost notes and fills follow it.
             uint8_t quantized_step = looper_quantize_step();
+            if (looper_status.record_mode == LOOPER_RECORD_EVENTS) {
+                if (!track->events)
+                    looper_track_to_hits(looper_status.current_track);
+                // Buttons carry no velocity, a hit is recorded at full level.
+                looper_record_hit(looper_status.current_track, looper_press_tick(), 0x7f);
+            } else if (track->events) {
+                looper_clear_hits(looper_status.current_track);
+                track->events = false;
+            }
             track->pattern[quantized_step] = true;
+            track->revision++;
+            looper_publish();
             break;
         case BUTTON_EVENT_HOLD_RELEASE:
             // Long press release: revert track and switch
-            memcpy(track->pattern, track->hold_pattern, LOOPER_TOTAL_STEPS);
+            memcpy(track->pattern, track->hold_pattern, geometry.total_steps);
+            track->revision++;
+            looper_publish();
             looper_status.state = LOOPER_STATE_TRACK_SWITCH;
             break;
         case BUTTON_EVENT_LONG_HOLD_RELEASE:
@@ -420,15 +788,32 @@ void looper_handle_button_event(button_event_t event) {
     }
 }
 
+// Start of the previous internal tick, 0 when the chain was (re)started.
+static uint64_t last_tick_us = 0;
+
 // Runs `looper_process_state()` and reschedules tick timer.
 void looper_handle_tick(async_context_t *ctx, async_at_time_worker_t *worker) {
     uint64_t start_us = time_us_64();
 
+    // Ideally one step period after the previous tick started.
+    if (last_tick_us != 0) {
+        int64_t error_us = (int64_t)(start_us - last_tick_us) - (int64_t)(looper_status.step_period_ms * 1000.0f);
+        metrics_sample(METRICS_TICK_JITTER_US, (uint32_t)(error_us < 0 ? -error_us : error_us));
+    }
+    last_tick_us = start_us;
+    metrics_count(METRICS_TICKS);
+
+    TRACE(TRACE_TICK_BEGIN, looper_status.current_step, 0);
 	midi_process_state(start_us);
+    arpeggiator_step(start_us);
     looper_process_state(start_us);
+    TRACE(TRACE_TICK_END, looper_status.current_step, 0);
+
+    uint64_t handler_us = time_us_64() - start_us;
+    metrics_sample(METRICS_TICK_DURATION_US, (uint32_t)handler_us);
 
     float step_delay = looper_status.step_period_ms;
-    uint64_t handler_delay_ms = (time_us_64() - start_us) / 1000;
+    uint64_t handler_delay_ms = handler_us / 1000;
     uint32_t delay =
         (handler_delay_ms >= (uint32_t)step_delay) ? 1 : (uint32_t)step_delay - handler_delay_ms;
 
@@ -440,13 +825,14 @@ static void looper_audit_midi_sync(async_context_t *ctx, async_at_time_worker_t
 
     if (looper_status.clock_source == LOOPER_CLOCK_EXTERNAL) {
         if (now_us - midi_clock_last_tick_us > 250000) {
-            looper_status.current_step = 0;
+            looper_rewind();
             looper_status.ghost_bar_counter = 0;
             looper_status.lfo_phase = 0;
 
             looper_status.state = LOOPER_STATE_WAITING;
             looper_status.clock_source = LOOPER_CLOCK_INTERNAL;
 
+            last_tick_us = 0;
             async_context_add_at_time_worker_in_ms(ctx, &looper_status.tick_timer,
                                                    looper_status.step_period_ms);
         }
@@ -475,10 +861,13 @@ void looper_handle_midi_tick(void) {
     uint64_t delta_us = start_us - midi_clock_last_tick_us;
     accumulated_tick_interval_us += delta_us;
 
-    if (midi_clock_tick_count % 6 == 0) {
+    if (midi_clock_tick_count >= geometry.clocks_per_step) {
+        midi_clock_tick_count = 0;
+        arpeggiator_step(start_us);
         looper_process_state_external_clock(start_us);
+        metrics_sample(METRICS_TICK_DURATION_US, (uint32_t)(time_us_64() - start_us));
 
-        float bpm = 60000000.0f / ((accumulated_tick_interval_us / 6) * 24.0f);
+        float bpm = 60000000.0f / ((accumulated_tick_interval_us / geometry.clocks_per_step) * 24.0f);
         looper_update_bpm(bpm);
         accumulated_tick_interval_us = 0;
     }
@@ -487,7 +876,7 @@ void looper_handle_midi_tick(void) {
 }
 
 void looper_handle_midi_start(void) {
-    looper_status.current_step = 0;
+    looper_rewind();
     looper_status.ghost_bar_counter = 0;
     looper_status.lfo_phase = 0;
     midi_clock_tick_count = 0;
@@ -10,14 +10,36 @@
 #include "button.h"
 
 #define LOOPER_DEFAULT_BPM 96    // Beats per minute (global tempo)
-#define LOOPER_BARS 2            // Loop length in bars
-#define LOOPER_BEATS_PER_BAR 4   // Time signature numerator (e.g., 4/4)
-#define LOOPER_STEPS_PER_BEAT 4  // Resolution (4 = 16th notes)
+#define LOOPER_DEFAULT_BARS 2            // Loop length in bars
+#define LOOPER_DEFAULT_BEATS_PER_BAR 4   // Time signature numerator (e.g., 4/4)
+#define LOOPER_DEFAULT_BEAT_UNIT 4       // Time signature denominator
+#define LOOPER_DEFAULT_STEPS_PER_BEAT 4  // Resolution (4 = 16th notes)
+#define LOOPER_MAX_STEPS 128             // Pattern storage is pooled for this many steps per track
+#define LOOPER_GHOST_SEED 1              // Ghost notes replay the same for the same seed
+#define LOOPER_MASK_WORDS(steps) (((steps) + 31) / 32)
 
-#define LOOPER_TOTAL_STEPS (LOOPER_STEPS_PER_BEAT * LOOPER_BEATS_PER_BAR * LOOPER_BARS)
-#define LOOPER_CLICK_DIV (LOOPER_TOTAL_STEPS / LOOPER_BARS / LOOPER_BEATS_PER_BAR)
+#define LOOPER_PPQN 96             // Recording resolution (ticks per quarter note)
+#define LOOPER_MAX_HITS 256        // Recorded hits across all tracks
+#define LOOPER_DEFAULT_QUANTIZE 100  // Percent pulled to the (swung) step grid on playback
 
-#define LFO_RATE (65536 / (4 * LOOPER_BEATS_PER_BAR * LOOPER_STEPS_PER_BEAT))
+/*
+ * Loop length and time signature, set at runtime with looper_set_geometry().
+ * The derived fields spare the tick path any division.
+ */
+typedef struct {
+    uint8_t bars;               // Loop length in bars
+    uint8_t beats_per_bar;      // Time signature numerator (e.g., 6 in 6/8)
+    uint8_t beat_unit;          // Time signature denominator (e.g., 8 in 6/8)
+    uint8_t steps_per_beat;     // Resolution (4 = 16th notes in 4/4, 2 = 16th notes in 6/8)
+    uint8_t steps_per_quarter;  // Step rate against the tempo, BPM counts quarter notes
+    uint16_t steps_per_bar;
+    uint16_t total_steps;
+    uint16_t ticks_per_step;    // LOOPER_PPQN ticks
+    uint8_t clocks_per_step;    // MIDI clock pulses
+    uint16_t total_ticks;
+    uint16_t lfo_rate;          // LFO phase increment per step, one cycle every 4 bars
+    bool swing;                 // Steps pair up for swing (even steps per beat)
+} looper_geometry_t;
 
 // Represents the current playback or recording state.
 typedef enum {
@@ -41,6 +63,18 @@ typedef enum {
     LOOPER_CLOCK_EXTERNAL,      // MIDI clock
 } looper_clock_source_t;
 
+typedef enum {
+    LOOPER_RECORD_STEPS = 0,  // Hits snap to a step of the pattern when recorded.
+    LOOPER_RECORD_EVENTS,     // Hits keep their tick and velocity, quantized on playback.
+} looper_record_mode_t;
+
+// One recorded hit. All tracks share one arena, sorted by tick.
+typedef struct {
+    uint16_t tick;     // Offset into the loop, LOOPER_PPQN resolution.
+    uint8_t track;
+    uint8_t velocity;
+} looper_hit_t;
+
 /*
  * Runtime playback state, managed globally.
  * Holds track index, current step, recording progress, and last tick time.
@@ -51,11 +85,15 @@ typedef struct {
     looper_state_t state;          // Current looper mode (e.g. PLAYING, RECORDING).
     uint8_t current_track;         // Index of the active track (for recording or preview).
     uint8_t current_step;          // Index of the current step in the sequence loop.
+    uint8_t beat_step;             // Step within the current beat, advanced with current_step.
+    uint16_t bar_step;             // Step within the current bar, advanced with current_step.
     uint8_t recording_step_count;  // Step count for ongoing recording session (resets on new record).
     looper_timing_t timing;
     uint8_t ghost_bar_counter;
     uint16_t lfo_phase;
     looper_clock_source_t clock_source;
+    looper_record_mode_t record_mode;
+    uint8_t quantize_strength;     // 0 plays hits as recorded, 100 on the step grid.
     async_at_time_worker_t tick_timer;  // Step timer (internal clock mode)
     async_at_time_worker_t sync_timer;  // MIDI sync watchdog timer
 } looper_status_t;
@@ -70,14 +108,30 @@ typedef struct {
     const char *name;                       // Human-readable name of the track.
     uint8_t note;                           // MIDI note to trigger.
     uint8_t channel;                        // MIDI channel.
-    bool pattern[LOOPER_TOTAL_STEPS];       // Current active pattern
-    bool hold_pattern[LOOPER_TOTAL_STEPS];  // Temporary copy saved on button down.
-    ghost_note_t ghost_notes[LOOPER_TOTAL_STEPS];
-    bool fill_pattern[LOOPER_TOTAL_STEPS];
+    bool *pattern;                          // Current active pattern
+    bool *hold_pattern;                     // Temporary copy saved on button down.
+    ghost_note_t *ghost_notes;
+    bool *fill_pattern;                     // All four hold geometry.total_steps entries.
+    uint32_t *ghost_mask;                   // Steps whose ghost note fires, fills excluded.
+    uint32_t *fill_mask;                    // Steps with a fill, a bit each.
+    bool events;                            // Played from recorded hits, pattern only marks their steps.
+    uint16_t revision;                      // Bumped by every edit of the pattern.
 } track_t;
 
+// Bit test of a step in a ghost_mask or fill_mask.
+static inline bool looper_step_bit(const uint32_t *mask, uint16_t step) {
+    return (mask[step >> 5] >> (step & 31)) & 1;
+}
 
 void looper_status_led_init(void);
+void looper_init(void);
+bool looper_set_geometry(uint8_t bars, uint8_t beats_per_bar, uint8_t beat_unit, uint8_t steps_per_beat);
+const looper_geometry_t *looper_geometry_get(void);
+void looper_cycle_bars(void);
+void looper_cycle_time_signature(void);
+void *looper_pool_alloc(size_t size);
+void looper_rewind(void);
+void looper_publish(void);
 looper_status_t *looper_status_get(void);
 track_t *looper_tracks_get(size_t *num_tracks);
 
@@ -92,4 +146,7 @@ void looper_schedule_step_timer(void);
 void looper_perform_note(uint8_t channel, uint8_t note, uint8_t velocity);
 void looper_copy_style(uint8_t group, uint8_t style);
 void looper_handle_input_internal_clock(button_event_t event);
-void looper_clear_all_tracks();
\ No newline at end of file
+void looper_clear_all_tracks();
+void looper_set_record_mode(looper_record_mode_t mode);
+void looper_set_quantize_strength(uint8_t percent);
+const looper_hit_t *looper_hits_get(size_t *count);
\ No newline at end of file
@@ -23,6 +23,14 @@
 #include "storage.h"
 #include "looper.h"
 #include "note_scheduler.h"
+#include "wav_trigger_i2c.h"
+#include "midi_pipeline.h"
+#include "event_loop.h"
+#include "uart_midi.h"
+#include "usb_midi_packet.h"
+#include "trace.h"
+#include "metrics.h"
+#include "sysex.h"
 #include "pico/stdlib.h"
 #include "hardware/watchdog.h"
 #include "hardware/i2c.h"
@@ -80,7 +88,11 @@ void pico_set_led(bool led_on) {
 #define I2C_ID          i2c1
 #define I2C_SDA_PIN     6
 #define I2C_SCL_PIN     7
+#ifdef WAV_TRIGGER_PRO_I2C_FAST_MODE
+#define I2C_SPEED_HZ    400000     // Fast-mode 400kHz clock speed
+#else
 #define I2C_SPEED_HZ    100000     // Standard 100kHz clock speed
+#endif
 
 // I2C Command Protocol Constants 
 #define WAV_TRIGGER_PRO_ADDR 0x13
@@ -100,7 +112,9 @@ void pico_set_led(bool led_on) {
 #define WAV_TRIGGER_PRO_MAX_MESSAGE_LEN   32
 #define WAV_TRIGGER_PRO_MAX_PAYLOAD_LEN   (WAV_TRIGGER_PRO_MAX_MESSAGE_LEN - 1)
 #define WAV_TRIGGER_PRO_VERSION_STRING_LEN 12
-#define WAV_TRIGGER_PRO_RESPONSE_DELAY_MS  2
+#define WAV_TRIGGER_PRO_RESPONSE_TIMEOUT_US 20000
+// One queued MIDI command: address + 4 bytes, 9 clocks each.
+#define WAV_TRIGGER_PRO_COMMAND_US (45u * 1000000u / I2C_SPEED_HZ)
 #define WAV_TRIGGER_PRO_LOOP_FLAG         0x01
 #define WAV_TRIGGER_PRO_LOCK_FLAG         0x02
 #define WAV_TRIGGER_PRO_PITCH_BEND_FLAG   0x04
@@ -196,6 +210,14 @@ bool mute_midi_controller = false;
 static uint32_t held_notes_mask[4] = {0};
 static int held_note_count = 0;
 
+// Pitch classes of the held notes, kept up to date on every note event.
+static uint8_t held_pc_count[12] = {0};
+static uint16_t held_pc_mask = 0;
+
+// Chord lookup by pitch-class mask: (root << 4) | chord quality, CHORD_NONE if unrecognised.
+#define CHORD_NONE 0xFF
+static uint8_t chord_table[4096];
+
 // MIDI running-status parser state (persists across tuh_midi_rx_cb invocations).
 static uint8_t midi_running_status = 0;
 static uint8_t midi_data0 = 0;
@@ -257,6 +279,7 @@ void config_nanobox_tangerine();
 void config_mpx_looper();
 void process_midi_byte(uint8_t b);
 void gamepad_bluetooth_handle_data();
+void uni_bt_le_liberlive_process_events(void);
 void set_tempo(uint8_t tempo);
 bool wav_trigger_pro_get_version(char *dst, size_t dst_len);
 int wav_trigger_pro_get_num_tracks(void);
@@ -277,7 +300,9 @@ void wav_trigger_pro_stop_loops();
 void config_wav_trigger_pro();
 void launchkey_display_text(const char* text, bool is_temp);
 void launchkey_set_led(uint8_t msg_type, uint8_t channel, uint8_t index, uint8_t color_id);
+static void launchkey_feedback_reset(void);
 
+static bool wav_trigger_pro_can_send_midi_message(const uint8_t *buffer, uint32_t bufsize);
 static void wav_trigger_pro_forward_midi_message(const uint8_t *buffer, uint32_t bufsize);
 
 uint8_t get_arp_template(void);
@@ -310,18 +335,399 @@ bool is_wav_trigger_connected() {
 //
 //--------------------------------------------------------------------+
 
+// Core 1 owns the USB device and host stacks and the UART output. Core 0 hands
+// it MIDI through the output queue of midi_pipeline.
+
+#define DEVICE_MIDI_PACKETS  64		// packed in a pass, a pipeline chunk needs up to one per byte
+#define DEVICE_MIDI_STALL_US 20000	// the computer stopped reading the port
+
+static uint8_t device_packets[DEVICE_MIDI_PACKETS * USB_MIDI_PACKET_LEN];
+static uint32_t device_packet_count = 0;
+static uint32_t device_progress_us = 0;
+static usb_midi_packer_t device_packer;
+
+// No pipeline message is partly written to the computer.
+static bool device_midi_idle(void) {
+	return device_packet_count == 0 && usb_midi_packer_idle(&device_packer);
+}
+
+// Packs the messages due for the computer and writes them in one go. What the
+// FIFO does not take waits for the next pass, in order.
+static void device_midi_write(void) {
+	midi_pipeline_event_t event;
+	uint32_t now = time_us_32();
+
+	while (device_packet_count + MIDI_PIPELINE_CHUNK_LEN <= DEVICE_MIDI_PACKETS && midi_pipeline_due(MIDI_SINK_DEVICE, &event)) {
+		device_packet_count += usb_midi_pack(&device_packer, event.cable, event.data, event.len,
+		                                     &device_packets[device_packet_count * USB_MIDI_PACKET_LEN]);
+	}
+
+	if (device_packet_count == 0) {
+		device_progress_us = now;
+		return;
+	}
+
+	// 0 as well when the device is not mounted
+	uint32_t written = tud_midi_n_packet_write_n(0, device_packets, device_packet_count);
+	if (written > 0) {
+		device_packet_count -= written;
+		memmove(device_packets, &device_packets[written * USB_MIDI_PACKET_LEN], device_packet_count * USB_MIDI_PACKET_LEN);
+		device_progress_us = now;
+	}
+
+	// Nobody reads the port: drop what did not go out rather than hold up the other sinks.
+	if (device_packet_count > 0 && now - device_progress_us > DEVICE_MIDI_STALL_US) {
+		device_packet_count = 0;
+	}
+}
+
+// Short requests from the computer: F0 7D 4F <subsystem> <cmd> F7
+static void device_sysex_request(const uint8_t packet[4]) {
+	static uint8_t request[6];
+	static uint32_t request_len = 0;
+	uint8_t cin = packet[0] & 0x0F;
+	uint32_t n;
+
+	switch (cin) {
+		case 0x4: n = 3; break;		// SysEx starts or continues
+		case 0x5: n = 1; break;		// SysEx ends with 1, 2 or 3 bytes
+		case 0x6: n = 2; break;
+		case 0x7: n = 3; break;
+		default: request_len = 0; return;
+	}
+
+	if (packet[1] == 0xF0) request_len = 0;
+
+	for (uint32_t i = 0; i < n; i++) {
+		if (request_len < sizeof(request)) request[request_len] = packet[1 + i];
+		request_len++;
+	}
+
+	if (cin == 0x4) return;
+
+	if (request_len == sizeof(request) && request[0] == 0xF0 && request[1] == SYSEX_ID && request[2] == SYSEX_TAG && request[5] == 0xF7) {
+		if (request[3] == SYSEX_TRACE) trace_request(request[4]);
+		if (request[3] == SYSEX_METRICS) metrics_request(request[4]);
+	}
+	request_len = 0;
+}
+
+// Whole USB-MIDI packets, so a SysEx cut short by a full FIFO goes on where
+// it stopped. `len` is what is left of the message.
+static uint32_t device_sysex_write(const uint8_t *data, uint32_t len) {
+	uint32_t sent = 0;
+
+	while (sent < len) {
+		uint8_t packet[4] = {0};
+		uint32_t n = (len - sent) < 3 ? (len - sent) : 3;
+
+		packet[0] = (sent + n == len) ? (uint8_t)(0x4 + n) : 0x4;	// SysEx ends with n bytes, or continues
+		memcpy(&packet[1], data + sent, n);
+		if (!tud_midi_n_packet_write(0, packet)) break;
+		sent += n;
+	}
+	return sent;
+}
+
+typedef struct {
+	uint32_t (*peek)(const uint8_t **data);
+	void (*consume)(uint32_t len);
+	bool (*open)(void);
+} device_sysex_source_t;
+
+static const device_sysex_source_t device_sysex_sources[] = {
+	{metrics_reply_peek, metrics_reply_consume, metrics_reply_open},
+	{trace_stream_peek, trace_stream_consume, trace_stream_open},
+};
+
+#define DEVICE_SYSEX_SOURCES (sizeof(device_sysex_sources) / sizeof(device_sysex_sources[0]))
+
+// A SysEx partly written to the computer, the pipeline waits for its end.
+static bool device_sysex_open(void) {
+	for (uint32_t i = 0; i < DEVICE_SYSEX_SOURCES; i++) {
+		if (device_sysex_sources[i].open()) return true;
+	}
+	return false;
+}
+
+static void device_sysex_drain(void) {
+	static uint32_t current = 0;
+	static uint32_t progress_us = 0;
+	uint32_t idle = 0;
+	uint32_t now = time_us_32();
+
+	if (!device_midi_idle()) return;
+	if (!device_sysex_open()) progress_us = now;	// only a started message holds up the pipeline
+
+	// Take turns message by message, a message started is finished first.
+	while (idle < DEVICE_SYSEX_SOURCES) {
+		const device_sysex_source_t *source = &device_sysex_sources[current];
+		const uint8_t *data;
+		uint32_t len = source->peek(&data);
+
+		if (len == 0) {
+			current = (current + 1) % DEVICE_SYSEX_SOURCES;
+			idle++;
+			continue;
+		}
+
+		uint32_t sent = device_sysex_write(data, len);
+		source->consume(sent);
+		if (sent > 0) progress_us = now;
+		if (sent < len) {
+			// Nobody reads the port: drop the rest rather than hold up the pipeline.
+			if (now - progress_us > DEVICE_MIDI_STALL_US) {
+				source->consume(len - sent);
+				progress_us = now;
+			}
+			return;
+		}
+
+		current = (current + 1) % DEVICE_SYSEX_SOURCES;
+		idle = 0;
+	}
+}
+
+// Output to the USB MIDI devices on the host port is staged per interface
+// and handed to TinyUSB at most once per 1 ms frame, or sooner when a full
+// bulk packet is waiting; a chord goes out in one transfer, not one each.
+#define HOST_MIDI_PACKETS   64		// staged per interface
+#define HOST_MIDI_FLUSH_LEN 64		// a full-speed bulk packet
+#define HOST_MIDI_FRAME_US  1000
+#define HOST_MIDI_STALL_US  20000	// the device stopped taking data
+
+typedef struct {
+	uint8_t packets[HOST_MIDI_PACKETS * USB_MIDI_PACKET_LEN];
+	uint32_t count;
+	usb_midi_packer_t packer;
+	uint32_t flushed_us;
+	uint32_t progress_us;
+} host_midi_out_t;
+
+static host_midi_out_t host_midi_out[CFG_TUH_MIDI];
+static uint32_t host_midi_transfers = 0;	// this second, counted by tuh_midi_tx_cb()
+static uint32_t host_midi_rate_us = 0;
+
+static bool host_midi_room(uint8_t idx, uint32_t len) {
+	return idx < CFG_TUH_MIDI && host_midi_out[idx].count + len <= HOST_MIDI_PACKETS;
+}
+
+// Up to one packet per byte; false when it does not fit, nothing is staged then.
+static bool host_midi_write(uint8_t idx, uint8_t cable, const uint8_t *data, uint32_t len) {
+	if (!host_midi_room(idx, len)) return false;
+
+	host_midi_out_t *out = &host_midi_out[idx];
+	out->count += usb_midi_pack(&out->packer, cable, data, len, &out->packets[out->count * USB_MIDI_PACKET_LEN]);
+	return true;
+}
+
+static void host_midi_flush_itf(uint8_t idx, uint32_t now) {
+	host_midi_out_t *out = &host_midi_out[idx];
+
+	if (out->count == 0) {
+		out->progress_us = now;
+		return;
+	}
+	if (out->count * USB_MIDI_PACKET_LEN < HOST_MIDI_FLUSH_LEN && now - out->flushed_us < HOST_MIDI_FRAME_US) return;
+
+	metrics_sample(METRICS_HOST_QUEUE_DEPTH, out->count * USB_MIDI_PACKET_LEN);
+
+	// The FIFO takes a bulk packet at most, the rest waits for the next frame.
+	uint32_t written = tuh_midi_packet_write_n(idx, out->packets, out->count * USB_MIDI_PACKET_LEN) / USB_MIDI_PACKET_LEN;
+	tuh_midi_write_flush(idx);
+	out->flushed_us = now;
+
+	if (written > 0) {
+		out->count -= written;
+		memmove(out->packets, &out->packets[written * USB_MIDI_PACKET_LEN], out->count * USB_MIDI_PACKET_LEN);
+		out->progress_us = now;
+	}
+
+	if (out->count > 0 && now - out->progress_us > HOST_MIDI_STALL_US) {
+		out->count = 0;
+	}
+}
+
+static void host_midi_flush(void) {
+	uint32_t now = time_us_32();
+
+	if (midi_itf_idx < CFG_TUH_MIDI) host_midi_flush_itf(midi_itf_idx, now);
+	if (daw_itf_idx < CFG_TUH_MIDI) host_midi_flush_itf(daw_itf_idx, now);
+
+	// Transfers per second, the seconds with host output
+	if (now - host_midi_rate_us >= 1000000) {
+		if (host_midi_transfers > 0) metrics_sample(METRICS_HOST_TRANSFERS_PER_S, host_midi_transfers);
+		host_midi_transfers = 0;
+		host_midi_rate_us = now;
+	}
+}
+
+static void host_midi_reset(uint8_t idx) {
+	if (idx < CFG_TUH_MIDI) memset(&host_midi_out[idx], 0, sizeof(host_midi_out[idx]));
+}
+
+// What the computer sends the DIN port is merged with our own messages a
+// whole message at a time; a SysEx too long to hold keeps the port until it ends.
+#define FORWARD_SYSEX_TIMEOUT_US 100000	// the computer gave up on a SysEx
+
+static usb_midi_unpacker_t forward_unpacker;
+static uint32_t forward_sysex_us = 0;
+static bool uart_pipeline_split = false;	// DIN has part of a pipeline message
+
+// Packets from the computer the host port takes now. Its stream is merged
+// with the pipeline's at message boundaries, so none while a pipeline SysEx
+// is half staged (an open SysEx is the computer's own while forward_unpacker
+// is in one), nor while DIN is between the chunks of a pipeline message;
+// what is not read waits in the device FIFO.
+static uint32_t forward_host_packets(void) {
+	if (uart_pipeline_split) return 0;
+	if (midi_itf_idx >= CFG_TUH_MIDI) return 16;
+
+	const host_midi_out_t *out = &host_midi_out[midi_itf_idx];
+	uint32_t room = (HOST_MIDI_PACKETS - out->count) / 3;	// up to 3 bytes a packet, a packet each
+
+	if (!forward_unpacker.sysex && !usb_midi_packer_idle(&out->packer)) return 0;
+	return room < 16 ? room : 16;
+}
+
+static void usb_device_midi_forward(void) {
+	uint8_t packets[16 * USB_MIDI_PACKET_LEN];
+	uint32_t count;
+	uint32_t max;
+
+	// what the FIFO holds, a few packets per read
+	while ((max = forward_host_packets()) > 0 && (count = tud_midi_n_packet_read_n(0, packets, max)) > 0) {
+		for (uint32_t i = 0; i < count; i++) {
+			uint8_t *buffer = &packets[i * USB_MIDI_PACKET_LEN];
+			uint8_t size = usb_midi_packet_size(buffer);
+			const uint8_t *message;
+			uint32_t len;
+
+			if (size == 0) continue;
+			device_sysex_request(buffer);
+
+			if (midi_itf_idx != 0xFF) {
+				host_midi_write(midi_itf_idx, 0, &buffer[1], size);
+			}
+
+			bool split = forward_unpacker.split;
+			len = usb_midi_unpack(&forward_unpacker, buffer, &message);
+			if (len > 0 && !uart_midi_tx_write(UART_ID, message, len)) {
+				// A SysEx missing a piece is not sent on: the rest of it is
+				// dropped, and our next status byte ends what DIN already has.
+				if (message[0] < 0xF8 && (split || message[0] == 0xF0)) usb_midi_unpacker_reset(&forward_unpacker);
+			}
+			if (forward_unpacker.sysex) forward_sysex_us = time_us_32();
+		}
+
+		cyw43_arch_gpio_put(CYW43_WL_GPIO_LED_PIN, true);
+	}
+
+	if (forward_unpacker.sysex && time_us_32() - forward_sysex_us > FORWARD_SYSEX_TIMEOUT_US) {
+		usb_midi_unpacker_reset(&forward_unpacker);
+	}
+}
+
+static void midi_transport_drain(void) {
+	midi_pipeline_event_t event;
+
+	// Queued bytes delay a sink as much as its own latency does.
+	midi_pipeline_set_sink_backlog(MIDI_SINK_UART, uart_midi_tx_backlog_us(UART_ID));
+	midi_pipeline_set_sink_backlog(MIDI_SINK_WAV_TRIGGER, wav_trigger_i2c_queue_depth() * WAV_TRIGGER_PRO_COMMAND_US);
+	midi_pipeline_align();
+
+	// Notes wait for the end of a trace or metrics SysEx to the computer.
+	if (!device_sysex_open()) device_midi_write();
+
+	// Staged for the frame flush; what does not fit stays in the pipeline, as
+	// does everything while a SysEx from the computer is going to the device.
+	while ((midi_itf_idx == 0xFF || (!forward_unpacker.sysex && host_midi_room(midi_itf_idx, MIDI_PIPELINE_CHUNK_LEN))) && midi_pipeline_due(MIDI_SINK_HOST, &event)) {
+		if (midi_itf_idx != 0xFF) {
+			host_midi_write(midi_itf_idx, event.cable, event.data, event.len);
+		}
+	}
+
+	while ((daw_itf_idx == 0xFF || host_midi_room(daw_itf_idx, MIDI_PIPELINE_CHUNK_LEN)) && midi_pipeline_due(MIDI_SINK_DAW, &event)) {
+		if (daw_itf_idx != 0xFF) {
+			host_midi_write(daw_itf_idx, event.cable, event.data, event.len);
+		}
+	}
+
+	// Not in the middle of a SysEx from the computer. A chunk waits in the
+	// pipeline until the ring has room for it, a SysEx is not cut short.
+	bool uart_written = false;
+	while (usb_midi_unpacker_idle(&forward_unpacker) && uart_midi_tx_free(UART_ID) >= MIDI_PIPELINE_CHUNK_LEN &&
+		   midi_pipeline_due(MIDI_SINK_UART, &event)) {
+		if (!uart_midi_tx_write(UART_ID, event.data, event.len)) break;
+		uart_pipeline_split = event.more > 0;
+		uart_written = true;
+	}
+	if (uart_written) {
+		metrics_sample(METRICS_UART_TX_DEPTH, uart_midi_tx_queued(UART_ID));
+	}
+
+	while (midi_pipeline_due(MIDI_SINK_WAV_TRIGGER, &event)) {
+		wav_trigger_pro_forward_midi_message(event.data, event.len);
+	}
+
+	midi_pipeline_arm_wakeup();
+}
+
+static void launchkey_daw_handshake(void) {
+	static uint32_t connected_ms = 0;
+
+	if (launchkey_daw_mode || !launchkey_connected || midi_itf_idx == 0xFF) {
+		connected_ms = 0;
+		return;
+	}
+
+	// Give the Launchkey half a second after mount before switching it to DAW mode.
+	uint32_t now_ms = to_ms_since_boot(get_absolute_time());
+	
+	if (connected_ms == 0) {
+		connected_ms = now_ms ? now_ms : 1;
+		return;
+	}
+	if (now_ms - connected_ms < 500) return;
+
+	uint8_t msg[3];			
+	msg[0] = 0x9F;
+	msg[1] = 0x0C;
+	msg[2] = 0x7F;
+
+	// Staging full: tried again on the next pass
+	if (host_midi_write(midi_itf_idx, launchkey_tx_cable_count >= 2 ? 1 : 0, msg, 3)) {
+		launchkey_daw_mode = true;
+	}
+}
+
 void core1_main() {
 	//sleep_ms(10);
+	trace_init_core();
 	tuh_init(BOARD_TUH_RHPORT);
+	tud_init(BOARD_TUD_RHPORT);
+	uart_midi_tx_init(UART_ID, BAUD_RATE);
 
 	while (true) {
 		tuh_task(); // tinyusb host task
+		tud_task(); // tinyusb device task
+		
+		usb_device_midi_forward();
+		midi_transport_drain();
+		device_sysex_drain();
+		launchkey_daw_handshake();
+		host_midi_flush();
+		
+		// Woken by core 0 queueing output or by the USB interrupts, the 1 ms SOF
+		// alarm of the PIO USB host bounds the sleep.
+		event_loop_idle();
 	}
 }
 
 int main() {	
 	set_sys_clock_khz(120000, true);
 	sleep_ms(10);
+	trace_init_core();
 	
     stdio_init_all();		
 
@@ -330,11 +736,20 @@ int main() {
 		
     board_init();	
 	
+	// setup UART0 - M5Stack MIDI, DMA transmit set up on core 1
+	uart_init(UART_ID, BAUD_RATE);
+	gpio_set_function(UART_TX_PIN, GPIO_FUNC_UART);
+	gpio_set_function(UART_RX_PIN, GPIO_FUNC_UART);
+	uart_set_fifo_enabled(UART_ID, true);
+	uart_set_translate_crlf(UART_ID, false);
+	
+	event_loop_init();
+	midi_pipeline_init();
 	multicore_reset_core1();
 	multicore_launch_core1(core1_main);	
 	flash_safe_execute_core_init();	
 
-	tud_init(BOARD_TUD_RHPORT);			
+	looper_init();								// pattern storage, before controllers can record
 	bluetooth_init();
 
     //struct repeating_timer timer;	
@@ -343,13 +758,7 @@ int main() {
 	async_timer_init();
 	looper_schedule_step_timer();
     note_scheduler_init();
-	
-	// setup UART0 - M5Stack MIDI
-	uart_init(UART_ID, BAUD_RATE);
-	gpio_set_function(UART_TX_PIN, GPIO_FUNC_UART);
-	gpio_set_function(UART_RX_PIN, GPIO_FUNC_UART);
-	uart_set_fifo_enabled(UART_ID, true);
-	uart_set_translate_crlf(UART_ID, false);
+	chord_table_init();
 	sleep_ms(500);	
 	
 	// setup I2C - WAV Trigger Pro	
@@ -359,55 +768,48 @@ int main() {
     gpio_set_function(I2C_SCL_PIN, GPIO_FUNC_I2C);
     gpio_pull_up(I2C_SDA_PIN);
     gpio_pull_up(I2C_SCL_PIN);	
+	wav_trigger_i2c_init(I2C_ID, WAV_TRIGGER_PRO_ADDR);
 	sleep_ms(500);	
 	
 	wav_trigger_pro_connected = is_wav_trigger_connected();	
 	
 	
+	// UART RX is buffered by its interrupt on this core and wakes the main loop
+	uart_midi_rx_init(UART_ID, BAUD_RATE);
+	
     while (true) {
-		tud_task(); // tinyusb device task		
+		// sleeps until an interrupt, callback or core 1 leaves work
+		uint32_t events = event_loop_wait();
 		
 		if (enable_midi_drums) cyw43_arch_gpio_put(CYW43_WL_GPIO_LED_PIN, false);			
 		
-		while (tud_midi_available()) {
-			uint8_t buffer[4] = {0};			
-			tud_midi_packet_read(buffer);
-			
-			if (midi_itf_idx != 0xFF) {
-				tuh_midi_stream_write(midi_itf_idx, 0, buffer, 4);
-				tuh_midi_write_flush(midi_itf_idx);
-			}
-			
-			uart_write_blocking(UART_ID, buffer, 4);
-			uart_tx_wait_blocking(UART_ID); 			
+		if (events & EVENT_LOOP_UART_RX) {
+			uint8_t ch;
+			while (uart_midi_rx_pop(&ch, NULL)) {
+				process_midi_byte(ch);
+			}		
+		}
 		
-			cyw43_arch_gpio_put(CYW43_WL_GPIO_LED_PIN, true);				
+		// bytes from the USB host MIDI device, queued by core 1
+		if (events & EVENT_LOOP_MIDI_INPUT) {
+			uint8_t ch;
+			while (midi_pipeline_input_pop(&ch)) {
+				process_midi_byte(ch);
+			}
 		}
-
-		while (uart_is_readable(UART_ID)) {
-			uint8_t ch = uart_getc(UART_ID);
-			process_midi_byte(ch);
-		}		
 		
-		note_scheduler_dispatch_pending();
+		// bluepad32 wakes the core with a plain SEV, the queue is checked every pass
+		uni_bt_le_liberlive_process_events();
+		
+		if (events & EVENT_LOOP_NOTE_DUE) {
+			note_scheduler_dispatch_pending();
+		}
 
 		// Poll for incoming MIDI events from any connected BLE MIDI peripheral.
 		// BAO disable BLE for now
 		//ble_midi_controller_poll();
 		
 
-		if (!launchkey_daw_mode && launchkey_connected && midi_itf_idx != 0xFF) {
-			launchkey_daw_mode = true;			
-			sleep_ms(500);
-			
-			uint8_t msg[3];			
-			msg[0] = 0x9F;
-			msg[1] = 0x0C;
-			msg[2] = 0x7F;
-			tuh_midi_stream_write(midi_itf_idx, launchkey_tx_cable_count >= 2 ? 1 : 0, msg, 3);
-			tuh_midi_write_flush(midi_itf_idx);
-		}		
-
 		if (preferences_changed) {
 			preferences_changed = false;
 			storage_store_preferences();
@@ -539,6 +941,8 @@ void tuh_umount_cb(uint8_t daddr) {
 }
 
 void tuh_midi_mount_cb(uint8_t idx, const tuh_midi_mount_cb_t* mount_cb_data) {
+	host_midi_reset(idx);
+
 	if (midi_itf_idx == 0xFF) {
 		midi_itf_idx          = idx;
 		midi_dev_addr         = mount_cb_data->daddr;
@@ -549,6 +953,7 @@ void tuh_midi_mount_cb(uint8_t idx, const tuh_midi_mount_cb_t* mount_cb_data) {
 	if (daw_itf_idx == 0xFF) {
 		daw_itf_idx = idx;
 		daw_dev_addr = mount_cb_data->daddr;
+		launchkey_feedback_reset();
 	}
 	
 	if (enable_mpc_sample) {
@@ -565,6 +970,12 @@ void tuh_midi_umount_cb(uint8_t idx) {
 		launchkey_daw_mode    = false;
 		irig_pro_connected	  = false;
 	}
+	
+	if (idx == daw_itf_idx) {
+		daw_itf_idx           = 0xFF;
+		daw_dev_addr          = 0;
+		launchkey_feedback_reset();
+	}
 	cyw43_arch_gpio_put(CYW43_WL_GPIO_LED_PIN, false);
 }
 
@@ -574,11 +985,92 @@ void tuh_midi_umount_cb(uint8_t idx) {
 //
 //--------------------------------------------------------------------+
 
+typedef enum {
+    CHORD_MAJ,
+    CHORD_MIN,
+    CHORD_SUS4,
+    CHORD_MAJ7,
+    CHORD_7,
+    CHORD_MIN7,
+    CHORD_7SUS4,
+    CHORD_DIM,
+    CHORD_DIM7,
+    CHORD_MIN7B5,
+    CHORD_AUG,
+    CHORD_ADD9,
+    CHORD_MIN_ADD9,
+    CHORD_9,
+    CHORD_MAJ9,
+    CHORD_MIN9,
+    CHORD_QUALITY_COUNT
+} chord_quality_t;
+
+typedef struct {
+    uint16_t intervals;		// pitch-class mask of the shape with the root on bit 0
+    uint8_t type;			// advanced_chord type nibble: 0 = major, 1 = minor, 2 = sus4
+} chord_shape_t;
+
+#define PC(i) (1u << (i))
+
+// In order of preference: when two shapes produce the same pitch-class set
+// the earlier one wins. No two qualities here share a set; the symmetric
+// chords do across roots (C+ / E+ / G#+, Cdim7 / Ebdim7 / F#dim7 / Adim7),
+// where the root nearest C wins.
+static const chord_shape_t chord_shapes[CHORD_QUALITY_COUNT] = {
+    [CHORD_MAJ]      = { PC(0) | PC(4) | PC(7), 0 },
+    [CHORD_MIN]      = { PC(0) | PC(3) | PC(7), 1 },
+    [CHORD_SUS4]     = { PC(0) | PC(5) | PC(7), 2 },
+    [CHORD_MAJ7]     = { PC(0) | PC(4) | PC(7) | PC(11), 0 },
+    [CHORD_7]        = { PC(0) | PC(4) | PC(7) | PC(10), 0 },
+    [CHORD_MIN7]     = { PC(0) | PC(3) | PC(7) | PC(10), 1 },
+    [CHORD_7SUS4]    = { PC(0) | PC(5) | PC(7) | PC(10), 2 },
+    [CHORD_DIM]      = { PC(0) | PC(3) | PC(6), 1 },
+    [CHORD_DIM7]     = { PC(0) | PC(3) | PC(6) | PC(9), 1 },
+    [CHORD_MIN7B5]   = { PC(0) | PC(3) | PC(6) | PC(10), 1 },
+    [CHORD_AUG]      = { PC(0) | PC(4) | PC(8), 0 },
+    [CHORD_ADD9]     = { PC(0) | PC(2) | PC(4) | PC(7), 0 },
+    [CHORD_MIN_ADD9] = { PC(0) | PC(2) | PC(3) | PC(7), 1 },
+    [CHORD_9]        = { PC(0) | PC(2) | PC(4) | PC(7) | PC(10), 0 },
+    [CHORD_MAJ9]     = { PC(0) | PC(2) | PC(4) | PC(7) | PC(11), 0 },
+    [CHORD_MIN9]     = { PC(0) | PC(2) | PC(3) | PC(7) | PC(10), 1 },
+};
+
+static uint16_t chord_rotate(uint16_t intervals, uint8_t root) {
+    return ((intervals << root) | (intervals >> (12 - root))) & 0x0FFF;
+}
+
+static void chord_table_init(void) {
+	// Fill the 4096-entry pitch-class table once at boot, so that recognition is a
+	// single lookup however many chord shapes are known.
+	
+    memset(chord_table, CHORD_NONE, sizeof(chord_table));
+
+    for (uint8_t q = 0; q < CHORD_QUALITY_COUNT; q++) {
+        for (uint8_t root = 0; root < 12; root++) {
+            uint16_t mask = chord_rotate(chord_shapes[q].intervals, root);
+            if (chord_table[mask] == CHORD_NONE) chord_table[mask] = (root << 4) | q;
+        }
+    }
+
+    // Any other four pitch classes containing a major, minor or sus4 triad are
+    // played as that triad with an added tone or a foreign bass note.
+    for (uint8_t q = CHORD_MAJ; q <= CHORD_SUS4; q++) {
+        for (uint8_t root = 0; root < 12; root++) {
+            uint16_t triad = chord_rotate(chord_shapes[q].intervals, root);
+            for (uint8_t extra = 0; extra < 12; extra++) {
+                uint16_t mask = triad | PC(extra);
+                if (mask != triad && chord_table[mask] == CHORD_NONE) chord_table[mask] = (root << 4) | q;
+            }
+        }
+    }
+}
+
 static void chord_note_on(uint8_t note) {
     uint32_t bit = 1u << (note & 31);
     if (!(held_notes_mask[note >> 5] & bit)) {
         held_notes_mask[note >> 5] |= bit;
         held_note_count++;
+        if (held_pc_count[note % 12]++ == 0) held_pc_mask |= PC(note % 12);
     }
 }
 
@@ -587,117 +1079,33 @@ static void chord_note_off(uint8_t note) {
     if (held_notes_mask[note >> 5] & bit) {
         held_notes_mask[note >> 5] &= ~bit;
         if (held_note_count > 0) held_note_count--;
+        if (--held_pc_count[note % 12] == 0) held_pc_mask &= ~PC(note % 12);
     }
 }
 
-static int chord_collect_pcs(uint8_t pcs[12], uint8_t *lowest) {
-	// Collect unique pitch classes of all held notes into pcs[]; set *lowest to
-	// the lowest held MIDI note number.  Returns the number of unique pitch classes.
-	
-    int count = 0;
-    *lowest = 255;
-    for (int n = 0; n < 128; n++) {
-        if (!(held_notes_mask[n >> 5] & (1u << (n & 31)))) continue;
-        if (*lowest == 255) *lowest = (uint8_t)n;
-        uint8_t pc = (uint8_t)(n % 12);
-        bool dup = false;
-        for (int i = 0; i < count; i++) {
-            if (pcs[i] == pc) { dup = true; break; }
-        }
-        if (!dup && count < 12) pcs[count++] = pc;
-    }
-    return count;
-}
-
-static bool triad_match(uint8_t root, const uint8_t pcs[3], uint8_t i0, uint8_t i1) {
-	// Returns true when pcs[0..2] is exactly the set {root, root+i0, root+i1} mod 12.	
-    uint8_t t1 = (root + i0) % 12;
-    uint8_t t2 = (root + i1) % 12;
-    int found = 0;
-    for (int i = 0; i < 3; i++) {
-        if (pcs[i] == root || pcs[i] == t1 || pcs[i] == t2) found++;
+static uint8_t chord_lowest_note(void) {
+    for (int w = 0; w < 4; w++) {
+        if (held_notes_mask[w]) return (uint8_t)(w * 32 + __builtin_ctz(held_notes_mask[w]));
     }
-    return found == 3;
+    return 255;
 }
 
 static void chord_detect(void) {
-	// Analyse the currently held notes and print the detected chord whenever 3 or
-	// 4 notes are pressed simultaneously.  Recognised chord types:
-	//   3-note: major {0,4,7}, minor {0,3,7}, sus4 {0,5,7}
-	//   4-note: maj7  {0,4,7,11}; falls back to a slash-chord triad + bass note.
+	// Look up the held pitch classes whenever 3 or more notes are pressed.  The bass
+	// is the lowest held note, so inversions and slash chords keep their bass.
 	
     if (held_note_count < 3) return;
 
-    uint8_t pcs[12];
-    uint8_t lowest = 255;
-    int n = chord_collect_pcs(pcs, &lowest);
-    if (n < 3 || n > 4) return;
-
-    const char *chord_name = NULL;
-    uint8_t chord_root = 255;
-
-    if (n == 3) {
-        // Interval tables for triad shapes
-        static const uint8_t ti0[3] = { 4, 3, 5 };   // major, minor, sus4
-        static const uint8_t ti1[3] = { 7, 7, 7 };
-        static const char *const tn[3] = { "maj", "min", "sus4" };
-        for (int t = 0; t < 3 && !chord_name; t++) {
-            for (int r = 0; r < 3 && !chord_name; r++) {
-                if (triad_match(pcs[r], pcs, ti0[t], ti1[t])) {
-                    chord_root = pcs[r];
-                    chord_name = tn[t];
-                }
-            }
-        }
-    } else { // n == 4
-        // Try maj7: {root, root+4, root+7, root+11}
-        for (int r = 0; r < 4 && !chord_name; r++) {
-            uint8_t t1 = (pcs[r] + 4)  % 12;
-            uint8_t t2 = (pcs[r] + 7)  % 12;
-            uint8_t t3 = (pcs[r] + 11) % 12;
-            int found = 0;
-            for (int i = 0; i < 4; i++) {
-                if (pcs[i] == pcs[r] || pcs[i] == t1 ||
-                    pcs[i] == t2      || pcs[i] == t3) found++;
-            }
-            if (found == 4) { chord_root = pcs[r]; chord_name = "maj7"; }
-        }
-        // Fallback: try a triad within any 3-note subset (slash chord)
-        if (!chord_name) {
-            static const uint8_t si0[3] = { 4, 3, 5 };
-            static const uint8_t si1[3] = { 7, 7, 7 };
-            static const char *const sn[3] = { "maj", "min", "sus4" };
-            for (int skip = 0; skip < 4 && !chord_name; skip++) {
-                uint8_t sub[3]; int si = 0;
-                for (int j = 0; j < 4; j++) if (j != skip) sub[si++] = pcs[j];
-                for (int t = 0; t < 3 && !chord_name; t++) {
-                    for (int r = 0; r < 3 && !chord_name; r++) {
-                        if (triad_match(sub[r], sub, si0[t], si1[t])) {
-                            chord_root = sub[r];
-                            chord_name = sn[t];
-                        }
-                    }
-                }
-            }
-        }
-    }
+    uint8_t entry = chord_table[held_pc_mask];
+    if (entry == CHORD_NONE) return;
 
-    if (chord_name && lowest != 255) {
-        // Map chord type to advanced_chord type nibble (pico_bluetooth.c scheme):
-        //   0 = major  (also used for maj7, which has no dedicated sampler type)
-        //   1 = minor
-        //   2 = sus4
-        uint8_t type = 0;
-        if (strcmp(chord_name, "min") == 0)  type = 1;
-        else if (strcmp(chord_name, "sus4") == 0) type = 2;
-
-        // Encode advanced_chord: high byte = root (1-based), middle nibble =
-        // bass (1-based), low nibble = type.  Mirrors the pico_bluetooth.c scheme.
-        uint8_t root_1based = chord_root + 1;
-        uint8_t bass_1based = (lowest % 12) + 1;
-        advanced_chord = (root_1based * 256) + (bass_1based * 16) + type;
-		trigger_loop();
-    }
+    // Encode advanced_chord: high byte = root (1-based), middle nibble =
+    // bass (1-based), low nibble = type.  Mirrors the pico_bluetooth.c scheme.
+    uint8_t root_1based = (entry >> 4) + 1;
+    uint8_t bass_1based = (chord_lowest_note() % 12) + 1;
+    uint8_t type = chord_shapes[entry & 0x0F].type;
+    advanced_chord = (root_1based * 256) + (bass_1based * 16) + type;
+    trigger_loop();
 }
 
 void trigger_loop() {
@@ -1100,12 +1508,12 @@ void process_midi_byte(uint8_t b) {
 	}
 
 	buffer[0] = b;	
-	tud_midi_n_stream_write(0, 0, buffer, 1);
+	uint8_t sinks = MIDI_SINK_DEVICE;
 
 	if (!enable_mpx_looper && !mute_midi_controller) { 	// filter midi events from mpx pads	to midi synth			
-		uart_write_blocking(UART_ID, buffer, 1);
-		uart_tx_wait_blocking(UART_ID);			
+		sinks |= MIDI_SINK_UART;
 	}	
+	midi_pipeline_send(sinks, 0, 0, buffer, 1);
 	
 }
 
@@ -1121,8 +1529,8 @@ void tuh_midi_rx_cb(uint8_t idx, uint32_t xferred_bytes) {
 		for (uint32_t i=0; i<bytes_read; i++) 
 		{
 			if (enable_mpc_sample || enable_sp404mk2 || enable_nanobox_tangerine || enable_wav_trigger_pro) {
-				// Parse the raw MIDI byte stream to track note on/off events.
-				process_midi_byte(buffer[i]);
+				// Parsed on core 0 to track note on/off events.
+				midi_pipeline_input_push(buffer[i]);
 			}
 		}
 	
@@ -1132,7 +1540,11 @@ void tuh_midi_rx_cb(uint8_t idx, uint32_t xferred_bytes) {
 
 void tuh_midi_tx_cb(uint8_t idx, uint32_t xferred_bytes) {
 	(void) idx;
-	(void) xferred_bytes;
+
+	if (xferred_bytes > 0) {
+		host_midi_transfers++;
+		metrics_count(METRICS_HOST_TRANSFERS);
+	}
 }
 
 void tud_mount_cb(void) {
@@ -1162,25 +1574,38 @@ void tud_resume_cb(void) {
 //
 //--------------------------------------------------------------------+
 
+// Fixed SysEx headers. Messages are built by copying a header and appending the
+// parameter bytes and EOX, see SYSEX_SEND().
+static const uint8_t SYSEX_ROLAND_DREAM_DELAY[] = { 0xF0, 0x41, 0x00, 0x42, 0x12, 0x40, 0x01, 0x35 };
+static const uint8_t SYSEX_YAMAHA_MODX[]        = { 0xF0, 0x43, 0x10, 0x7F, 0x1C, 0x0D };
+static const uint8_t SYSEX_YAMAHA_SEQTRAK[]     = { 0xF0, 0x43, 0x10, 0x7F, 0x1C, 0x0C };
+static const uint8_t SYSEX_YAMAHA_START_STOP[]  = { 0xF0, 0x43, 0x60 };
+static const uint8_t SYSEX_YAMAHA_ARR[]         = { 0xF0, 0x43, 0x7E, 0x00 };
+static const uint8_t SYSEX_KETRON_ARR[]         = { 0xF0, 0x26, 0x79, 0x05, 0x00 };
+static const uint8_t SYSEX_KETRON_FOOTSW[]      = { 0xF0, 0x26, 0x7C, 0x05, 0x01 };
+static const uint8_t SYSEX_LAUNCHKEY_DISPLAY[]  = { 0xF0, 0x00, 0x20, 0x29, 0x02, 0x13, 0x04 };	// use 0x14 for full keys, 0x04 = display target
+
+static size_t sysex_build(uint8_t *msg, const uint8_t *header, size_t header_len, const uint8_t *params, size_t params_len) {
+	memcpy(msg, header, header_len);
+	memcpy(msg + header_len, params, params_len);
+	msg[header_len + params_len] = 0xF7;
+	return header_len + params_len + 1;
+}
+
+// Send <header> <params...> F7 to all MIDI outputs.
+#define SYSEX_SEND(header, ...) do { \
+	const uint8_t sysex_params[] = { __VA_ARGS__ }; \
+	uint8_t sysex_msg[sizeof(header) + sizeof(sysex_params) + 1]; \
+	midi_n_stream_write(0, 0, sysex_msg, sysex_build(sysex_msg, header, sizeof(header), sysex_params, sizeof(sysex_params))); \
+} while (0)
+
 void dream_set_delay(int tempo) {
 	uint8_t rate = (60000 / tempo / 128 / 4) % 128;
 	int check_sum = (rate % 128);
 	check_sum = 128 - check_sum;
 	if (check_sum == 128) check_sum = 0;
 	
-	uint8_t msg[11];	
-	msg[0] = 0xF0;
-	msg[1] = 0x41;
-	msg[2] = 0x00;   
-	msg[3] = 0x42;
-	msg[4] = 0x12;
-	msg[5] = 0x40; 
-	msg[6] = 0x01;
-	msg[7] = 0x35;
-	msg[8] = rate;
-	msg[9] = check_sum;	
-	msg[10] = 0xF7;	
-	midi_n_stream_write(0, 0, msg, 11);	
+	SYSEX_SEND(SYSEX_ROLAND_DREAM_DELAY, rate, (uint8_t)check_sum);
 
 	//msg[7] = 0x3D;
 	//midi_n_stream_write(0, 0, msg, 11);		
@@ -1189,222 +1614,73 @@ void dream_set_delay(int tempo) {
 void midi_modx_key(uint8_t key) {
 	if (!enable_modx) return;
 	
-	uint8_t msg[12];	
-	msg[0] = 0xF0;
-	msg[1] = 0x43;
-	msg[2] = 0x10;   
-	msg[3] = 0x7F;
-	msg[4] = 0x1C;
-	msg[5] = 0x0D; 
-	msg[6] = 0x00;
-	msg[7] = 0x00;
-	msg[8] = 0x02;
-	msg[9] = 0x00;	
-	msg[10] = 0x40 + key;
-	msg[11] = 0xF7;
-	
-	midi_n_stream_write(0, 0, msg, 12);	
+	SYSEX_SEND(SYSEX_YAMAHA_MODX, 0x00, 0x00, 0x02, 0x00, 0x40 + key);
 }
 
 void midi_modx_arp_octave(uint8_t octave) {
 	if (!enable_modx) return;	
 	
-	uint8_t msg[12];	
-	msg[0] = 0xF0;
-	msg[1] = 0x43;
-	msg[2] = 0x10;   
-	msg[3] = 0x7F;
-	msg[4] = 0x1C;
-	msg[5] = 0x0D; 
-	msg[6] = 0x00;
-	msg[7] = 0x00;
-	msg[8] = 0x02;
-	msg[9] = 0x02;	
-	msg[10] = 0x40 + octave;
-	msg[11] = 0xF7;	
-	
-	midi_n_stream_write(0, 0, msg, 12);		
+	SYSEX_SEND(SYSEX_YAMAHA_MODX, 0x00, 0x00, 0x02, 0x02, 0x40 + octave);
 }
 
 void midi_modx_arp(bool on) {
 	if (!enable_modx) return;	
 		
-	uint8_t msg[12];	
-	msg[0] = 0xF0;
-	msg[1] = 0x43;
-	msg[2] = 0x10;   
-	msg[3] = 0x7F;
-	msg[4] = 0x1C;
-	msg[5] = 0x0D; 
-	msg[6] = 0x06;
-	msg[7] = 0x00;
-	msg[8] = 0x01;
-	msg[9] = 0x09;	
-	msg[10] = on ? 1 : 0;
-	msg[11] = 0xF7;
-	
-	midi_n_stream_write(0, 0, msg, 12);		
+	SYSEX_SEND(SYSEX_YAMAHA_MODX, 0x06, 0x00, 0x01, 0x09, on ? 1 : 0);
 }
 
 void midi_modx_arp_hold(uint8_t part, bool on) {
 	if (!enable_modx) return;	
 		
-	uint8_t msg[13];	
-	msg[0] = 0xF0;
-	msg[1] = 0x43;
-	msg[2] = 0x10;   
-	msg[3] = 0x7F;
-	msg[4] = 0x1C;
-	msg[5] = 0x0D; 
-	msg[6] = 0x10 + part;
-	msg[7] = 0x00;
-	msg[8] = 0x06;
-	msg[9] = 0x00;	
-	msg[10] = 0x00;
-	msg[11] = on ? 2 : 1;
-	msg[12] = 0xF7;
-	
-	midi_n_stream_write(0, 0, msg, 13);		
+	SYSEX_SEND(SYSEX_YAMAHA_MODX, 0x10 + part, 0x00, 0x06, 0x00, 0x00, on ? 2 : 1);
 }
 
 void midi_modx_arp_realtime(uint8_t part, bool on) {
 	if (!enable_modx) return;	
 		
-	uint8_t msg[13];	
-	msg[0] = 0xF0;
-	msg[1] = 0x43;
-	msg[2] = 0x10;   
-	msg[3] = 0x7F;
-	msg[4] = 0x1C;
-	msg[5] = 0x0D; 
-	msg[6] = 0x10 + part;
-	msg[7] = 0x00;
-	msg[8] = 0x06;
-	msg[9] = 0x10;	
-	msg[10] = 0x00;
-	msg[11] = on ? 0 : 1;
-	msg[12] = 0xF7;
-	
-	midi_n_stream_write(0, 0, msg, 13);		
+	SYSEX_SEND(SYSEX_YAMAHA_MODX, 0x10 + part, 0x00, 0x06, 0x10, 0x00, on ? 0 : 1);
 }
 
 void midi_modx_tempo(int tempo) {
 	if (!enable_modx) return;	
 	
-	uint8_t msg[13];	
-	msg[0] = 0xF0;
-	msg[1] = 0x43;
-	msg[2] = 0x10;   
-	msg[3] = 0x7F;
-	msg[4] = 0x1C;
-	msg[5] = 0x0D; 
-	msg[6] = 0x06;
-	msg[7] = 0x00;
-	msg[8] = 0x02;
-	msg[9] = 0x1E;	
-	msg[10] = (int) (tempo / 128);
-	msg[11] = tempo % 128;
-	msg[12] = 0xF7;
-	
-	midi_n_stream_write(0, 0, msg, 13);	
+	SYSEX_SEND(SYSEX_YAMAHA_MODX, 0x06, 0x00, 0x02, 0x1E, (uint8_t)(tempo / 128), tempo % 128);
 }
 
 void midi_seqtrak_arp_octave(uint8_t track, int octave) {
 	if (!enable_seqtrak) return;	
 	
-	uint8_t msg[11];	
-	msg[0] = 0xF0;
-	msg[1] = 0x43;
-	msg[2] = 0x10;   
-	msg[3] = 0x7F;
-	msg[4] = 0x1C;
-	msg[5] = 0x0C; 
-	msg[6] = 0x31;
-	msg[7] = 0x50 + track;
-	msg[8] = 0x1C;
-	msg[9] = 0x40 + octave;	// 0x3D - 0x43 (-3 to +3)
-	msg[10] = 0xF7;
-	
-	midi_n_stream_write(0, 0, msg, 11);	
+	SYSEX_SEND(SYSEX_YAMAHA_SEQTRAK, 0x31, 0x50 + track, 0x1C, 0x40 + octave);	// 0x3D - 0x43 (-3 to +3)
 }
 
 void midi_seqtrak_tempo(int tempo) {
 	if (!enable_seqtrak) return;	
 	
-	uint8_t msg[12];	
-	msg[0] = 0xF0;
-	msg[1] = 0x43;
-	msg[2] = 0x10;   
-	msg[3] = 0x7F;
-	msg[4] = 0x1C;
-	msg[5] = 0x0C; 
-	msg[6] = 0x30;
-	msg[7] = 0x40;
-	msg[8] = 0x76;
-	msg[9] = (int) (tempo / 128);
-	msg[10] = tempo % 128;
-	msg[11] = 0xF7;
-	
-	midi_n_stream_write(0, 0, msg, 12);	
+	SYSEX_SEND(SYSEX_YAMAHA_SEQTRAK, 0x30, 0x40, 0x76, (uint8_t)(tempo / 128), tempo % 128);
 }
 
 void midi_seqtrak_key(uint8_t key) {
 	if (!enable_seqtrak) return;	
 	
-	uint8_t msg[11];	
-	msg[0] = 0xF0;
-	msg[1] = 0x43;
-	msg[2] = 0x10;   
-	msg[3] = 0x7F;
-	msg[4] = 0x1C;
-	msg[5] = 0x0C; 
-	msg[6] = 0x30;
-	msg[7] = 0x40;
-	msg[8] = 0x7F;
-	msg[9] = key;
-	msg[10] = 0xF7;
-	
-	midi_n_stream_write(0, 0, msg, 11);	
+	SYSEX_SEND(SYSEX_YAMAHA_SEQTRAK, 0x30, 0x40, 0x7F, key);
 }
 
 void midi_seqtrak_mute(uint8_t track, bool mute) {
 	if (!enable_seqtrak) return;	
 	
-	uint8_t msg[11];	
-	msg[0] = 0xF0;
-	msg[1] = 0x43;
-	msg[2] = 0x10;   
-	msg[3] = 0x7F;
-	msg[4] = 0x1C;
-	msg[5] = 0x0C; 
-	msg[6] = 0x30;
-	msg[7] = 0x50 + track;
-	msg[8] = 0x29;
-	msg[9] = mute ? 0x7D : 0;
-	msg[10] = 0xF7;
-	
-	midi_n_stream_write(0, 0, msg, 11);	
+	SYSEX_SEND(SYSEX_YAMAHA_SEQTRAK, 0x30, 0x50 + track, 0x29, mute ? 0x7D : 0);
 }
 
 void midi_seqtrak_pattern(uint8_t pattern) {
 	if (!enable_seqtrak) return;	
 	
-	uint8_t msg[11];	
-	msg[0] = 0xF0;
-	msg[1] = 0x43;
-	msg[2] = 0x10;   
-	msg[3] = 0x7F;
-	msg[4] = 0x1C;
-	msg[5] = 0x0C; 
-	msg[6] = 0x30;
-
-	msg[8] = 0x0F;
-	msg[9] = pattern;
-	msg[10] = 0xF7;
+	const uint8_t params[] = { 0x30, 0x50, 0x0F, pattern };
+	uint8_t msg[sizeof(SYSEX_YAMAHA_SEQTRAK) + sizeof(params) + 1];
+	size_t len = sysex_build(msg, SYSEX_YAMAHA_SEQTRAK, sizeof(SYSEX_YAMAHA_SEQTRAK), params, sizeof(params));
 				
 	for (int i=0; i<7; i++) {						
-		msg[7] = 0x50 + i;
-		midi_n_stream_write(0, 0, msg, 11);	
+		msg[7] = 0x50 + i;				// patch the track byte in place
+		midi_n_stream_write(0, 0, msg, len);	
 	}	
 }
 
@@ -1442,7 +1718,9 @@ void sampler_midi_note(uint8_t command, uint8_t note, uint8_t velocity) {
 	msg[2] = velocity;   
 
 	if (enable_wav_trigger_pro && midi_keyboard_connected) {	// WAV trigger Pro cannot be on USB Host. Something else is
-		wav_trigger_pro_forward_midi_message(msg, 3);
+		if (wav_trigger_pro_can_send_midi_message(msg, 3)) {
+			midi_pipeline_send(MIDI_SINK_WAV_TRIGGER, 0, 0, msg, 3);
+		}
 	} else {
 		midi_n_stream_write(0, 0, msg, 3);	// includes sampler connected by UART0 MIDI	
 	}
@@ -1519,62 +1797,25 @@ void midi_start_stop(bool start) {
 }
 
 void midi_yamaha_start_stop(int8_t code, bool on) {
-	uint8_t msg[6];	
-	msg[0] = 0xF0;
-	msg[1] = 0x43; 
-	msg[2] = 0x60;
-	msg[3] = code; 
-	msg[4] = on ? 0x7F : 0x00;	
-	msg[5] = 0xF7;
-
-	midi_n_stream_write(0, 0, msg, 6);	
+	SYSEX_SEND(SYSEX_YAMAHA_START_STOP, (uint8_t)code, on ? 0x7F : 0x00);
 }
 
 void midi_yamaha_arr(uint8_t code, bool on) {
 	if (enable_seqtrak) return;
 	
-	uint8_t msg[7];	
-	msg[0] = 0xF0;
-	msg[1] = 0x43;
-	msg[2] = 0x7E;   
-	msg[3] = 0x00;
-	msg[4] = code; 
-	msg[5] = on ? 0x7F : 0x00;
-	msg[6] = 0xF7;
-
-	midi_n_stream_write(0, 0, msg, 7);	
+	SYSEX_SEND(SYSEX_YAMAHA_ARR, code, on ? 0x7F : 0x00);
 }
 
 void midi_ketron_arr(uint8_t code, bool on) {
 	if (enable_seqtrak) return;
 	
-	uint8_t msg[8];	
-	msg[0] = 0xF0;
-	msg[1] = 0x26;
-	msg[2] = 0x79;   
-	msg[3] = 0x05;
-	msg[4] = 0x00;
-	msg[5] = code; 
-	msg[6] = on ? 0x7F : 0x00;
-	msg[7] = 0xF7;
-
-	midi_n_stream_write(0, 0, msg, 8);	
+	SYSEX_SEND(SYSEX_KETRON_ARR, code, on ? 0x7F : 0x00);
 }
 
 void midi_ketron_footsw(uint8_t code, bool on) {
 	if (enable_seqtrak) return;
 	
-	uint8_t msg[8];		
-	msg[0] = 0xF0;
-	msg[1] = 0x26;
-	msg[2] = 0x7C;   
-	msg[3] = 0x05;
-	msg[4] = 0x01;
-	msg[5] = 0x55 + code; 
-	msg[6] = on ? 0x7F : 0x00;
-	msg[7] = 0xF7;
-
-	midi_n_stream_write(0, 0, msg, 8);	
+	SYSEX_SEND(SYSEX_KETRON_FOOTSW, 0x55 + code, on ? 0x7F : 0x00);
 }
 
 void midi_send_chord_note(uint8_t note, uint8_t velocity) {
@@ -1707,20 +1948,18 @@ void midi_play_slash_chord(bool on, uint8_t p1, uint8_t p2, uint8_t p3, uint8_t
 }
 
 void midi_n_stream_write(uint8_t itf, uint8_t cable_num, uint8_t *buffer, uint32_t bufsize) {
-	tud_midi_n_stream_write(itf, cable_num, buffer, bufsize);
+	uint8_t sinks = MIDI_SINK_DEVICE | MIDI_SINK_UART;
 	
 	if (!midi_keyboard_connected) 	// don't send control events to midi keyboard
 	{
-		if (midi_itf_idx != 0xFF) {
-			tuh_midi_stream_write(midi_itf_idx, cable_num, buffer, bufsize);
-			tuh_midi_write_flush(midi_itf_idx);
-		}
+		sinks |= MIDI_SINK_HOST;
 	}
 
-	uart_write_blocking(UART_ID, buffer, bufsize);
-	uart_tx_wait_blocking(UART_ID);
-	
-	wav_trigger_pro_forward_midi_message(buffer, bufsize);
+	if (wav_trigger_pro_can_send_midi_message(buffer, bufsize)) {
+		sinks |= MIDI_SINK_WAV_TRIGGER;
+	}
+
+	midi_pipeline_send(sinks, itf, cable_num, buffer, bufsize);
 }
 
 void send_ble_midi(uint8_t* midi_data, int len) {
@@ -1757,12 +1996,32 @@ static bool wav_trigger_pro_write_command(uint8_t cmd, const uint8_t *payload, s
 		memcpy(&buffer[1], payload, payload_len);
 	}
 
-	return i2c_write_blocking(I2C_ID, WAV_TRIGGER_PRO_ADDR, buffer, payload_len + 1, false) == (int)(payload_len + 1);
+	return wav_trigger_i2c_write(buffer, payload_len + 1);
 }
 
-static bool wav_trigger_pro_read_response(uint8_t *buffer, size_t len) {
-	if (buffer == NULL || len == 0) return false;
-	return i2c_read_blocking(I2C_ID, WAV_TRIGGER_PRO_ADDR, buffer, len, false) == (int)len;
+static bool wav_trigger_pro_query(uint8_t cmd, const uint8_t *payload, size_t payload_len, uint8_t *response, size_t response_len) {
+	// The read is started from the I2C transport once the module had time to prepare
+	// its answer; callers only wait here for a value they cannot continue without.
+	if (response == NULL || response_len == 0) return false;
+	if (payload == NULL && payload_len > 0) return false;
+	if (payload_len > WAV_TRIGGER_PRO_MAX_PAYLOAD_LEN) return false;
+
+	uint8_t buffer[WAV_TRIGGER_PRO_MAX_MESSAGE_LEN];
+	buffer[0] = cmd;
+
+	if (payload_len > 0) {
+		memcpy(&buffer[1], payload, payload_len);
+	}
+
+	if (!wav_trigger_i2c_query(buffer, payload_len + 1, response_len)) return false;
+
+	absolute_time_t deadline = make_timeout_time_us(WAV_TRIGGER_PRO_RESPONSE_TIMEOUT_US);
+	while (true) {
+		wav_trigger_i2c_query_state_t state = wav_trigger_i2c_query_result(response, response_len);
+		if (state == WAV_TRIGGER_I2C_QUERY_DONE) return true;
+		if (state != WAV_TRIGGER_I2C_QUERY_PENDING) return false;
+		if (best_effort_wfe_or_timeout(deadline)) return false;
+	}
 }
 
 static uint16_t wav_trigger_pro_pack_signed_16bit(int16_t value) {
@@ -1816,12 +2075,8 @@ static void wav_trigger_pro_forward_midi_message(const uint8_t *buffer, uint32_t
 
 bool wav_trigger_pro_get_version(char *dst, size_t dst_len) {
 	if (dst == NULL || dst_len == 0) return false;
-	if (!wav_trigger_pro_write_command(CMD_GET_VERSION, NULL, 0)) return false;
-
-	sleep_ms(WAV_TRIGGER_PRO_RESPONSE_DELAY_MS);
-
 	uint8_t version[WAV_TRIGGER_PRO_VERSION_STRING_LEN];
-	if (!wav_trigger_pro_read_response(version, sizeof(version))) return false;
+	if (!wav_trigger_pro_query(CMD_GET_VERSION, NULL, 0, version, sizeof(version))) return false;
 
 	size_t copy_len = sizeof(version);
 	size_t max_copy_len = dst_len - 1;
@@ -1833,12 +2088,8 @@ bool wav_trigger_pro_get_version(char *dst, size_t dst_len) {
 }
 
 int wav_trigger_pro_get_num_tracks(void) {
-	if (!wav_trigger_pro_write_command(CMD_GET_NUM_TRACKS, NULL, 0)) return -1;
-
-	sleep_ms(WAV_TRIGGER_PRO_RESPONSE_DELAY_MS);
-
 	uint8_t response[2];
-	if (!wav_trigger_pro_read_response(response, sizeof(response))) return -1;
+	if (!wav_trigger_pro_query(CMD_GET_NUM_TRACKS, NULL, 0, response, sizeof(response))) return -1;
 
 	return (int)wav_trigger_pro_unpack_uint16(response);
 }
@@ -1862,18 +2113,12 @@ bool wav_trigger_pro_track_get_status(uint16_t track, uint8_t *status) {
 	uint8_t payload[2];
 	wav_trigger_pro_pack_uint16(payload, track);
 
-	if (!wav_trigger_pro_write_command(CMD_GET_TRACK_STATUS, payload, sizeof(payload))) return false;
-
-	sleep_ms(WAV_TRIGGER_PRO_RESPONSE_DELAY_MS);
-	return wav_trigger_pro_read_response(status, 1);
+	return wav_trigger_pro_query(CMD_GET_TRACK_STATUS, payload, sizeof(payload), status, 1);
 }
 
 bool wav_trigger_pro_get_num_active_voices(uint8_t *voices) {
 	if (voices == NULL) return false;
-	if (!wav_trigger_pro_write_command(CMD_GET_NUM_ACTIVE_VOICES, NULL, 0)) return false;
-
-	sleep_ms(WAV_TRIGGER_PRO_RESPONSE_DELAY_MS);
-	return wav_trigger_pro_read_response(voices, 1);
+	return wav_trigger_pro_query(CMD_GET_NUM_ACTIVE_VOICES, NULL, 0, voices, 1);
 }
 
 bool wav_trigger_pro_track_set_loop(uint16_t track, bool loop) {
@@ -1930,7 +2175,7 @@ bool wav_trigger_pro_track_fade(uint16_t track, int16_t gain_db, uint16_t time_m
     txbuf[4] = (uint8_t)(tmp16 >> 8);
 	txbuf[5] = (uint8_t)time_ms;
 	txbuf[6] = (uint8_t)(time_ms >> 8);	
-	return i2c_write_blocking(I2C_ID, WAV_TRIGGER_PRO_ADDR, txbuf, 7, false) == (int)(7);
+	return wav_trigger_i2c_write(txbuf, 7);
 }
 
 bool wav_trigger_pro_send_midi_msg(uint8_t cmd, uint8_t dat1, uint8_t dat2) {
@@ -1946,7 +2191,7 @@ bool wav_trigger_pro_send_midi_msg(uint8_t cmd, uint8_t dat1, uint8_t dat2) {
 		(uint8_t)(dat2 & MIDI_DATA_BYTE_MASK),
 	};
 
-	return wav_trigger_pro_write_command(CMD_MIDI_MSG, payload, sizeof(payload));
+	return wav_trigger_i2c_write_midi(CMD_MIDI_MSG, payload);
 }
 
 bool wav_trigger_pro_load_preset(uint16_t preset) {
@@ -1965,10 +2210,35 @@ bool wav_trigger_pro_set_output_gain(int16_t gain_db) {
 
 //--------------------------------------------------------------------+
 //
-// WAV Trigger Pro
+// Launchkey
 //
 //--------------------------------------------------------------------+
 
+// Last LED state sent per pad (Note) and button (CC), (channel << 7) | color.
+static uint16_t launchkey_led_state[2][128];
+static char launchkey_display_state[LAUNCHKEY_MAX_TEXT_LEN + 1];
+static bool launchkey_display_valid = false;
+static volatile bool launchkey_feedback_stale = true;
+
+// Core 1, on mount and unmount: the cache belongs to core 0, which clears it
+// before its next use.
+static void launchkey_feedback_reset(void) {
+	launchkey_feedback_stale = true;
+}
+
+static void launchkey_feedback_check(void) {
+	if (!launchkey_feedback_stale) return;
+	launchkey_feedback_stale = false;
+	memset(launchkey_led_state, 0xFF, sizeof(launchkey_led_state));
+	launchkey_display_valid = false;
+}
+
+static bool launchkey_write(const uint8_t *msg, uint32_t len) {
+	// Core 1 stages the DAW interface and flushes it once per USB frame, so a
+	// burst of LED updates goes out in one transfer.
+	return midi_pipeline_send(MIDI_SINK_DAW, 0, 0, msg, len);
+}
+
 void launchkey_set_led(uint8_t msg_type, uint8_t channel, uint8_t index, uint8_t color_id) {
 	/**
 	 * 1. Change LED Color on Pads / Buttons
@@ -1985,14 +2255,24 @@ void launchkey_set_led(uint8_t msg_type, uint8_t channel, uint8_t index, uint8_t
 	
 	if (daw_itf_idx != 0xFF) {
 		uint8_t status_byte = (msg_type & 0xF0) | (channel & 0x0F);
+		uint16_t *state = NULL;
+		uint16_t value = ((channel & 0x0F) << 7) | (color_id & 0x7F);
+		
+		launchkey_feedback_check();
+
+		// Skip LEDs that already show this color
+		if ((msg_type & 0xF0) == 0x90 || (msg_type & 0xF0) == 0xB0) {
+			state = &launchkey_led_state[(msg_type & 0xF0) == 0xB0][index & 0x7F];
+			if (*state == value) return;
+		}
 		
 		uint8_t msg[3];	
 		msg[0] = status_byte;
 		msg[1] = index;
 		msg[2] = color_id;
 	
-		tuh_midi_stream_write(daw_itf_idx, 0, msg, 3);
-		tuh_midi_write_flush(daw_itf_idx);
+		// A dropped message leaves the LED to be sent again
+		if (launchkey_write(msg, 3) && state != NULL) *state = value;
 	}	
 }
 
@@ -2005,42 +2285,35 @@ void launchkey_display_text(const char* text, bool is_temp) {
 	 * @param text       ASCII null-terminated string to print on screen
 	 * @param is_temp    true = temporary alert window, false = stationary display string
 	 */	
-	 
-    // Novation Header: Sysex Open, Manufacturer ID (00 20 29), Launchkey Family ID
-    uint8_t sysex_header[] = { 0xF0, 0x00, 0x20, 0x29, 0x02, 0x13 }; //use 0x14 for full keys
-    
-    // MK4 Custom Command Sub-IDs (0x04 for display target handling)
-    uint8_t cmd_sub_id = 0x04; 
-    
-    // Display Mode: 0x01 for Temporary Popup Message, 0x00 for Stationary Default string
-    uint8_t display_mode = is_temp ? 0x01 : 0x00;
-    uint8_t msg[LAUNCHKEY_DISPLAY_MSG_SIZE];
-		
-    // Send Header
-    for (size_t i = 0; i < sizeof(sysex_header); i++) {
-        msg[i] = sysex_header[i];
-    }
-    
-    // Send Display Sub-command properties
-    msg[6] = cmd_sub_id;
-    msg[7] = display_mode;
-    
-    // Stream ASCII Text characters payload (Limit safely to 16-32 characters depending on UI layout)
+	
+	if (daw_itf_idx == 0xFF) return;
+	
     size_t len = strlen(text);
 	if (len > LAUNCHKEY_MAX_TEXT_LEN) len = LAUNCHKEY_MAX_TEXT_LEN;
+
+	launchkey_feedback_check();
+
+	// A stationary string stays on screen, so sending it again changes nothing.
+	// Popups time out on the device and are always sent.
+	if (!is_temp) {
+		if (launchkey_display_valid && strncmp(launchkey_display_state, text, len) == 0 && launchkey_display_state[len] == '\0') return;
+	}
+	
+    // Display Mode: 0x01 for Temporary Popup Message, 0x00 for Stationary Default string
+    uint8_t params[1 + LAUNCHKEY_MAX_TEXT_LEN];
+    params[0] = is_temp ? 0x01 : 0x00;
 	
     for (size_t i = 0; i < len; i++) {
         // Enforce valid safe-range 7-bit ASCII text transmission
-        if (text[i] < 128) {
-            msg[8 + i] = (uint8_t)text[i];
-        }
+        params[1 + i] = (uint8_t)text[i] & 0x7F;
     }
-    
-    // Send End of Exclusive byte (EOX)
-    msg[8 + len] = 0xF7;
 
-	if (daw_itf_idx != 0xFF) {
-		tuh_midi_stream_write(daw_itf_idx, 0, msg, LAUNCHKEY_DISPLAY_SYSEX_OVERHEAD + len);
-		tuh_midi_write_flush(daw_itf_idx);
-	}	
+	uint8_t msg[LAUNCHKEY_DISPLAY_MSG_SIZE];
+	if (!launchkey_write(msg, sysex_build(msg, SYSEX_LAUNCHKEY_DISPLAY, sizeof(SYSEX_LAUNCHKEY_DISPLAY), params, 1 + len))) return;
+
+	if (!is_temp) {
+		memcpy(launchkey_display_state, text, len);
+		launchkey_display_state[len] = '\0';
+		launchkey_display_valid = true;
+	}
 }
@@ -0,0 +1,129 @@
+/**
+ * Performance metrics
+ *
+ * Counters and fixed-bucket histograms for the paths that decide how the box
+ * feels on stage: controller report to MIDI out, looper step jitter and
+ * duration, note scheduler load, UART backlog, BLE packets per
+ * connection event and the USB host MIDI transfers.
+ * Recording a sample is one increment; a histogram bucket is the bit length
+ * of the value, so the buckets double in width and need no division.
+ *
+ * The computer queries a snapshot with a SysEx request on the USB MIDI port
+ * and tools/metrics_render.py prints it, no debug probe needed. Increments
+ * are not atomic: a sample racing another one from an interrupt on the same
+ * core may be lost, which is fine for health figures.
+ */
+#include "metrics.h"
+
+#include <string.h>
+
+#include "pico/time.h"
+
+#include "sysex.h"
+
+#define METRICS_HID_MATCH_US     20000  // later MIDI is not blamed on the report
+#define METRICS_BLE_EVENT_GAP_US 1000   // closer packets came in one connection event
+
+#define METRICS_SNAPSHOT_LEN (4 + 4 * (METRICS_COUNTERS + METRICS_HISTOGRAMS * METRICS_BUCKETS))
+#define METRICS_REPLY_MAX_LEN (SYSEX_HEADER_LEN + SYSEX_PACKED_LEN(METRICS_SNAPSHOT_LEN) + 1)
+
+volatile uint32_t metrics_counters[METRICS_COUNTERS];
+volatile uint32_t metrics_histograms[METRICS_HISTOGRAMS][METRICS_BUCKETS];
+
+static volatile uint32_t hid_change_us;
+static volatile bool hid_change_pending = false;
+
+static uint32_t ble_last_us;
+static uint32_t ble_packets;
+
+static uint8_t reply[METRICS_REPLY_MAX_LEN];
+static uint32_t reply_len;
+static uint32_t reply_pos;
+
+void metrics_hid_report(bool ble, bool changed) {
+    uint32_t now = time_us_32();
+
+    metrics_count(METRICS_HID_REPORTS);
+
+    // Only a report that changed the controller state can have caused MIDI.
+    if (changed) {
+        hid_change_us = now;
+        hid_change_pending = true;
+    }
+
+    if (ble) {
+        if (ble_packets > 0 && now - ble_last_us > METRICS_BLE_EVENT_GAP_US) {
+            metrics_sample(METRICS_BLE_PACKETS, ble_packets);
+            metrics_count(METRICS_BLE_EVENTS);
+            ble_packets = 0;
+        }
+        ble_packets++;
+        ble_last_us = now;
+    }
+}
+
+void metrics_midi_out(void) {
+    if (!hid_change_pending)
+        return;
+
+    uint32_t latency = time_us_32() - hid_change_us;
+    hid_change_pending = false;
+    if (latency <= METRICS_HID_MATCH_US)
+        metrics_sample(METRICS_HID_TO_MIDI_US, latency);
+}
+
+static uint32_t build_reply(void) {
+    uint8_t snapshot[METRICS_SNAPSHOT_LEN];
+    uint32_t len = 0;
+
+    snapshot[len++] = METRICS_VERSION;
+    snapshot[len++] = METRICS_COUNTERS;
+    snapshot[len++] = METRICS_HISTOGRAMS;
+    snapshot[len++] = METRICS_BUCKETS;
+
+    // Little endian, as the values are in memory.
+    for (int i = 0; i < METRICS_COUNTERS; i++) {
+        uint32_t value = metrics_counters[i];
+        memcpy(&snapshot[len], &value, sizeof(value));
+        len += sizeof(value);
+    }
+    for (int h = 0; h < METRICS_HISTOGRAMS; h++) {
+        for (int b = 0; b < METRICS_BUCKETS; b++) {
+            uint32_t value = metrics_histograms[h][b];
+            memcpy(&snapshot[len], &value, sizeof(value));
+            len += sizeof(value);
+        }
+    }
+
+    uint32_t out = sysex_header(reply, SYSEX_METRICS, METRICS_SYSEX_REPLY);
+    out += sysex_pack_7bit(&reply[out], snapshot, len);
+    reply[out++] = 0xF7;
+    return out;
+}
+
+void metrics_request(uint8_t cmd) {
+    if (cmd == METRICS_SYSEX_RESET) {
+        for (int i = 0; i < METRICS_COUNTERS; i++)
+            metrics_counters[i] = 0;
+        for (int h = 0; h < METRICS_HISTOGRAMS; h++)
+            for (int b = 0; b < METRICS_BUCKETS; b++)
+                metrics_histograms[h][b] = 0;
+    } else if (cmd == METRICS_SYSEX_QUERY && reply_pos == reply_len) {
+        // A query while the previous reply is still going out is ignored.
+        reply_len = build_reply();
+        reply_pos = 0;
+    }
+}
+
+uint32_t metrics_reply_peek(const uint8_t **data) {
+    *data = &reply[reply_pos];
+    return reply_len - reply_pos;
+}
+
+void metrics_reply_consume(uint32_t len) {
+    reply_pos += len;
+}
+
+bool metrics_reply_open(void) {
+    return reply_pos != 0 && reply_pos < reply_len;
+}
@@ -0,0 +1,73 @@
+#ifndef METRICS_H_
+#define METRICS_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Metrics queried as SysEx: F0 7D 4F 4D <cmd> F7, see sysex.h
+#define METRICS_SYSEX_QUERY 0x01  // host -> device
+#define METRICS_SYSEX_RESET 0x02  // host -> device
+#define METRICS_SYSEX_REPLY 0x11  // device -> host, 7-bit packed snapshot
+
+#define METRICS_VERSION 1
+
+// Bucket 0 holds 0, bucket n holds [2^(n-1), 2^n), the last one everything above.
+#define METRICS_BUCKETS 16
+
+typedef enum {
+    METRICS_HID_REPORTS,         // controller reports decoded
+    METRICS_NOTES_SCHEDULED,
+    METRICS_NOTE_DROPS,          // note scheduler slots full
+    METRICS_NOTE_PENDING_DROPS,  // due note lost, pending list full
+    METRICS_BLE_EVENTS,          // BLE connection events with controller data
+    METRICS_TICKS,               // looper steps
+    METRICS_HOST_TRANSFERS,      // bulk OUT transfers to USB MIDI devices on the host port
+    METRICS_COUNTERS
+} metrics_counter_t;
+
+typedef enum {
+    METRICS_HID_TO_MIDI_US,     // controller report -> first MIDI byte handed to a transport
+    METRICS_TICK_JITTER_US,     // looper step against its ideal deadline
+    METRICS_NOTE_QUEUE_DEPTH,   // scheduled notes, sampled when one is added
+    METRICS_UART_TX_DEPTH,      // bytes queued for the UART after a drain pass
+    METRICS_BLE_PACKETS,        // controller packets per BLE connection event
+    METRICS_TICK_DURATION_US,   // looper step handler, start to end
+    METRICS_HOST_QUEUE_DEPTH,   // bytes staged for a host MIDI interface when it is flushed
+    METRICS_HOST_TRANSFERS_PER_S,  // host MIDI transfers in each second with output
+    METRICS_HISTOGRAMS
+} metrics_histogram_t;
+
+extern volatile uint32_t metrics_counters[METRICS_COUNTERS];
+extern volatile uint32_t metrics_histograms[METRICS_HISTOGRAMS][METRICS_BUCKETS];
+
+// A few cycles each: one increment, the bucket is the bit length of the value.
+static inline void metrics_count(metrics_counter_t counter) {
+    metrics_counters[counter]++;
+}
+
+static inline void metrics_sample(metrics_histogram_t histogram, uint32_t value) {
+    uint32_t bucket = value ? 32u - (uint32_t)__builtin_clz(value) : 0;
+
+    if (bucket >= METRICS_BUCKETS)
+        bucket = METRICS_BUCKETS - 1;
+    metrics_histograms[histogram][bucket]++;
+}
+
+// Core 0: a controller report arrived. `changed` starts a report -> MIDI
+// measurement, BLE reports also count toward connection events.
+void metrics_hid_report(bool ble, bool changed);
+
+// Core 1: a MIDI message was handed to a transport.
+void metrics_midi_out(void);
+
+// Core 1: a metrics SysEx request from the computer.
+void metrics_request(uint8_t cmd);
+
+// Core 1: pending bytes of the reply, consume what the transport took.
+uint32_t metrics_reply_peek(const uint8_t **data);
+void metrics_reply_consume(uint32_t len);
+
+// Core 1: the reply is partly taken, nothing else may go between its bytes.
+bool metrics_reply_open(void);
+
+#endif  // METRICS_H_
@@ -0,0 +1,317 @@
+/**
+ * Two-core MIDI pipeline
+ *
+ * Core 0 owns the radio, controller decoding and the musical logic. Core 1
+ * owns the USB device and host stacks and the UART. Everything core 0 wants
+ * to send goes through the output queue as timestamped chunks which core 1
+ * writes to the selected transports, and bytes core 1 receives for the
+ * musical logic come back through the input queue.
+ *
+ * The transports differ in latency, so core 1 sorts every chunk into a
+ * delay line per sink and releases it to the faster sinks later, by the
+ * difference between the slowest and their own expected latency.
+ *
+ * Producers on core 0 include async_context callbacks that can preempt the
+ * main loop, so queueing an output message takes a spin lock. The input
+ * queue has a single producer and consumer and needs no lock. Wakeups use
+ * SEV/WFE rather than the SIO FIFO, which the flash lockout uses.
+ */
+#include "midi_pipeline.h"
+
+#include <string.h>
+
+#include "hardware/sync.h"
+#include "pico/sync.h"
+#include "pico/time.h"
+
+#include "event_loop.h"
+#include "metrics.h"
+#include "trace.h"
+
+#define MIDI_PIPELINE_OUT_LEN 128
+#define MIDI_PIPELINE_IN_LEN  256
+#define MIDI_PIPELINE_DELAY_LEN 64
+#define MIDI_PIPELINE_MAX_COMPENSATION_US 20000
+
+// Expected latency of each sink before any backlog, override with -D.
+#ifndef MIDI_SINK_LATENCY_DEVICE_US
+#define MIDI_SINK_LATENCY_DEVICE_US 1000  // full-speed USB, polled once per frame
+#endif
+#ifndef MIDI_SINK_LATENCY_HOST_US
+#define MIDI_SINK_LATENCY_HOST_US 1000  // PIO USB host, sent in the next frame
+#endif
+#ifndef MIDI_SINK_LATENCY_DAW_US
+#define MIDI_SINK_LATENCY_DAW_US 0  // Launchkey feedback, never aligned
+#endif
+#ifndef MIDI_SINK_LATENCY_UART_US
+#define MIDI_SINK_LATENCY_UART_US 960  // 3-byte message at 31250 baud
+#endif
+#ifndef MIDI_SINK_LATENCY_WAV_TRIGGER_US
+#define MIDI_SINK_LATENCY_WAV_TRIGGER_US 450  // one Qwiic command at 100 kHz
+#endif
+
+typedef struct {
+    uint32_t release_us;
+    midi_pipeline_event_t event;
+} held_event_t;
+
+typedef struct {
+    held_event_t queue[MIDI_PIPELINE_DELAY_LEN];
+    uint32_t head;
+    uint32_t tail;
+    uint32_t last_release_us;
+    uint32_t backlog_us;
+} sink_line_t;
+
+static critical_section_t out_cs;
+static midi_pipeline_event_t out_queue[MIDI_PIPELINE_OUT_LEN];
+static volatile uint32_t out_head = 0;  // advanced by core 1
+static volatile uint32_t out_tail = 0;  // advanced by core 0
+
+static uint8_t in_queue[MIDI_PIPELINE_IN_LEN];
+static volatile uint32_t in_head = 0;  // advanced by core 0
+static volatile uint32_t in_tail = 0;  // advanced by core 1
+
+static sink_line_t sink_lines[MIDI_PIPELINE_SINKS];
+static uint32_t sink_latency_us[MIDI_PIPELINE_SINKS] = {
+    MIDI_SINK_LATENCY_DEVICE_US, MIDI_SINK_LATENCY_HOST_US, MIDI_SINK_LATENCY_DAW_US,
+    MIDI_SINK_LATENCY_UART_US,   MIDI_SINK_LATENCY_WAV_TRIGGER_US,
+};
+
+static volatile bool wakeup_armed = false;
+static uint32_t wakeup_at_us;
+
+static midi_pipeline_stats_t stats;
+
+static inline int sink_index(uint8_t sink) {
+    return __builtin_ctz(sink);
+}
+
+void midi_pipeline_init(void) {
+    critical_section_init(&out_cs);
+}
+
+bool midi_pipeline_send(uint8_t sinks, uint8_t itf, uint8_t cable, const uint8_t *buffer, uint32_t len) {
+    uint32_t chunks = (len + MIDI_PIPELINE_CHUNK_LEN - 1) / MIDI_PIPELINE_CHUNK_LEN;
+    uint32_t now = time_us_32();
+
+    if (buffer == NULL || len == 0 || sinks == 0 || chunks > MIDI_PIPELINE_DELAY_LEN)
+        return false;
+
+    critical_section_enter_blocking(&out_cs);
+
+    uint32_t used = out_tail - out_head;
+    if (used + chunks > MIDI_PIPELINE_OUT_LEN) {
+        stats.out_dropped++;
+        critical_section_exit(&out_cs);
+        return false;
+    }
+
+    uint32_t tail = out_tail;
+    for (uint32_t offset = 0; offset < len; offset += MIDI_PIPELINE_CHUNK_LEN) {
+        midi_pipeline_event_t *event = &out_queue[tail % MIDI_PIPELINE_OUT_LEN];
+        uint32_t n = len - offset;
+        if (n > MIDI_PIPELINE_CHUNK_LEN)
+            n = MIDI_PIPELINE_CHUNK_LEN;
+
+        event->timestamp_us = now;
+        event->sinks = sinks;
+        event->itf = itf;
+        event->cable = cable;
+        event->len = (uint8_t)n;
+        event->more = (uint8_t)((len - offset - n + MIDI_PIPELINE_CHUNK_LEN - 1) / MIDI_PIPELINE_CHUNK_LEN);
+        memcpy(event->data, buffer + offset, n);
+        tail++;
+    }
+
+    // Publish the chunks only once they are all written.
+    __dmb();
+    out_tail = tail;
+
+    stats.out_events += chunks;
+    if (used + chunks > stats.out_high_water)
+        stats.out_high_water = used + chunks;
+
+    critical_section_exit(&out_cs);
+    __sev();
+    return true;
+}
+
+void midi_pipeline_set_sink_latency(uint8_t sink, uint32_t latency_us) {
+    sink_latency_us[sink_index(sink)] = latency_us;
+}
+
+uint32_t midi_pipeline_get_sink_latency(uint8_t sink) {
+    return sink_latency_us[sink_index(sink)];
+}
+
+void midi_pipeline_set_sink_backlog(uint8_t sink, uint32_t backlog_us) {
+    sink_lines[sink_index(sink)].backlog_us = backlog_us;
+}
+
+static bool sinks_have_room(uint8_t sinks, uint32_t chunks) {
+    for (int i = 0; i < MIDI_PIPELINE_SINKS; i++) {
+        if ((sinks & (1u << i)) && sink_lines[i].tail - sink_lines[i].head + chunks > MIDI_PIPELINE_DELAY_LEN)
+            return false;
+    }
+    return true;
+}
+
+void midi_pipeline_align(void) {
+    uint32_t head = out_head;
+    uint32_t message_left = 0;  // chunks of the message under way, room for them was checked
+    uint32_t now = time_us_32();
+
+    while (head != out_tail) {
+        __dmb();
+        const midi_pipeline_event_t *event = &out_queue[head % MIDI_PIPELINE_OUT_LEN];
+        uint32_t latency[MIDI_PIPELINE_SINKS];
+        uint32_t slowest = 0;
+
+        // Wait for the transports rather than reorder a sink's output, and
+        // never leave a sink between the chunks of a message: a transport
+        // merging other traffic does so at message boundaries.
+        if (message_left == 0) {
+            if (!sinks_have_room(event->sinks, 1u + event->more)) {
+                stats.align_stalls++;
+                break;
+            }
+            message_left = 1u + event->more;
+        }
+        message_left--;
+
+        for (int i = 0; i < MIDI_PIPELINE_SINKS; i++) {
+            if (!(event->sinks & (1u << i)))
+                continue;
+            latency[i] = sink_latency_us[i] + sink_lines[i].backlog_us;
+            if (latency[i] > slowest)
+                slowest = latency[i];
+        }
+
+        for (int i = 0; i < MIDI_PIPELINE_SINKS; i++) {
+            if (!(event->sinks & (1u << i)))
+                continue;
+
+            sink_line_t *line = &sink_lines[i];
+            uint32_t hold = slowest - latency[i];
+            if (hold > MIDI_PIPELINE_MAX_COMPENSATION_US)
+                hold = MIDI_PIPELINE_MAX_COMPENSATION_US;
+            if (hold > stats.max_compensation_us)
+                stats.max_compensation_us = hold;
+
+            // Never release ahead of a chunk already held for this sink.
+            uint32_t release = now + hold;
+            if (line->tail != line->head && (int32_t)(release - line->last_release_us) < 0)
+                release = line->last_release_us;
+            line->last_release_us = release;
+
+            held_event_t *held = &line->queue[line->tail % MIDI_PIPELINE_DELAY_LEN];
+            held->release_us = release;
+            held->event = *event;
+            line->tail++;
+        }
+
+        uint32_t latency_in_queue = now - event->timestamp_us;
+        if (latency_in_queue > stats.max_latency_us)
+            stats.max_latency_us = latency_in_queue;
+
+        __dmb();
+        out_head = ++head;
+    }
+}
+
+bool midi_pipeline_due(uint8_t sink, midi_pipeline_event_t *event) {
+    sink_line_t *line = &sink_lines[sink_index(sink)];
+
+    if (line->head == line->tail)
+        return false;
+
+    held_event_t *held = &line->queue[line->head % MIDI_PIPELINE_DELAY_LEN];
+    int32_t late = (int32_t)(time_us_32() - held->release_us);
+    if (late < 0)
+        return false;
+
+    if ((uint32_t)late > stats.max_release_lag_us)
+        stats.max_release_lag_us = (uint32_t)late;
+    *event = held->event;
+    line->head++;
+    TRACE(TRACE_MIDI_OUT, sink, (uint32_t)event->len << 8 | event->data[0]);
+    metrics_midi_out();
+    return true;
+}
+
+static int64_t wakeup_alarm(alarm_id_t id, void *user_data) {
+    (void)id;
+    (void)user_data;
+
+    wakeup_armed = false;
+    __sev();
+    return 0;
+}
+
+void midi_pipeline_arm_wakeup(void) {
+    bool pending = false;
+    uint32_t next = 0;
+
+    for (int i = 0; i < MIDI_PIPELINE_SINKS; i++) {
+        sink_line_t *line = &sink_lines[i];
+        if (line->head == line->tail)
+            continue;
+
+        uint32_t release = line->queue[line->head % MIDI_PIPELINE_DELAY_LEN].release_us;
+        if (!pending || (int32_t)(release - next) < 0)
+            next = release;
+        pending = true;
+    }
+
+    if (!pending)
+        return;
+    if (wakeup_armed && (int32_t)(wakeup_at_us - next) <= 0)
+        return;
+
+    // The alarm fires on core 0, its SEV wakes core 1 as well.
+    int32_t wait = (int32_t)(next - time_us_32());
+    wakeup_at_us = next;
+    wakeup_armed = true;
+    if (add_alarm_in_us(wait > 0 ? (uint64_t)wait : 0, wakeup_alarm, NULL, true) < 0)
+        wakeup_armed = false;
+}
+
+bool midi_pipeline_input_push(uint8_t byte) {
+    uint32_t tail = in_tail;
+    uint32_t used = tail - in_head;
+
+    if (used == MIDI_PIPELINE_IN_LEN) {
+        stats.in_dropped++;
+        return false;
+    }
+
+    in_queue[tail % MIDI_PIPELINE_IN_LEN] = byte;
+    __dmb();
+    in_tail = tail + 1;
+    TRACE(TRACE_MIDI_IN, MIDI_SINK_HOST, byte);
+
+    stats.in_bytes++;
+    if (used + 1 > stats.in_high_water)
+        stats.in_high_water = used + 1;
+
+    event_loop_signal(EVENT_LOOP_MIDI_INPUT);
+    return true;
+}
+
+bool midi_pipeline_input_pop(uint8_t *byte) {
+    uint32_t head = in_head;
+
+    if (head == in_tail)
+        return false;
+
+    __dmb();
+    *byte = in_queue[head % MIDI_PIPELINE_IN_LEN];
+    __dmb();
+    in_head = head + 1;
+    return true;
+}
+
+void midi_pipeline_get_stats(midi_pipeline_stats_t *stats_out) {
+    *stats_out = stats;
+}
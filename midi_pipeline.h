@@ -0,0 +1,72 @@
+#ifndef MIDI_PIPELINE_H_
+#define MIDI_PIPELINE_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Transports a MIDI message is written to on core 1.
+#define MIDI_SINK_DEVICE 0x01  // USB device (computer)
+#define MIDI_SINK_HOST   0x02  // MIDI device on the USB host port
+#define MIDI_SINK_DAW    0x04  // Launchkey DAW interface on the USB host port
+#define MIDI_SINK_UART   0x08  // DIN / M5Stack MIDI
+#define MIDI_SINK_WAV_TRIGGER 0x10  // WAV Trigger Pro over I2C
+
+#define MIDI_PIPELINE_SINKS 5
+
+#define MIDI_PIPELINE_CHUNK_LEN 16
+
+typedef struct {
+    uint32_t timestamp_us;  // when core 0 queued the message
+    uint8_t sinks;
+    uint8_t itf;
+    uint8_t cable;
+    uint8_t len;
+    uint8_t more;           // chunks of the same message after this one
+    uint8_t data[MIDI_PIPELINE_CHUNK_LEN];
+} midi_pipeline_event_t;
+
+typedef struct {
+    uint32_t out_events;      // chunks queued for core 1
+    uint32_t out_dropped;     // messages dropped, output queue full
+    uint32_t out_high_water;  // output queue high-water mark
+    uint32_t in_bytes;        // bytes queued for core 0
+    uint32_t in_dropped;      // bytes dropped, input queue full
+    uint32_t in_high_water;   // input queue high-water mark
+    uint32_t max_latency_us;  // queued on core 0 -> handed to the transport on core 1
+    uint32_t max_compensation_us;  // longest hold applied to a faster sink
+    uint32_t max_release_lag_us;   // a held chunk released after its due time
+    uint32_t align_stalls;    // a delay line was full, alignment waited
+} midi_pipeline_stats_t;
+
+void midi_pipeline_init(void);
+
+// Core 0: queue a message for the transports on core 1. Messages longer than a
+// chunk are split into consecutive events, a message is queued whole or dropped.
+bool midi_pipeline_send(uint8_t sinks, uint8_t itf, uint8_t cable, const uint8_t *buffer, uint32_t len);
+
+// Latency compensation. Every sink has an expected latency: a configured base
+// plus the backlog its transport currently reports. Chunks going to several
+// sinks are held back for the faster ones so all of them sound together.
+void midi_pipeline_set_sink_latency(uint8_t sink, uint32_t latency_us);
+uint32_t midi_pipeline_get_sink_latency(uint8_t sink);
+
+// Core 1: the transport of `sink` is this far behind.
+void midi_pipeline_set_sink_backlog(uint8_t sink, uint32_t backlog_us);
+
+// Core 1: move queued chunks into the per-sink delay lines, the chunks of a
+// message all in one go and due together.
+void midi_pipeline_align(void);
+
+// Core 1: next chunk due for `sink`.
+bool midi_pipeline_due(uint8_t sink, midi_pipeline_event_t *event);
+
+// Core 1: make sure an interrupt wakes the core when the next held chunk is due.
+void midi_pipeline_arm_wakeup(void);
+
+// Core 1 -> core 0: raw bytes received from a transport for the musical logic.
+bool midi_pipeline_input_push(uint8_t byte);
+bool midi_pipeline_input_pop(uint8_t *byte);
+
+void midi_pipeline_get_stats(midi_pipeline_stats_t *stats);
+
+#endif  // MIDI_PIPELINE_H_
@@ -14,18 +14,23 @@
  */
 #include "note_scheduler.h"
 #include "async_timer.h"
+#include "event_loop.h"
 #include "looper.h"
+#include "metrics.h"
 #include "pico/multicore.h"
 #include "pico/time.h"
+#include "strum.h"
+#include "trace.h"
 
-#define MAX_SCHEDULED_NOTES 24
+#define MAX_SCHEDULED_NOTES 32  // a step of every drum track plus a strum
 
 // One-time pending note event to be dispatched from the main loop
 typedef struct {
-    uint8_t channel;
-    uint8_t note;
+    uint8_t channel;  // data 1 of a guitar message
+    uint8_t note;     // data 2 of a guitar message
     uint8_t velocity;
     bool valid;
+    uint8_t command;  // guitar message status, 0 for a drum note
 } pending_note_t;
 
 // Scheduled note with its async worker and parameters
@@ -37,6 +42,7 @@ typedef struct {
 static scheduled_note_slot_t scheduled_slots[MAX_SCHEDULED_NOTES];
 static pending_note_t pending_notes[MAX_SCHEDULED_NOTES];
 static critical_section_t pending_notes_cs;
+static uint32_t scheduled_count = 0;
 
 // Initialize the note scheduler
 void note_scheduler_init(void) { critical_section_init(&pending_notes_cs); }
@@ -49,40 +55,103 @@ static void note_worker_enqueue_pending(async_context_t *ctx, async_at_time_work
     (void)ctx;
     scheduled_note_slot_t *slot = (scheduled_note_slot_t *)worker;
 
+    bool queued = false;
+
     critical_section_enter_blocking(&pending_notes_cs);
     for (size_t i = 0; i < MAX_SCHEDULED_NOTES; i++) {
         if (!pending_notes[i].valid) {
-            pending_notes[i] = (pending_note_t){slot->pending.channel, slot->pending.note,
-                                                slot->pending.velocity, true};
+            pending_notes[i] = slot->pending;
+            pending_notes[i].valid = true;
+            queued = true;
             break;
         }
     }
 
     slot->worker.do_work = NULL;  // mark as unused
+    scheduled_count--;
     critical_section_exit(&pending_notes_cs);
+
+    if (!queued)
+        metrics_count(METRICS_NOTE_PENDING_DROPS);
+
+    event_loop_signal(EVENT_LOOP_NOTE_DUE);
 }
 
 /*
  * Schedule a note to be triggered at a specific absolute time in microseconds.
  * Returns false if the scheduling queue is full.
  */
-bool note_scheduler_schedule_note(uint64_t time_us, uint8_t channel, uint8_t note,
-                                  uint8_t velocity) {
+static bool schedule_pending(uint64_t time_us, pending_note_t pending) {
     absolute_time_t note_at = to_us_since_boot(time_us);
 
     for (size_t i = 0; i < MAX_SCHEDULED_NOTES; i++) {
         if (scheduled_slots[i].worker.do_work == NULL) {
             scheduled_slots[i] = (scheduled_note_slot_t){
-                .pending = {.channel = channel, .note = note, .velocity = velocity},
+                .pending = pending,
                 .worker = {.do_work = note_worker_enqueue_pending}};
+            TRACE(TRACE_NOTE_SCHEDULE, (uint32_t)pending.channel << 8 | pending.note, time_us);
+
+            // The worker can fire from the timer interrupt and decrement it.
+            critical_section_enter_blocking(&pending_notes_cs);
+            uint32_t depth = ++scheduled_count;
+            critical_section_exit(&pending_notes_cs);
+            metrics_count(METRICS_NOTES_SCHEDULED);
+            metrics_sample(METRICS_NOTE_QUEUE_DEPTH, depth);
             async_context_add_at_time_worker_at(async_timer_async_context(),
                                                 &scheduled_slots[i].worker, note_at);
             return true;
         }
     }
+    metrics_count(METRICS_NOTE_DROPS);
     return false;
 }
 
+bool note_scheduler_schedule_note(uint64_t time_us, uint8_t channel, uint8_t note,
+                                  uint8_t velocity) {
+    return schedule_pending(time_us, (pending_note_t){.channel = channel, .note = note, .velocity = velocity});
+}
+
+/*
+ * Schedule a guitar message, e.g. a strummed string, played by
+ * strum_perform_message() through the guitar routing.
+ * Each message is released at its due time; those that fall due before the
+ * main loop runs go out together, in no particular order.
+ */
+bool note_scheduler_schedule_message(uint64_t time_us, uint8_t command, uint8_t data1,
+                                     uint8_t data2) {
+    return schedule_pending(time_us, (pending_note_t){.channel = data1, .note = data2, .command = command});
+}
+
+/*
+ * Drop the guitar messages with this status that have not gone out yet,
+ * e.g. the rest of a strum when the chord is stopped, so no note starts
+ * after its note off.
+ */
+void note_scheduler_cancel_messages(uint8_t command) {
+    async_context_t *context = async_timer_async_context();
+
+    for (size_t i = 0; i < MAX_SCHEDULED_NOTES; i++) {
+        scheduled_note_slot_t *slot = &scheduled_slots[i];
+
+        if (slot->worker.do_work == NULL || slot->pending.command != command)
+            continue;
+        // False when the worker already fired, its message is pending then.
+        if (async_context_remove_at_time_worker(context, &slot->worker)) {
+            critical_section_enter_blocking(&pending_notes_cs);
+            slot->worker.do_work = NULL;
+            scheduled_count--;
+            critical_section_exit(&pending_notes_cs);
+        }
+    }
+
+    critical_section_enter_blocking(&pending_notes_cs);
+    for (size_t i = 0; i < MAX_SCHEDULED_NOTES; i++) {
+        if (pending_notes[i].valid && pending_notes[i].command == command)
+            pending_notes[i].valid = false;
+    }
+    critical_section_exit(&pending_notes_cs);
+}
+
 // Called from the main loop to process all pending scheduled notes.
 void note_scheduler_dispatch_pending(void) {
     critical_section_enter_blocking(&pending_notes_cs);
@@ -90,8 +159,14 @@ void note_scheduler_dispatch_pending(void) {
     for (size_t i = 0; i < MAX_SCHEDULED_NOTES; i++) 
 	{
         if (pending_notes[i].valid) {
-            looper_perform_note(pending_notes[i].channel, pending_notes[i].note,
-                                pending_notes[i].velocity);
+            TRACE(TRACE_NOTE_DISPATCH, (uint32_t)pending_notes[i].channel << 8 | pending_notes[i].note,
+                  pending_notes[i].velocity);
+            if (pending_notes[i].command)
+                strum_perform_message(pending_notes[i].command, pending_notes[i].channel,
+                                      pending_notes[i].note);
+            else
+                looper_perform_note(pending_notes[i].channel, pending_notes[i].note,
+                                    pending_notes[i].velocity);
             pending_notes[i].valid = false;
         }
     }
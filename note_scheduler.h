@@ -10,4 +10,6 @@
 
 void note_scheduler_init(void);
 bool note_scheduler_schedule_note(uint64_t time_us, uint8_t channel, uint8_t note, uint8_t velocity);
+bool note_scheduler_schedule_message(uint64_t time_us, uint8_t command, uint8_t data1, uint8_t data2);
+void note_scheduler_cancel_messages(uint8_t command);
 void note_scheduler_dispatch_pending(void);
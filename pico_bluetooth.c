@@ -19,6 +19,12 @@
 #include "looper.h"
 #include "storage.h"
 #include "ghost_note.h"
+#include "known_device.h"
+#include "event_loop.h"
+#include "metrics.h"
+#include "trace.h"
+#include "strum.h"
+#include "arpeggiator.h"
 
 #ifndef CONFIG_BLUEPAD32_PLATFORM_CUSTOM
 #error "Pico W must use BLUEPAD32_PLATFORM_CUSTOM"
@@ -61,6 +67,7 @@ bool enable_drum_track = true;
 bool enable_ample_guitar = false;
 bool enable_midi_drums = false;
 bool enable_worship_pads = false;
+bool enable_native_arp = false;
 bool gamepad_guitar_connected = false;
 bool finished_processing = true;
 bool style_change_requested = false;
@@ -339,12 +346,16 @@ static void pico_bluetooth_on_init_complete(void) {
   // Safe to call "unsafe" functions since they are called
   // PICO_INFO("Bluetooth initialization complete.\n");
 
-  // Delete stored BT keys for fresh pairing (helpful for initial connection)
-  uni_bt_del_keys_unsafe();
+  // Page the last bonded controller directly. It falls back to scanning by itself
+  // if the controller does not answer in time.
+  if (!known_device_reconnect()) {
+    // Delete stored BT keys for fresh pairing (helpful for initial connection)
+    uni_bt_del_keys_unsafe();
 
-  // Start scanning and autoconnect to supported controllers.
-  uni_bt_start_scanning_and_autoconnect_safe();
-  // PICO_INFO("Started Bluetooth scanning for new devices.\n");
+    // Start scanning and autoconnect to supported controllers.
+    uni_bt_start_scanning_and_autoconnect_safe();
+    // PICO_INFO("Started Bluetooth scanning for new devices.\n");
+  }
 
   uni_property_dump_all();
 
@@ -397,6 +408,7 @@ static void pico_bluetooth_on_device_connected(uni_hid_device_t* d) {
 static void pico_bluetooth_on_device_disconnected(uni_hid_device_t* d) {
   (void) d;	
   gamepad_guitar_connected = false;	
+  known_device_on_connection_lost();
   // PICO_INFO("Device disconnected: %s (%02X:%02X:%02X:%02X:%02X:%02X)\n", d->name, d->conn.btaddr[0], d->conn.btaddr[1], d->conn.btaddr[2], d->conn.btaddr[3], d->conn.btaddr[4], d->conn.btaddr[5]);
 
   // Re-enable scanning when a device is disconnected
@@ -407,9 +419,18 @@ static void pico_bluetooth_on_device_disconnected(uni_hid_device_t* d) {
 }
 
 static uni_error_t pico_bluetooth_on_device_ready(uni_hid_device_t* d) {
-	(void) d;	
+	static bool devices_configured = false;
+	
 	// You can reject the connection by returning an error.
 	cyw43_arch_gpio_put(CYW43_WL_GPIO_LED_PIN, false); 
+	
+	known_device_on_ready();
+	known_device_remember(d);
+	
+	// The connected gear is set up once per boot. A controller that drops out on stage comes
+	// back to the state it left, toggles and config_guitar() changes included, with nothing resent.
+	if (devices_configured) return UNI_ERROR_SUCCESS;
+	devices_configured = true;
     
 	//storage_load_tracks();			
 	
@@ -436,9 +457,16 @@ static const uni_property_t* pico_bluetooth_get_property(uni_property_idx_t idx)
 }
 
 static void pico_bluetooth_on_controller_data(uni_hid_device_t* d, uni_controller_t* ctl) { 
-	(void) d;
+	static uint32_t last_buttons = 0;
 	if (!gamepad_guitar_connected) return;
 	
+	known_device_on_report();
+	TRACE(TRACE_HID_REPORT, ctl->gamepad.buttons, 0);
+	
+	uint32_t buttons = ctl->gamepad.buttons | (uint32_t)ctl->gamepad.dpad << 16 | (uint32_t)ctl->gamepad.misc_buttons << 24;
+	metrics_hid_report(d->conn.protocol == UNI_BT_CONN_PROTOCOL_BLE, buttons != last_buttons);
+	last_buttons = buttons;
+	
 	int8_t axis_x = ctl->gamepad.axis_x / 4;	// nomalise -512 to +512 to -128 to +128
 	int8_t axis_y = ctl->gamepad.axis_y / 4;
 	int8_t axis_rx = ctl->gamepad.axis_rx / 4;
@@ -985,7 +1013,7 @@ void gamepad_bluetooth_handle_data() {
 				
 				if (looper_status.state == LOOPER_STATE_WAITING || looper_status.state == LOOPER_STATE_RECORDING || looper_status.state == LOOPER_STATE_TAP_TEMPO) {
 					style_section = 0;	
-					looper_status.current_step = 0;	
+					looper_rewind();	
 					
 					//if (looper_status.state == LOOPER_STATE_RECORDING) storage_store_tracks();													
 					looper_status.state = LOOPER_STATE_PLAYING;
@@ -1603,8 +1631,10 @@ void gamepad_bluetooth_handle_data() {
 				}
 			} 			
 			else if (green && red && yellow) config_guitar(18);		// Reset Preferences
-			else if (red && yellow && blue) config_guitar(16);		// Used
-			else if (green && red && blue) config_guitar(15);		// Used			
+			else if (red && yellow && blue) config_guitar(16);		// Native arpeggiator
+			else if (green && red && blue) config_guitar(15);		// Looper timing			
+			else if (green && yellow && blue) config_guitar(20);	// Looper bars
+			else if (red && blue && orange) config_guitar(21);		// Looper time signature
 			else if (yellow && blue && orange) config_guitar(17);	// Save Preferences
 			
 			else if (green && orange) config_guitar(13);			// Behringer Synth (JT-Micro, UB-1 Micro)
@@ -1771,8 +1801,7 @@ void gamepad_bluetooth_handle_data() {
 			if (joy_down) 
 			{
 				if (enable_midi_drums)	{	
-					ghost_parameters_t *params = ghost_note_parameters();
-					params->ghost_intensity = 0.843;	
+					ghost_note_set_intensity(0.843);	
 
 					finished_processing = true;
 					return;
@@ -1786,8 +1815,7 @@ void gamepad_bluetooth_handle_data() {
 			if (joy_down) 
 			{
 				if (enable_midi_drums)	{	
-					ghost_parameters_t *params = ghost_note_parameters();
-					params->ghost_intensity = 0.0;
+					ghost_note_set_intensity(0.0);
 
 					finished_processing = true;
 					return;
@@ -1806,7 +1834,7 @@ void gamepad_bluetooth_handle_data() {
 					if (style_group > -1) looper_clear_all_tracks();		// clear static style				
 					style_group = -1;
 					
-					looper_status.current_step = 0;
+					looper_rewind();
 					
 					finished_processing = true;					
 					return;
@@ -1927,12 +1955,104 @@ void gamepad_bluetooth_handle_data() {
 	finished_processing = true;				
 }
 
-int compDown(const void *a, const void *b) {
-    return (*(uint8_t *)b - *(uint8_t *)a);
+/*
+ * Voicing of the last chord on the neck. It is rebuilt only when the chord,
+ * neck position or guitar mode changes, so a strum or an auto-strum step
+ * walks the strings in pitch order instead of sorting notes.
+ */
+typedef struct {
+	int8_t root;		// key, -1 before the first chord
+	int8_t type;
+	int8_t neck_pos;
+	bool ample;
+	uint8_t pitch[6];	// per string, fret + chord chart as the single string actions play it
+	uint8_t notes[6];	// per string, as strummed with the bass and ample octave shifts
+	uint8_t order[6];	// used strings, lowest pitch first
+	uint8_t count;		// used strings
+} chord_voicing_t;
+
+static chord_voicing_t voicing = {.root = -1};
+static uint8_t mute_midinotes_up[6] = {0};		// mute_midinotes, lowest first
+
+static const chord_voicing_t *chord_voicing(void) {
+	int root = last_chord_note % 12;
+
+	if (voicing.root == root && voicing.type == last_chord_type && voicing.neck_pos == active_neck_pos && voicing.ample == enable_ample_guitar)
+		return &voicing;
+
+	int O = 12;
+	int D = 2, E = 4, G = 7, A = 9, B = 11;
+	int string_frets[6] = {E +O*(active_neck_pos+2), A +O*(active_neck_pos+2), D +O*(active_neck_pos+2), G +O*(active_neck_pos+2), B +O*(active_neck_pos+2), E +O*(active_neck_pos+3)};
+
+	voicing.root = root;
+	voicing.type = last_chord_type;
+	voicing.neck_pos = active_neck_pos;
+	voicing.ample = enable_ample_guitar;
+	voicing.count = 0;
+
+	for (int string = 0; string < 6; string++) {
+		int fret = chord_chart[root][last_chord_type][string];
+		uint8_t note = string_frets[string] + fret;
+
+		voicing.pitch[string] = note;
+		voicing.notes[string] = 0;
+		if (fret < 0) continue;									// unused string
+
+		if (active_neck_pos == 1) {
+			if ((note % 12) > 4) note = note - 12; 				// bass needs another octave lower for bass neck pos
+		}
+		if (enable_ample_guitar && note < 40) note = note + 12;
+		voicing.notes[string] = note;
+
+		// strings are ordered by the chart pitch, before the octave shifts
+		int n = voicing.count++;
+		while (n > 0 && voicing.pitch[voicing.order[n - 1]] > voicing.pitch[string]) {
+			voicing.order[n] = voicing.order[n - 1];
+			n--;
+		}
+		voicing.order[n] = string;
+	}
+	return &voicing;
+}
+
+// Arpeggios on the looper clock in auto mode, for targets without an arpeggiator of their own.
+// Opt-in: by default a strum plays one pattern step, as it always has.
+static bool native_arp(void) {
+	return enable_native_arp && (enable_midi_drums || (enable_auto_strum && !style_started)) && active_strum_pattern > 0 && !enable_modx && !enable_seqtrak && !enable_ample_guitar;
 }
 
-int compUp(const void *a, const void *b) {
-    return (*(uint8_t *)a - *(uint8_t *)b);
+// Picks the arpeggio like get_arp_template() does for the MODX and SEQTRAK.
+static void native_arp_play(void) {
+	static const arp_mode_t modes[5] = {ARP_UP, ARP_RANDOM, ARP_UP, ARP_DOWN, ARP_UP_DOWN};
+	ghost_parameters_t *params = ghost_note_parameters();
+	int strum_index = active_strum_pattern + ((style_section % 4) * 3);		// as the strummed arps 3-14
+	
+	arp_config_t config = {
+		.mode = (style_section % 2 == 0 || active_strum_pattern == 1) ? modes[active_strum_pattern] : ARP_PATTERN,
+		.rate = style_section % 2 == 0 ? 1 : 2,								// 16th or 8th notes
+		.gate = 80,
+		.octaves = active_neck_pos == 1 ? 1 : 2,								// bass stays low
+		.velocity = 100,
+		.swing = looper_geometry_get()->swing ? params->swing_ratio : 0.5f,
+		.pattern = strum_pattern[strum_index],
+		.pattern_len = 12,
+	};
+	
+	arpeggiator_play(chord_voicing()->notes, &config);
+}
+
+// Keeps the auto-strum order of the notes muted by the last strum.
+static void mute_notes_sort(void) {
+	for (int i = 0; i < 6; i++) {
+		uint8_t note = mute_midinotes[i];
+		int n = i;
+
+		while (n > 0 && mute_midinotes_up[n - 1] > note) {
+			mute_midinotes_up[n] = mute_midinotes_up[n - 1];
+			n--;
+		}
+		mute_midinotes_up[n] = note;
+	}
 }
 
 void config_guitar(uint8_t mode) {
@@ -1945,6 +2065,16 @@ void config_guitar(uint8_t mode) {
 		
 	
 		
+	if (mode == 21) {										// Looper time signature: 4/4, 3/4, 6/8
+		looper_cycle_time_signature();
+	}
+	else
+
+	if (mode == 20) {										// Looper length: 1, 2, 4, 8 bars
+		looper_cycle_bars();
+	}
+	else
+
 	if (mode == 19) {										// SeqTrak			
 		enable_seqtrak = !enable_seqtrak;
 		enable_style_play = enable_seqtrak;
@@ -1967,25 +2097,34 @@ void config_guitar(uint8_t mode) {
 		enable_mpx_looper		 = false;
 		enable_mpx_drums		 = false;
 		enable_synth 			 = false;
+		enable_native_arp		 = false;
 		
 		guitar_pc_code			 = 26;
 		
 		preferences_changed 	 = true;
+		event_loop_signal(EVENT_LOOP_PREFERENCES);
 	}
 	else
 		
 	if (mode == 17) {										// Save Preferences
 		preferences_changed = true;
+		event_loop_signal(EVENT_LOOP_PREFERENCES);
 	}
 	else
 		
-	if (mode == 16) {										// unused
-
+	if (mode == 16) {										// Native arpeggiator for strum patterns 1-4
+		enable_native_arp = !enable_native_arp;
 	}
 	else
 		
-	if (mode == 15) {										// unused
-
+	if (mode == 15) {										// Looper timing: as recorded, half, on the grid, steps
+		if (looper_status.record_mode == LOOPER_RECORD_STEPS) {
+			looper_set_record_mode(LOOPER_RECORD_EVENTS);
+			looper_set_quantize_strength(0);
+		}
+		else if (looper_status.quantize_strength < 50) looper_set_quantize_strength(50);
+		else if (looper_status.quantize_strength < 100) looper_set_quantize_strength(100);
+		else looper_set_record_mode(LOOPER_RECORD_STEPS);
 	}
 	else
 		
@@ -2523,10 +2662,6 @@ void play_chord(bool on, bool up) {
 	}
 	
 	int O = 12;
-	int D = 2, E = 4, G = 7, A = 9, B = 11;	
-	int __6th = E +O*(active_neck_pos+2), __5th = A +O*(active_neck_pos+2), __4th = D +O*(active_neck_pos+2), __3rd = G +O*(active_neck_pos+2), __2nd = B +O*(active_neck_pos+2), __1st = E +O*(active_neck_pos+3);		
-	int string_frets[6] = {__6th, __5th, __4th, __3rd, __2nd, __1st};
-	uint8_t chord_midinotes[6] = {0};	
 	static int seq_index = 0;
 	
 	int string = 0;
@@ -2658,6 +2793,11 @@ void play_chord(bool on, bool up) {
 						ample_old_key = note;		
 					}						
 				} 
+				else
+				
+				if (native_arp()) {
+					native_arp_play();
+				}
 				else {	
 					int strum_index = active_strum_pattern;
 					
@@ -2672,48 +2812,38 @@ void play_chord(bool on, bool up) {
 						if (seq_index > 11) seq_index = 0;
 					}
 
+					uint8_t strings = 0;	// strings of this pattern step, a bit each
+					
 					for (int i=0; i<6; i++) 
 					{						
 						mute_midinotes[i] = 0;	// reset muted notes
 						
 						string = 6 - strum_pattern[play_pattern][seq_index][i];
 						
-						if (string > -1 && string < 6) 
-						{
-							if (chord_chart[last_chord_note % 12][last_chord_type][string] > -1) {	// ignore unused strings
-								chord_midinotes[notes_count] = string_frets[string] + chord_chart[last_chord_note % 12][last_chord_type][string];
-								notes_count++;						
-							}
-						}
+						if (string > -1 && string < 6) strings |= 1 << string;
 					}
 
-					velocity = 110;
+					const chord_voicing_t *chord = chord_voicing();
 					
-					if (up) {
-						qsort(chord_midinotes, notes_count, sizeof(uint8_t), compUp);			
-					} else {
-						qsort(chord_midinotes, notes_count, sizeof(uint8_t), compDown);								
-					}
-				
-					for (int n=0; n<notes_count; n++) {
-						note = chord_midinotes[(notes_count - 1) - n];											
-						if (velocity > 25) velocity = velocity - 10;
-										
-						if (active_neck_pos == 1) {
-							if ((note % 12) > 4) note = note - 12; 	// bass needs another octave lower for bass neck pos
-						}						
-						
-						if (enable_ample_guitar && note < 40) note = note + 12;	
-						
-						// don't play chord when midi drums is enabled. auto-strum will handle it on beat
-						
-						if (!enable_midi_drums || active_strum_pattern != 0) {
-							midi_send_note(0x90, note, velocity);
-						}
+					// up strums from the highest string pitch down, down strums from the lowest up
+					for (int k=0; k<chord->count; k++) {
+						string = up ? chord->order[(chord->count - 1) - k] : chord->order[k];
+						if (!(strings & (1 << string))) continue;	// unused strings are not in the order
+
+						int n = notes_count++;
+						note = chord->notes[string];
 						
 						old_midinotes[n] = note;
 						mute_midinotes[n] = note;							
 					}
+					mute_notes_sort();
+					
+					// don't play chord when midi drums is enabled. auto-strum will handle it on beat
+					
+					if (!enable_midi_drums || active_strum_pattern != 0) {
+						strum_cancel();									// a new strum cuts the last one short
+						strum_play(mute_midinotes, notes_count, 100, STRUM_NO_PROGRAM);
+					}
 
 					if (!up && enable_midi_drums && active_strum_pattern == 0) {
 						// play bass note on downstroke with auto-strum
@@ -2836,6 +2966,8 @@ void clear_chord_notes() {
 
 void stop_chord() {
 	if (enable_style_play) clear_chord_notes();		
+	strum_cancel();										// strings still to come would outlast their note off
+	arpeggiator_stop();
 	
 	for (int n=0; n<6; n++) 
 	{
@@ -3502,13 +3634,6 @@ void midi_process_state(uint64_t start_us) {		// called by looper.c real-timer f
 	(void) start_us;
 	
 	int O = 12;
-	int D = 2, E = 4, G = 7, A = 9, B = 11;	
-	int __6th = E +O*(active_neck_pos+2), __5th = A +O*(active_neck_pos+2), __4th = D +O*(active_neck_pos+2), __3rd = G +O*(active_neck_pos+2), __2nd = B +O*(active_neck_pos+2), __1st = E +O*(active_neck_pos+3);		
-	uint8_t auto_chord_midinotes[6] = {0};
-	
-	for (int i=0; i<6; i++) {
-		auto_chord_midinotes[i] = mute_midinotes[i];
-	}
 	
 	midi_current_step = (midi_current_step + 1) % 128; // 8 bars of of 16 (1/16) beats per bar
 	
@@ -3521,6 +3646,7 @@ void midi_process_state(uint64_t start_us) {		// called by looper.c real-timer f
 		
 		if (stop_action == 72 || stop_action == 74 || stop_action == 76 || stop_action == 79 || stop_action == 81 || stop_action == 83) 
 		{		
+			strum_cancel();
 			for (int n=0; n<6; n++) {
 				midi_send_note(0x80, chord_notes[n], 0);
 			}
@@ -3532,37 +3658,37 @@ void midi_process_state(uint64_t start_us) {		// called by looper.c real-timer f
 		// play string 1 -6
 
 		if (start_action == 62) {
-			voice_note = __6th + chord_chart[last_chord_note % 12][last_chord_type][0];
+			voice_note = chord_voicing()->pitch[0];
 			midi_send_note(0x90, voice_note, velocity);
 		}
 		else
 			
 		if (start_action == 64) {
-			voice_note = __5th + chord_chart[last_chord_note % 12][last_chord_type][1];
+			voice_note = chord_voicing()->pitch[1];
 			midi_send_note(0x90, voice_note, velocity);
 		}
 		else
 			
 		if (start_action == 65) {
-			voice_note = __4th + chord_chart[last_chord_note % 12][last_chord_type][2];
+			voice_note = chord_voicing()->pitch[2];
 			midi_send_note(0x90, voice_note, velocity);
 		}
 		else
 			
 		if (start_action == 67) {
-			voice_note = __3rd + chord_chart[last_chord_note % 12][last_chord_type][3];
+			voice_note = chord_voicing()->pitch[3];
 			midi_send_note(0x90, voice_note, velocity);
 		}
 		else
 			
 		if (start_action == 69) {
-			voice_note = __2nd + chord_chart[last_chord_note % 12][last_chord_type][4];
+			voice_note = chord_voicing()->pitch[4];
 			midi_send_note(0x90, voice_note, velocity);
 		}
 		else
 			
 		if (start_action == 71) {
-			voice_note = __1st + chord_chart[last_chord_note % 12][last_chord_type][5];
+			voice_note = chord_voicing()->pitch[5];
 			midi_send_note(0x90, voice_note, velocity);				
 		}
 		else
@@ -3570,49 +3696,41 @@ void midi_process_state(uint64_t start_us) {		// called by looper.c real-timer f
 		// play chord strum up notes	
 		
 		if (start_action == 76 || start_action == 83) {
-			qsort(auto_chord_midinotes, 6, sizeof(uint8_t), compUp);
 			
-			if (start_action == 83) {	// mute
-				if (!enable_modx && !enable_seqtrak && !enable_synth && !enable_ample_guitar && !enable_wav_trigger_pro && !enable_nanobox_tangerine) midi_send_program_change(0xC0, 28);
-			}
+			bool mute = start_action == 83 && !enable_modx && !enable_seqtrak && !enable_synth && !enable_ample_guitar && !enable_wav_trigger_pro && !enable_nanobox_tangerine;
+			
+			if (mute) midi_send_program_change(0xC0, 28);
 			
 			for (int n=0; n<6; n++) {
-				midi_send_note(0x90, auto_chord_midinotes[n], velocity);
-				chord_notes[n] = auto_chord_midinotes[n];
-				if (velocity > 25) velocity = velocity - 10;
+				chord_notes[n] = mute_midinotes_up[n];
 			}
 			
-			if (start_action == 83) {	// normal
-				if (!enable_modx && !enable_seqtrak && !enable_synth && !enable_ample_guitar && !enable_wav_trigger_pro && !enable_nanobox_tangerine) midi_send_program_change(0xC0, guitar_pc_code);
-			}			
+			// back to normal after the last string
+			strum_play(chord_notes, 6, velocity, mute ? guitar_pc_code : STRUM_NO_PROGRAM);
 		} 
 		else
 			
 		// play chord strum down notes		
 
 		if (start_action == 72 || start_action == 74 || start_action == 79 || start_action == 81) {
-			qsort(auto_chord_midinotes, 6, sizeof(uint8_t), compDown);
 			
-			if (start_action == 79 || start_action == 81) {	// mute
-				if (!enable_modx && !enable_seqtrak && !enable_synth && !enable_ample_guitar && !enable_wav_trigger_pro && !enable_nanobox_tangerine) midi_send_program_change(0xC0, 28);
-			}
+			bool mute = (start_action == 79 || start_action == 81) && !enable_modx && !enable_seqtrak && !enable_synth && !enable_ample_guitar && !enable_wav_trigger_pro && !enable_nanobox_tangerine;
+			
+			if (mute) midi_send_program_change(0xC0, 28);
 			
 			for (int n=0; n<6; n++) {
-				midi_send_note(0x90, auto_chord_midinotes[n], velocity);
-				chord_notes[n] = auto_chord_midinotes[n];	
-				if (velocity > 25) velocity = velocity - 10;			
+				chord_notes[n] = mute_midinotes_up[5 - n];	
 			}
 			
-			if (start_action == 79 || start_action == 81) {	// normal
-				if (!enable_modx && !enable_seqtrak && !enable_synth && !enable_ample_guitar && !enable_wav_trigger_pro && !enable_nanobox_tangerine) midi_send_program_change(0xC0, guitar_pc_code);
-			}			
+			// back to normal after the last string
+			strum_play(chord_notes, 6, velocity, mute ? guitar_pc_code : STRUM_NO_PROGRAM);
 		}
 		else
 		
 		// play voice note		
 
 		if (start_action == 77 || start_action == 78) {	
-			voice_note = (last_chord_note % 12) + (O * (active_neck_pos + 2)); // auto_chord_midinotes[0];
+			voice_note = (last_chord_note % 12) + (O * (active_neck_pos + 2)); // mute_midinotes_up[0];
 			midi_send_note(0x90, voice_note, velocity);
 		}		
 	}
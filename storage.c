@@ -10,11 +10,14 @@
 #include "pico/flash.h"
 #include <pico/cyw43_arch.h>
 
+#include "trace.h"
+
 #ifndef GHOST_FLASH_BANK_STORAGE_OFFSET
 #define GHOST_FLASH_BANK_STORAGE_OFFSET (PICO_FLASH_SIZE_BYTES - (FLASH_SECTOR_SIZE * 8))
 #endif
 
 #define MAGIC_HEADER "GHST"
+#define PATTERN_MAGIC "GHS2"  // patterns a bit per step, with the loop geometry
 #define NUM_TRACKS 4
 
 typedef struct {
@@ -22,9 +25,14 @@ typedef struct {
     uint8_t preferences[FLASH_PAGE_SIZE - 4];
 } storage_preference_t;
 
+// Patterns are stored a bit per step, so the longest loop fits one page.
 typedef struct {
     uint32_t magic;
-    bool pattern[NUM_TRACKS][LOOPER_TOTAL_STEPS];
+    uint8_t bars;
+    uint8_t beats_per_bar;
+    uint8_t beat_unit;
+    uint8_t steps_per_beat;
+    uint8_t pattern[NUM_TRACKS][LOOPER_MAX_STEPS / 8];
 } storage_pattern_t;
 
 typedef struct {
@@ -45,6 +53,7 @@ extern bool enable_mpc_sample;
 extern bool enable_mpx_looper;
 extern bool enable_nanobox_tangerine;
 extern bool enable_synth;
+extern bool enable_native_arp;
 
 extern uint8_t guitar_pc_code;
 
@@ -52,13 +61,15 @@ extern uint8_t guitar_pc_code;
 
 static void __no_inline_not_in_flash_func(flash_bank_perform_operation)(void *param) {
     const mutation_operation_t *mop = (const mutation_operation_t *)param;
-	
+
+    TRACE(TRACE_FLASH_BEGIN, mop->op_is_erase, mop->p0);
     if (mop->op_is_erase) {
         flash_range_erase(mop->p0, FLASH_SECTOR_SIZE);
     } else {
         flash_range_erase(mop->p0, FLASH_SECTOR_SIZE);		
         flash_range_program(mop->p0, (const uint8_t *)mop->p1, FLASH_PAGE_SIZE);
     }
+    TRACE(TRACE_FLASH_END, mop->op_is_erase, mop->p0);
 	
 	//midi_send_note(0x96, 66, 66);	
 }
@@ -89,6 +100,7 @@ bool storage_store_preferences(void) {
 	data->preferences[8]  = enable_mpx_looper;
 	data->preferences[9]  = enable_nanobox_tangerine;
 	data->preferences[10] = enable_synth;		
+	data->preferences[11] = enable_native_arp;
 	
     mutation_operation_t program = {.op_is_erase = false, .p0 = GHOST_FLASH_BANK_STORAGE_OFFSET, .p1 = (uintptr_t)storage};
 	
@@ -122,6 +134,7 @@ bool storage_load_preferences(void) {
 	enable_mpx_looper 		 = data->preferences[8];
 	enable_nanobox_tangerine = data->preferences[9];
 	enable_synth			 = data->preferences[10];	
+	enable_native_arp		 = data->preferences[11] == 1;	// older saves left it unset
 	
 	//midi_send_note(0x94, data->preferences[0] ? 127 : 0, enable_ample_guitar ? 127 : 0);	
     return true;
@@ -129,33 +142,53 @@ bool storage_load_preferences(void) {
 
 bool storage_load_tracks(void) {
     size_t num_tracks;
-    track_t *tracks = looper_tracks_get(&num_tracks);
-
     const storage_pattern_t *data = (const storage_pattern_t *)(XIP_BASE + GHOST_FLASH_BANK_STORAGE_OFFSET);
 	
-    if (memcmp(&data->magic, MAGIC_HEADER, sizeof(data->magic)) != 0)
+    if (memcmp(&data->magic, PATTERN_MAGIC, sizeof(data->magic)) != 0)
+        return false;
+
+	// Sets up storage for the stored loop, a geometry this build cannot hold is not loaded.
+    if (!looper_set_geometry(data->bars, data->beats_per_bar, data->beat_unit, data->steps_per_beat))
         return false;
 
-    for (size_t t = 0; t < num_tracks; t++) 
+    // The geometry starts editing over in another bank.
+    track_t *tracks = looper_tracks_get(&num_tracks);
+
+    uint16_t total_steps = looper_geometry_get()->total_steps;
+    for (size_t t = 0; t < NUM_TRACKS && t < num_tracks; t++) 
 	{
-        for (size_t i = 0; i < LOOPER_TOTAL_STEPS; i++) 
+        for (size_t i = 0; i < total_steps; i++) 
 		{
-            tracks[t].pattern[i] = data->pattern[t][i];
+            tracks[t].pattern[i] = (data->pattern[t][i / 8] >> (i % 8)) & 1;
         }
+        tracks[t].revision++;
     }
+    looper_publish();
     return true;
 }
 
+// Recorded hits are not stored: a loaded loop plays the steps they marked,
+// on the grid, whatever the looper timing was.
 bool storage_store_tracks(void) {
     uint8_t storage[FLASH_PAGE_SIZE];
     storage_pattern_t *data = (storage_pattern_t *)&storage;
     size_t num_tracks;
     track_t *tracks = looper_tracks_get(&num_tracks);
 
-    memcpy(&data->magic, MAGIC_HEADER, sizeof(data->magic));
+    const looper_geometry_t *geometry = looper_geometry_get();
+
+    memset(storage, 0, sizeof(storage));
+    memcpy(&data->magic, PATTERN_MAGIC, sizeof(data->magic));
+    data->bars = geometry->bars;
+    data->beats_per_bar = geometry->beats_per_bar;
+    data->beat_unit = geometry->beat_unit;
+    data->steps_per_beat = geometry->steps_per_beat;
 	
-    for (size_t t = 0; t < NUM_TRACKS; t++) {
-        memcpy(data->pattern[t], tracks[t].pattern, sizeof(tracks[t].pattern));
+    for (size_t t = 0; t < NUM_TRACKS && t < num_tracks; t++) {
+        for (size_t i = 0; i < geometry->total_steps; i++) {
+            if (tracks[t].pattern[i])
+                data->pattern[t][i / 8] |= 1u << (i % 8);
+        }
     }
 	
     mutation_operation_t program = {.op_is_erase = false, .p0 = GHOST_FLASH_BANK_STORAGE_OFFSET, .p1 = (uintptr_t)storage};
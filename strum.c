@@ -0,0 +1,116 @@
+/**
+ * Timed strum
+ *
+ * A strum is spread over its strings at explicit offsets through the note
+ * scheduler instead of leaving as one burst. The smear is then part of the
+ * playing and the same on every transport, not whatever the DIN wire makes
+ * of six notes and a couple of program changes.
+ *
+ * A strum lasts a third of a 16th note at the looper tempo, 6 to 40 ms, and
+ * a soft one up to twice as long as a full velocity one. Each string gets a
+ * little seeded jitter on its timing and velocity so repeated strums do not
+ * sound mechanical; the jitter never lets two strings swap, and the same
+ * strums replay the same after a reset.
+ */
+#include "strum.h"
+
+#include "pico/time.h"
+
+#include "looper.h"
+#include "note_scheduler.h"
+
+#define STRUM_STEP_FRACTION     3      // a full velocity strum takes a third of a 16th note
+#define STRUM_MIN_SPAN_US       6000   // first to last string
+#define STRUM_MAX_SPAN_US       40000
+#define STRUM_HUMANIZE_US       1000   // timing jitter per string, 0 turns it off
+#define STRUM_HUMANIZE_VELOCITY 4      // velocity jitter per string, 0 turns it off
+#define STRUM_SEED              1
+
+void midi_send_note(uint8_t command, uint8_t note, uint8_t velocity);
+void midi_send_program_change(uint8_t command, uint8_t code);
+
+static uint32_t rng_state = STRUM_SEED;
+
+// xorshift32, the same generator the ghost notes use.
+static uint32_t rng_next(void) {
+    uint32_t x = rng_state;
+
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    rng_state = x;
+    return x;
+}
+
+// Uniform in [-range, range].
+static int32_t rng_jitter(uint32_t range) {
+    if (range == 0)
+        return 0;
+    return (int32_t)(((uint64_t)rng_next() * (2 * range + 1)) >> 32) - (int32_t)range;
+}
+
+static uint32_t strum_span_us(uint8_t velocity) {
+    uint32_t bpm = looper_status_get()->bpm > 0 ? looper_status_get()->bpm : LOOPER_DEFAULT_BPM;
+    uint32_t sixteenth_us = 60000000 / (bpm * 4);
+    uint32_t span = sixteenth_us / STRUM_STEP_FRACTION * (254 - velocity) / 127;
+
+    if (span < STRUM_MIN_SPAN_US)
+        return STRUM_MIN_SPAN_US;
+    if (span > STRUM_MAX_SPAN_US)
+        return STRUM_MAX_SPAN_US;
+    return span;
+}
+
+void strum_play(const uint8_t *notes, uint8_t count, uint8_t velocity, int restore_program) {
+    uint64_t start_us = time_us_64();
+    uint8_t strings = 0;
+
+    for (uint8_t n = 0; n < count; n++) {
+        if (notes[n] > 0)
+            strings++;
+    }
+    if (strings == 0)
+        return;
+
+    uint32_t spacing_us = strings > 1 ? strum_span_us(velocity) / (strings - 1) : 0;
+    uint32_t jitter_us = spacing_us > 0 ? (spacing_us - 1) / 2 : 0;
+    if (jitter_us > STRUM_HUMANIZE_US)
+        jitter_us = STRUM_HUMANIZE_US;
+
+    uint64_t at_us = start_us;
+    uint8_t string = 0;
+    for (uint8_t n = 0; n < count; n++) {
+        if (notes[n] == 0)
+            continue;
+
+        // The first string goes out right away, it carries the attack.
+        at_us = start_us + string * spacing_us;
+        if (string > 0)
+            at_us += rng_jitter(jitter_us);
+
+        int32_t level = velocity + rng_jitter(STRUM_HUMANIZE_VELOCITY);
+        if (level < 1)
+            level = 1;
+        if (level > 127)
+            level = 127;
+
+        note_scheduler_schedule_message(at_us, 0x90, notes[n], (uint8_t)level);
+        if (velocity > 25)
+            velocity = velocity - 10;
+        string++;
+    }
+
+    if (restore_program != STRUM_NO_PROGRAM)
+        note_scheduler_schedule_message(at_us + 1, 0xC0, (uint8_t)restore_program, 0);
+}
+
+void strum_cancel(void) {
+    note_scheduler_cancel_messages(0x90);
+}
+
+void strum_perform_message(uint8_t command, uint8_t data1, uint8_t data2) {
+    if ((command & 0xF0) == 0xC0)
+        midi_send_program_change(command, data1);
+    else
+        midi_send_note(command, data1, data2);
+}
@@ -0,0 +1,20 @@
+#ifndef STRUM_H_
+#define STRUM_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define STRUM_NO_PROGRAM -1
+
+// Core 0: schedules the notes as one strum from now, first note first. The
+// first note gets `velocity`, each further one 10 less down to 25. With a
+// `restore_program` the program change goes out after the last string.
+void strum_play(const uint8_t *notes, uint8_t count, uint8_t velocity, int restore_program);
+
+// Core 0: drops the strings of the strum still to come.
+void strum_cancel(void);
+
+// Main loop: a due guitar message from the note scheduler.
+void strum_perform_message(uint8_t command, uint8_t data1, uint8_t data2);
+
+#endif  // STRUM_H_
@@ -0,0 +1,41 @@
+#ifndef SYSEX_H_
+#define SYSEX_H_
+
+#include <stdint.h>
+
+// Device SysEx on the USB MIDI port: F0 7D 4F <subsystem> <cmd> [7-bit data] F7
+#define SYSEX_ID         0x7D  // non-commercial / educational use
+#define SYSEX_TAG        0x4F  // 'O'
+#define SYSEX_TRACE      0x54  // 'T', see trace.h
+#define SYSEX_METRICS    0x4D  // 'M', see metrics.h
+#define SYSEX_HEADER_LEN 5
+
+#define SYSEX_PACKED_LEN(n) ((n) / 7 * 8 + ((n) % 7 ? (n) % 7 + 1 : 0))
+
+static inline uint32_t sysex_header(uint8_t *dst, uint8_t subsystem, uint8_t cmd) {
+    dst[0] = 0xF0;
+    dst[1] = SYSEX_ID;
+    dst[2] = SYSEX_TAG;
+    dst[3] = subsystem;
+    dst[4] = cmd;
+    return SYSEX_HEADER_LEN;
+}
+
+// 7 bytes become 8: a byte with their top bits, then the low 7 bits of each.
+static inline uint32_t sysex_pack_7bit(uint8_t *dst, const uint8_t *src, uint32_t len) {
+    uint32_t out = 0;
+
+    for (uint32_t i = 0; i < len; i += 7) {
+        uint32_t n = len - i < 7 ? len - i : 7;
+        uint8_t msbs = 0;
+
+        for (uint32_t j = 0; j < n; j++)
+            msbs |= (uint8_t)((src[i + j] >> 7) << j);
+        dst[out++] = msbs;
+        for (uint32_t j = 0; j < n; j++)
+            dst[out++] = src[i + j] & 0x7F;
+    }
+    return out;
+}
+
+#endif  // SYSEX_H_
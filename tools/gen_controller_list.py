@@ -0,0 +1,156 @@
+#!/usr/bin/env python3
+#
+# gen_controller_list.py
+#
+# Generates bluepad32/include/controller/uni_controller_list_sorted.h from
+# bluepad32/include/controller/uni_controller_list.h.
+#
+# uni_controller_list.h stays the hand-edited source (grouped by vendor, as in
+# SDL). The generated header holds the same entries sorted by device id so that
+# uni_guess_controller_type() can binary-search it. Duplicate VID/PID entries
+# are reported here, at build time, instead of on the device.
+#
+# Usage:
+#   gen_controller_list.py            regenerate the sorted header
+#   gen_controller_list.py --check    fail if the sorted header is stale or the
+#                                     list contains duplicates (used by CMake)
+
+import os
+import re
+import sys
+
+ROOT = os.path.normpath(os.path.join(os.path.dirname(os.path.abspath(__file__)), ".."))
+SRC = os.path.join(ROOT, "bluepad32", "include", "controller", "uni_controller_list.h")
+DST = os.path.join(ROOT, "bluepad32", "include", "controller", "uni_controller_list_sorted.h")
+
+ENTRY = re.compile(
+    r"^\s*\{\s*MAKE_CONTROLLER_ID\(\s*(0[xX][0-9a-fA-F]+)\s*,\s*(0[xX][0-9a-fA-F]+)\s*\)\s*,"
+    r"\s*(\w+)\s*,\s*(NULL|\"(?:[^\"\\]|\\.)*\")\s*\}\s*,?\s*(?://\s*(.*))?$"
+)
+
+HEADER = """\
+/*
+  Copyright (C) Valve Corporation
+
+  This software is provided 'as-is', without any express or implied
+  warranty.  In no event will the authors be held liable for any damages
+  arising from the use of this software.
+
+  Permission is granted to anyone to use this software for any purpose,
+  including commercial applications, and to alter it and redistribute it
+  freely, subject to the following restrictions:
+
+  1. The origin of this software must not be misrepresented; you must not
+     claim that you wrote the original software. If you use this software
+     in a product, an acknowledgment in the product documentation would be
+     appreciated but is not required.
+  2. Altered source versions must be plainly marked as such, and must not be
+     misrepresented as being the original software.
+  3. This notice may not be removed or altered from any source distribution.
+*/
+
+// GENERATED FILE. DO NOT EDIT.
+// Source: uni_controller_list.h
+// Regenerate with: tools/gen_controller_list.py
+
+// DO NOT INCLUDE.
+// CAN ONLY BE INCLUDED FROM uni_controller_type.c
+
+// Sorted by device id (VID << 16 | PID) for binary search.
+
+#define MAKE_CONTROLLER_ID(nVID, nPID) (uint32_t)((uint16_t)nVID << 16 | (uint16_t)nPID)
+
+// clang-format off
+
+static const uni_controller_description_t arrControllers[] = {
+"""
+
+FOOTER = """\
+};
+
+// clang-format on
+"""
+
+
+def parse(path):
+    entries = []
+    with open(path, encoding="utf-8") as f:
+        for lineno, line in enumerate(f, 1):
+            if line.lstrip().startswith("//"):
+                continue
+            m = ENTRY.match(line)
+            if not m:
+                if "MAKE_CONTROLLER_ID(" in line and "#define" not in line:
+                    sys.exit("%s:%d: unrecognised controller entry" % (path, lineno))
+                continue
+            vid = int(m.group(1), 16)
+            pid = int(m.group(2), 16)
+            entries.append(
+                {
+                    "id": (vid << 16) | pid,
+                    "vid": vid,
+                    "pid": pid,
+                    "type": m.group(3),
+                    "name": m.group(4),
+                    "comment": (m.group(5) or "").strip(),
+                    "line": lineno,
+                }
+            )
+    return entries
+
+
+def find_duplicates(entries):
+    seen = {}
+    dups = []
+    for e in entries:
+        if e["id"] in seen:
+            dups.append((seen[e["id"]], e))
+        else:
+            seen[e["id"]] = e
+    return dups
+
+
+def render(entries):
+    out = [HEADER]
+    for e in sorted(entries, key=lambda e: e["id"]):
+        line = "\t{ MAKE_CONTROLLER_ID( 0x%04x, 0x%04x ), %s, %s }," % (e["vid"], e["pid"], e["type"], e["name"])
+        if e["comment"]:
+            line += "\t// " + e["comment"]
+        out.append(line + "\n")
+    out.append(FOOTER)
+    return "".join(out)
+
+
+def main():
+    check = "--check" in sys.argv[1:]
+    entries = parse(SRC)
+
+    dups = find_duplicates(entries)
+    for first, second in dups:
+        sys.stderr.write(
+            "%s:%d: duplicate controller entry for VID 0x%04x PID 0x%04x (first at line %d)\n"
+            % (SRC, second["line"], second["vid"], second["pid"], first["line"])
+        )
+    if dups:
+        return 1
+
+    text = render(entries)
+
+    if check:
+        try:
+            with open(DST, encoding="utf-8") as f:
+                current = f.read()
+        except OSError:
+            current = None
+        if current != text:
+            sys.stderr.write("%s is out of date, run tools/gen_controller_list.py\n" % DST)
+            return 1
+        return 0
+
+    with open(DST, "w", encoding="utf-8") as f:
+        f.write(text)
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
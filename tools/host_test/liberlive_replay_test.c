@@ -0,0 +1,664 @@
+/**
+ * Liberlive notification replay
+ *
+ * Replays notifications through the table decoder and its event queue
+ * (bluepad32/bt/uni_bt_le_liberlive.c) and through the if/else ladder the
+ * GATT callback had before, copied below, and compares what the firmware
+ * would see: the config_guitar(), tempo and key calls in order, the
+ * controller globals at each gamepad_bluetooth_handle_data() call, and the
+ * globals at the end.
+ *
+ * The captures in liberlive_notifications.txt come first, then random
+ * notifications over the bytes the decoder reads. The decoder drops a repeat
+ * of the previous notification, the ladder ran it again; repeats are left out
+ * of the replay.
+ *
+ * Build and run with `make -C tools/host_test`.
+ */
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pico/cyw43_arch.h"
+#include "bt/uni_bt_le_liberlive.h"
+
+static int failures = 0;
+
+#define CHECK(cond, ...)                                   \
+    do {                                                   \
+        if (!(cond)) {                                     \
+            printf("%s:%d: ", __FILE__, __LINE__);         \
+            printf(__VA_ARGS__);                           \
+            printf("\n");                                  \
+            failures++;                                    \
+        }                                                  \
+    } while (0)
+
+// The controller globals of pico_bluetooth.c the decoder writes.
+int applied_velocity;
+int transpose;
+uint8_t but0, but1, but2, but3, but4, but6, but7, but9;
+uint8_t mbut0, mbut1, mbut2, mbut3;
+uint8_t dpad_left, dpad_right, dpad_up, dpad_down;
+bool joy_up, joy_down, knob_up, knob_down;
+uint8_t green, red, yellow, blue, orange, starpower, pitch, left, right, logo, joystick_up, joystick_down;
+bool enable_seqtrak = true;
+bool enable_modx = true;
+
+typedef struct {
+    int applied_velocity, transpose;
+    uint8_t but[8], mbut[4], dpad[4];
+    bool joy_up, joy_down, knob_up, knob_down;
+    uint8_t green, red, yellow, blue, orange, starpower, pitch, left, right, logo, joystick_up, joystick_down;
+} controls_t;
+
+static void controls_get(controls_t *c) {
+    memset(c, 0, sizeof(*c));
+    c->applied_velocity = applied_velocity;
+    c->transpose = transpose;
+    c->but[0] = but0; c->but[1] = but1; c->but[2] = but2; c->but[3] = but3;
+    c->but[4] = but4; c->but[5] = but6; c->but[6] = but7; c->but[7] = but9;
+    c->mbut[0] = mbut0; c->mbut[1] = mbut1; c->mbut[2] = mbut2; c->mbut[3] = mbut3;
+    c->dpad[0] = dpad_left; c->dpad[1] = dpad_right; c->dpad[2] = dpad_up; c->dpad[3] = dpad_down;
+    c->joy_up = joy_up; c->joy_down = joy_down; c->knob_up = knob_up; c->knob_down = knob_down;
+    c->green = green; c->red = red; c->yellow = yellow; c->blue = blue; c->orange = orange;
+    c->starpower = starpower; c->pitch = pitch; c->left = left; c->right = right; c->logo = logo;
+    c->joystick_up = joystick_up; c->joystick_down = joystick_down;
+}
+
+// The handler sets the raw inputs back up between reports, as a real report does.
+static void controls_reset(void) {
+    but0 = but1 = but2 = but3 = but4 = but6 = but7 = but9 = 0;
+    mbut0 = mbut1 = mbut2 = mbut3 = 0;
+    dpad_left = dpad_right = dpad_up = dpad_down = 0;
+    joy_up = joy_down = knob_up = knob_down = false;
+    green = red = yellow = blue = orange = starpower = pitch = left = right = logo = 1;
+    joystick_up = joystick_down = 1;
+}
+
+// What the decoder hands on, in order.
+typedef struct {
+    char kind;  // C config, H handle data, T SEQTRAK tempo, M MODX tempo, K SEQTRAK key
+    int value;
+    controls_t controls;
+} call_t;
+
+#define CALLS_MAX 20000
+
+typedef struct {
+    call_t calls[CALLS_MAX];
+    uint32_t count;
+} call_log_t;
+
+static call_log_t ladder_log, table_log;
+static call_log_t *log_to;
+
+static int lock_depth = 0;
+static uint32_t unlocked_calls = 0;
+
+async_context_t *cyw43_arch_async_context(void) {
+    return NULL;
+}
+
+void async_context_acquire_lock_blocking(async_context_t *context) {
+    (void)context;
+    lock_depth++;
+}
+
+void async_context_release_lock(async_context_t *context) {
+    (void)context;
+    lock_depth--;
+}
+
+static void log_call(char kind, int value) {
+    if (log_to->count == CALLS_MAX)
+        return;
+    call_t *call = &log_to->calls[log_to->count++];
+    call->kind = kind;
+    call->value = value;
+    if (kind == 'H')
+        controls_get(&call->controls);
+    else
+        memset(&call->controls, 0, sizeof(call->controls));
+    if (log_to == &table_log && lock_depth == 0)
+        unlocked_calls++;
+}
+
+void gamepad_bluetooth_handle_data() {
+    log_call('H', 0);
+    controls_reset();
+}
+
+void config_guitar(uint8_t mode) {
+    log_call('C', mode);
+}
+
+void midi_seqtrak_tempo(int tempo) {
+    log_call('T', tempo);
+}
+
+void midi_modx_tempo(int tempo) {
+    log_call('M', tempo);
+}
+
+void midi_seqtrak_key(uint8_t key) {
+    log_call('K', key);
+}
+
+void metrics_hid_report(bool ble, bool changed) {
+    (void)ble;
+    (void)changed;
+}
+
+// The GATT_EVENT_NOTIFICATION branch of handle_gatt_client_event() before the
+// table decoder, unchanged but for its name and the zeroed buffer: a short
+// notification left stack bytes in the rest of it.
+static bool ll_cannot_fire;
+static bool ll_have_fired;
+
+static void ladder_notification(const uint8_t *value, uint32_t value_length) {
+	static int current_tempo = 0;
+
+	bool chord_selected = false;
+	bool handling_required = false;
+
+	uint8_t event_data[16] = {0};
+
+		memcpy(event_data, value, value_length);
+
+		joy_up = false;
+		joy_down = false;
+		knob_up = false;
+		knob_down = false;
+
+		but0 = 0;
+		but1 = 0;
+		but2 = 0;
+		but3 = 0;
+		but4 = 0;
+		but6 = 0;
+		but7 = 0;
+		but9 = 0;
+
+		dpad_left = 0;
+		dpad_right = 0;
+		dpad_up = 0;
+		dpad_down = 0;
+
+		mbut0 = 0;
+		mbut1 = 0;
+		mbut2 = 0;
+		mbut3 = 0;
+
+
+		// detect config changes - tap tempo pressed
+
+		if (event_data[1] >= 16 && event_data[5] == 0)
+		{
+			if (event_data[4] == 2)   	   config_guitar(1);		// ketron arranger
+			else if (event_data[4] == 4)   config_guitar(2);		// ample guitar
+			else if (event_data[4] == 8)   config_guitar(3);		// midi drums
+			else if (event_data[4] == 16)  config_guitar(4);		// yamaha seqtrak
+			else if (event_data[4] == 32)  config_guitar(5);		// yamaha modx/montage
+			else if (event_data[4] == 64)  config_guitar(11);		// mpc sample
+			else if (event_data[4] == 128) config_guitar(19);		// wav trigger pro
+		}
+
+		// detect paddle neutral
+
+		ll_cannot_fire = (event_data[5] == 0); // when paddle in neutral
+
+		if (ll_have_fired && ll_cannot_fire) {
+			cyw43_arch_gpio_put(CYW43_WL_GPIO_LED_PIN, false);
+			ll_have_fired = false;
+
+			left = 1;
+			green = 0; red = 0; yellow = 0; blue = 0; orange = 0;
+			gamepad_bluetooth_handle_data();
+			return;
+		}
+
+		// detect tempo changes
+
+		if (event_data[7] != current_tempo) {
+			current_tempo = event_data[7];
+
+			if (enable_seqtrak) midi_seqtrak_tempo(current_tempo);
+			if (enable_modx) 	midi_modx_tempo(current_tempo);
+		}
+
+		// detect key change
+
+		uint8_t old_key = transpose;
+
+		if (event_data[1] == 0) transpose = 0;	// C
+		else if (event_data[1] == 1) transpose = 2;		// D
+		else if (event_data[1] == 2) transpose = 4;		// E
+		else if (event_data[1] == 3) transpose = 5;		// F
+		else if (event_data[1] == 4) transpose = 7;		// G
+		else if (event_data[1] == 5) transpose = 9;		// A
+		else if (event_data[1] == 6) transpose = 11;	// B
+
+		if (old_key != transpose && event_data[5] == 0)
+		{
+			if (enable_seqtrak) midi_seqtrak_key(transpose);
+		}
+
+		// detect strum style - - stop/config pressed
+
+		if (event_data[5] == 64 ) {		// guitar play mode selection
+			handling_required = true;
+			but6 = 1; pitch = 0;
+
+			if (event_data[4] == 2)   	   {but1 = 1; green = 0;}	// full chord up/down
+			else if (event_data[4] == 4)   {but0 = 1; red = 0;}		// chord up/root note down
+			else if (event_data[4] == 8)   {but2 = 1; yellow = 0;}	// root note up/down
+			else if (event_data[4] == 16)  {but3 = 1; blue = 0;}	// 3rd note up/root note down
+			else if (event_data[4] == 32)  {but4 = 1; orange = 0;}	// 5th note up/root note down
+			else if (event_data[4] == 64)  {}						// nothing
+			else if (event_data[4] == 128) {}						// nothing
+		}
+		else
+
+		// detect key press
+
+		if (event_data[4] == 2) {
+			but2 = 1; yellow = 0;		// 7b
+			but0 = 1; red = 0;
+			chord_selected = true;
+		}
+		else
+
+		if (event_data[2] == 8) {
+			but1 = 1; green = 0;		// 7
+			but0 = 1; red = 0;
+			but2 = 1; yellow = 0;
+			but3 = 1; blue = 0;
+			chord_selected = true;
+		}
+		else
+
+		if (event_data[3] == 4) {
+			but2 = 1; yellow = 0;			// 5b
+			but1 = 1; green = 0;
+			but0 = 1; red = 0;
+			chord_selected = true;
+		}
+		else
+
+		if (event_data[4] == 4) {
+			but0 = 1; red = 0;				// 6m
+			chord_selected = true;
+		}
+		else
+
+		if (event_data[2] == 16 || event_data[3] == 8) {
+			but0 = 1; red = 0;		// 6
+			but2 = 1; yellow = 0;
+			but3 = 1; blue = 0;
+			chord_selected = true;
+		}
+		else
+
+		if (event_data[4] == 8) {
+			but1 = 1; green = 0;		// 5
+			chord_selected = true;
+		}
+		else
+
+		if (event_data[2] == 32) {
+			but1 = 1; green = 0;		// 5sus
+			but2 = 1; yellow = 0;
+			chord_selected = true;
+		}
+		else
+
+		if (event_data[3] == 16) {
+			but1 = 1; green = 0;		// 5/7
+			but0 = 1; red = 0;
+			chord_selected = true;
+		}
+		else
+
+		if (event_data[4] == 16) {
+			but2 = 1; yellow = 0;		// 1
+			chord_selected = true;
+		}
+		else
+
+		if (event_data[2] == 64) {
+			but2 = 1; yellow = 0;		// 1sus
+			but4 = 1; orange = 0;
+			chord_selected = true;
+		}
+		else
+
+		if (event_data[3] == 32) {
+			but2 = 1; yellow = 0;		// 1/3
+			but3 = 1; blue = 0;
+			chord_selected = true;
+		}
+		else
+
+		if (event_data[4] == 32) {
+			but4 = 1; orange = 0;		// 4
+			chord_selected = true;
+		}
+		else
+
+		if (event_data[2] == 128) {
+			but4 = 1; orange = 0;		// 3b
+			but3 = 1; blue = 0;
+			but0 = 1; red = 0;
+			chord_selected = true;
+		}
+		else
+
+		if (event_data[3] == 64) {
+			but4 = 1; orange = 0;		// 4/6
+			but3 = 1; blue = 0;
+			chord_selected = true;
+		}
+		else
+
+		if (event_data[4] == 64) {
+			but3 = 1; blue = 0;		// 2m
+			chord_selected = true;
+		}
+		else
+
+		if (event_data[3] == 1) {
+			but3 = 1; blue = 0;		// 2
+			but0 = 1; red = 0;
+			chord_selected = true;
+		}
+		else
+
+		if (event_data[3] == 128) {
+			but4 = 1; orange = 0;		// 4m
+			but0 = 1; red = 0;
+			chord_selected = true;
+		}
+		else
+
+		if (event_data[4] == 128) {
+			but1 = 1; green = 0;		// 3m
+			but3 = 1; blue = 0;
+			chord_selected = true;
+		}
+		else
+
+		if (event_data[3] == 2) {
+			but1 = 1; green = 0;		// 3
+			but2 = 1; yellow = 0;
+			but3 = 1; blue = 0;
+			chord_selected = true;
+		}
+		else
+
+		if (event_data[4] == 1) {
+			but1 = 1; green = 0;		// 5m
+			but4 = 1; orange = 0;
+			chord_selected = true;
+		}
+
+
+
+
+		if (event_data[5] == 15) {										// Paddle A+B
+			handling_required = true;
+
+			if (event_data[10] < 48) { 									// UP
+				mbut0 = 1; logo = 0;
+			}
+			else
+
+			if (event_data[10] > 58) { 									// DOWN
+				mbut0 = 1; logo = 0;
+			}
+
+		}
+		else
+
+		if (event_data[5] == 12) {										// Paddle A
+			handling_required = true;
+
+			if (event_data[9] < 48) { 									// UP
+				applied_velocity = (50 - event_data[9]) / 50;
+
+				if (chord_selected) {
+					dpad_right = 1; right = 0;
+				} else {
+					joy_down = true; joystick_down = 0;					// break
+				}
+
+			}
+			else
+
+			if (event_data[9] > 58) { 									// DOWN
+				applied_velocity = event_data[9] / 50;
+
+				if (chord_selected) {
+					dpad_left = 1;	left = 0;
+				} else {
+					joy_up = true; joystick_up = 0;						// fill
+				}
+			}
+
+		}
+		else
+
+		if (event_data[5] == 3) {										// Paddle B
+			handling_required = true;
+
+			if (event_data[10] < 48) { 									// UP
+				applied_velocity = (50 - event_data[10]) / 50;
+
+				if (chord_selected) {
+					dpad_right = 1; right = 0;
+				} else {
+					dpad_down = 1; starpower = 0; orange = 0; but4 = 1;	// prev style
+				}
+			}
+			else
+
+			if (event_data[10] > 58) { 									// DOWN
+				applied_velocity = event_data[10] / 50;
+
+				if (chord_selected) {
+					dpad_left = 1;	left = 0;
+
+				} else {
+					dpad_down = 1; starpower = 0; 						// next style
+				}
+			}
+
+		}
+
+		if (handling_required && !ll_have_fired) {
+			ll_have_fired = true;
+			ll_cannot_fire = true;
+
+			gamepad_bluetooth_handle_data();
+			cyw43_arch_gpio_put(CYW43_WL_GPIO_LED_PIN, true);
+		}
+}
+
+#define NOTIFICATION_LEN 16
+#define NOTIFICATIONS_MAX 4096
+
+typedef struct {
+    uint8_t value[NOTIFICATION_LEN];
+    uint32_t len;
+} notification_t;
+
+static notification_t notifications[NOTIFICATIONS_MAX];
+static uint32_t notification_count = 0;
+
+static void add_notification(const uint8_t *value, uint32_t len) {
+    if (notification_count == NOTIFICATIONS_MAX)
+        return;
+
+    // A repeat reads the same as the zero-padded notification before it.
+    if (notification_count > 0) {
+        const notification_t *last = &notifications[notification_count - 1];
+        uint8_t a[NOTIFICATION_LEN] = {0}, b[NOTIFICATION_LEN] = {0};
+        memcpy(a, last->value, last->len);
+        memcpy(b, value, len);
+        if (memcmp(a, b, sizeof(a)) == 0)
+            return;
+    }
+
+    notification_t *n = &notifications[notification_count++];
+    memset(n->value, 0, sizeof(n->value));
+    memcpy(n->value, value, len);
+    n->len = len;
+}
+
+static bool load_captures(const char *path) {
+    FILE *file = fopen(path, "r");
+    char line[256];
+
+    if (file == NULL) {
+        printf("liberlive_replay_test: cannot open %s\n", path);
+        return false;
+    }
+    while (fgets(line, sizeof(line), file) != NULL) {
+        uint8_t value[NOTIFICATION_LEN];
+        uint32_t len = 0;
+        char *p = line;
+        char *end;
+
+        while (len < NOTIFICATION_LEN) {
+            unsigned long byte = strtoul(p, &end, 16);
+            if (end == p || *p == '#')
+                break;
+            value[len++] = (uint8_t)byte;
+            p = end;
+        }
+        if (len > 0)
+            add_notification(value, len);
+    }
+    fclose(file);
+    return true;
+}
+
+static uint32_t rng_state = 1;
+
+static uint32_t rng_next(void) {
+    uint32_t x = rng_state;
+
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    rng_state = x;
+    return x;
+}
+
+// A key byte: mostly nothing, else one key, now and then two.
+static uint8_t random_keys(void) {
+    uint32_t r = rng_next() % 16;
+
+    if (r < 8)
+        return 0;
+    if (r < 15)
+        return (uint8_t)(1u << (rng_next() % 8));
+    return (uint8_t)(rng_next() & 0xFF);
+}
+
+static void add_random_notifications(uint32_t count) {
+    static const uint8_t paddles[] = {0, 0, 0, 12, 3, 15, 64, 5};
+    static const uint8_t tempos[] = {90, 120, 120, 120, 140};
+
+    for (uint32_t i = 0; i < count; i++) {
+        uint8_t value[NOTIFICATION_LEN] = {0};
+
+        value[1] = (uint8_t)(rng_next() % 8 + (rng_next() % 4 == 0 ? 16 : 0));
+        value[2] = random_keys();
+        value[3] = random_keys();
+        value[4] = random_keys();
+        value[5] = paddles[rng_next() % sizeof(paddles)];
+        value[7] = tempos[rng_next() % sizeof(tempos)];
+        value[9] = (uint8_t)(rng_next() % 101);
+        value[10] = (uint8_t)(rng_next() % 101);
+        add_notification(value, NOTIFICATION_LEN);
+    }
+}
+
+static void compare_logs(const char *name, const controls_t *ladder_end, const controls_t *table_end) {
+    uint32_t handled = 0;
+
+    for (uint32_t i = 0; i < ladder_log.count; i++)
+        handled += ladder_log.calls[i].kind == 'H';
+
+    CHECK(table_log.count == ladder_log.count, "%s: %u calls, the ladder made %u", name, table_log.count,
+          ladder_log.count);
+    for (uint32_t i = 0; i < table_log.count && i < ladder_log.count; i++) {
+        const call_t *t = &table_log.calls[i];
+        const call_t *l = &ladder_log.calls[i];
+        if (t->kind != l->kind || t->value != l->value || memcmp(&t->controls, &l->controls, sizeof(t->controls))) {
+            CHECK(0, "%s: call %u is %c %d, the ladder made %c %d%s", name, i, t->kind, t->value, l->kind, l->value,
+                  t->kind == l->kind && t->value == l->value ? " with other controls" : "");
+            break;
+        }
+    }
+    CHECK(memcmp(ladder_end, table_end, sizeof(*ladder_end)) == 0, "%s: the controls end up differently", name);
+    CHECK(handled > 0, "%s: nothing was handed to the guitar handler", name);
+    CHECK(unlocked_calls == 0, "%s: %u calls outside the async context lock", name, unlocked_calls);
+    CHECK(lock_depth == 0, "%s: lock left at depth %d", name, lock_depth);
+}
+
+// Through both decoders, the table one drained every `batch` notifications.
+static void replay(const char *name, uint32_t batch) {
+    controls_t ladder_end, table_end;
+
+    memset(&ladder_log, 0, sizeof(ladder_log));
+    memset(&table_log, 0, sizeof(table_log));
+    unlocked_calls = 0;
+
+    log_to = &ladder_log;
+    ll_have_fired = false;
+    applied_velocity = 0;
+    transpose = 0;
+    controls_reset();
+    for (uint32_t i = 0; i < notification_count; i++)
+        ladder_notification(notifications[i].value, notifications[i].len);
+    controls_get(&ladder_end);
+
+    log_to = &table_log;
+    applied_velocity = 0;
+    transpose = 0;
+    controls_reset();
+    uni_bt_le_liberlive_reset();
+    for (uint32_t i = 0; i < notification_count; i++) {
+        uni_bt_le_liberlive_on_notification(notifications[i].value, notifications[i].len);
+        if ((i + 1) % batch == 0)
+            uni_bt_le_liberlive_process_events();
+    }
+    uni_bt_le_liberlive_process_events();
+    controls_get(&table_end);
+
+    printf("%s: %u notifications, %u calls\n", name, notification_count, table_log.count);
+    compare_logs(name, &ladder_end, &table_end);
+}
+
+int main(int argc, char **argv) {
+    const char *captures = argc > 1 ? argv[1] : "liberlive_notifications.txt";
+
+    if (!load_captures(captures))
+        return 1;
+    replay("captures", 1);
+
+    add_random_notifications(NOTIFICATIONS_MAX);
+    replay("captures and random", 1);
+    replay("captures and random, drained by 8", 8);
+
+    if (failures > 0) {
+        printf("liberlive_replay_test: %d failed\n", failures);
+        return 1;
+    }
+    printf("liberlive_replay_test: ok\n");
+    return 0;
+}
@@ -0,0 +1,12 @@
+// Host stand-in for the Pico SDK header.
+#ifndef HOST_TEST_SYNC_H
+#define HOST_TEST_SYNC_H
+
+static inline void __dmb(void) {
+    __sync_synchronize();
+}
+
+static inline void __sev(void) {
+}
+
+#endif  // HOST_TEST_SYNC_H
@@ -0,0 +1,21 @@
+// Host stand-in for the Pico SDK header: what the tested code uses, the
+// async context lock is counted by the test.
+#ifndef HOST_TEST_CYW43_ARCH_H
+#define HOST_TEST_CYW43_ARCH_H
+
+#include <stdbool.h>
+
+typedef struct async_context async_context_t;
+
+#define CYW43_WL_GPIO_LED_PIN 0
+
+static inline void cyw43_arch_gpio_put(unsigned int pin, bool value) {
+    (void)pin;
+    (void)value;
+}
+
+async_context_t *cyw43_arch_async_context(void);
+void async_context_acquire_lock_blocking(async_context_t *context);
+void async_context_release_lock(async_context_t *context);
+
+#endif  // HOST_TEST_CYW43_ARCH_H
@@ -0,0 +1,442 @@
+/**
+ * usb_midi_packet host test
+ *
+ * The packer against the TinyUSB stream parser it replaced, over channel,
+ * running status, system common, real-time and SysEx streams, written whole,
+ * in random pieces and a byte at a time. The unpacker replays mixed SysEx
+ * and channel traffic: what it returns must be the stream the packets carry,
+ * a SysEx too long to hold comes out in pieces while it is split, and a reset
+ * drops the rest of an unfinished SysEx.
+ *
+ * Build and run with `make -C tools/host_test`.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "usb_midi_packet.h"
+
+static int failures = 0;
+
+#define CHECK(cond, ...)                                   \
+    do {                                                   \
+        if (!(cond)) {                                     \
+            printf("%s:%d: ", __FILE__, __LINE__);         \
+            printf(__VA_ARGS__);                           \
+            printf("\n");                                  \
+            failures++;                                    \
+        }                                                  \
+    } while (0)
+
+#define STREAM_MAX 40000
+#define PACKETS_MAX (STREAM_MAX + 16)
+
+// tud_midi_n_stream_write() of tinyusb/src/class/midi/midi_device.c without
+// the endpoint: what the device port sent before the packer.
+typedef struct {
+    uint8_t buffer[4];
+    uint8_t index;
+    uint8_t total;
+} reference_stream_t;
+
+static uint32_t reference_write(reference_stream_t *stream, uint8_t cable_num, const uint8_t *buffer,
+                                uint32_t bufsize, uint8_t *packets) {
+    uint32_t count = 0;
+
+    for (uint32_t i = 0; i < bufsize; i++) {
+        const uint8_t data = buffer[i];
+
+        if (stream->index == 0) {
+            const uint8_t msg = data >> 4;
+
+            stream->index = 2;
+            stream->buffer[1] = data;
+
+            if ((stream->buffer[0] & 0xF) == 0x4) {
+                if (data == 0xF7) {
+                    stream->buffer[0] = (uint8_t)((cable_num << 4) | 0x5);
+                    stream->total = 2;
+                } else {
+                    stream->total = 4;
+                }
+            } else if ((msg >= 0x8 && msg <= 0xB) || msg == 0xE) {
+                stream->buffer[0] = (uint8_t)((cable_num << 4) | msg);
+                stream->total = 4;
+            } else if (msg == 0xC || msg == 0xD) {
+                stream->buffer[0] = (uint8_t)((cable_num << 4) | msg);
+                stream->total = 3;
+            } else if (msg == 0xF) {
+                if (data == 0xF0) {
+                    stream->buffer[0] = 0x4;
+                    stream->total = 4;
+                } else if (data == 0xF1 || data == 0xF3) {
+                    stream->buffer[0] = 0x2;
+                    stream->total = 3;
+                } else if (data == 0xF2) {
+                    stream->buffer[0] = 0x3;
+                    stream->total = 4;
+                } else {
+                    stream->buffer[0] = 0x5;
+                    stream->total = 2;
+                }
+                stream->buffer[0] |= (uint8_t)(cable_num << 4);
+            } else {
+                stream->buffer[0] = (uint8_t)(cable_num << 4 | 0xF);
+                stream->buffer[2] = 0;
+                stream->buffer[3] = 0;
+                stream->total = 2;
+            }
+        } else {
+            stream->buffer[stream->index] = data;
+            stream->index++;
+
+            if ((stream->buffer[0] & 0xF) == 0x4 && data == 0xF7) {
+                stream->buffer[0] = (uint8_t)((cable_num << 4) | (0x4 + (stream->index - 1)));
+                stream->total = stream->index;
+            }
+        }
+
+        if (stream->index == stream->total) {
+            for (uint8_t idx = stream->total; idx < 4; idx++)
+                stream->buffer[idx] = 0;
+            memcpy(&packets[count * USB_MIDI_PACKET_LEN], stream->buffer, USB_MIDI_PACKET_LEN);
+            count++;
+            stream->index = 0;
+            stream->total = 0;
+        }
+    }
+    return count;
+}
+
+static uint32_t rng_state = 1;
+
+static uint32_t rng_next(void) {
+    uint32_t x = rng_state;
+
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    rng_state = x;
+    return x;
+}
+
+static uint8_t data_byte(void) {
+    return (uint8_t)(rng_next() & 0x7F);
+}
+
+// Well-formed messages back to back, real-time bytes between them, SysEx of
+// up to `sysex_max` data bytes, channel messages sometimes in running status.
+static uint32_t random_stream(uint8_t *stream, uint32_t len, uint32_t sysex_max) {
+    static const uint8_t system[] = {0xF1, 0xF2, 0xF3, 0xF6};
+    uint32_t n = 0;
+    uint8_t running = 0;
+
+    while (n + sysex_max + 8 < len) {
+        uint32_t kind = rng_next() % 8;
+
+        if (kind < 4) {
+            uint8_t status = (uint8_t)(0x80 | (rng_next() % 7) << 4 | (rng_next() & 0x0F));
+            if (status != running || kind == 0)
+                stream[n++] = status;
+            running = status;
+            stream[n++] = data_byte();
+            if ((status & 0xE0) != 0xC0)
+                stream[n++] = data_byte();
+        } else if (kind == 4) {
+            uint32_t body = rng_next() % (sysex_max + 1);
+            stream[n++] = 0xF0;
+            for (uint32_t i = 0; i < body; i++)
+                stream[n++] = data_byte();
+            stream[n++] = 0xF7;
+            running = 0;
+        } else if (kind == 5) {
+            uint8_t status = system[rng_next() % sizeof(system)];
+            stream[n++] = status;
+            if (status != 0xF6)
+                stream[n++] = data_byte();
+            if (status == 0xF2)
+                stream[n++] = data_byte();
+            running = 0;
+        } else {
+            stream[n++] = (uint8_t)(0xF8 + rng_next() % 8);  // real-time keeps running status
+        }
+    }
+    return n;
+}
+
+static void compare_packets(const char *name, const uint8_t *expected, uint32_t expected_count,
+                            const uint8_t *packets, uint32_t count) {
+    CHECK(count == expected_count, "%s: %u packets, expected %u", name, count, expected_count);
+    for (uint32_t i = 0; i < count && i < expected_count; i++) {
+        const uint8_t *e = &expected[i * USB_MIDI_PACKET_LEN];
+        const uint8_t *p = &packets[i * USB_MIDI_PACKET_LEN];
+        if (memcmp(e, p, USB_MIDI_PACKET_LEN) != 0) {
+            CHECK(0, "%s: packet %u is %02x %02x %02x %02x, expected %02x %02x %02x %02x", name, i, p[0], p[1],
+                  p[2], p[3], e[0], e[1], e[2], e[3]);
+            return;
+        }
+    }
+}
+
+// Packs `stream` whole, in random pieces and a byte at a time, each against the reference.
+static void pack_like_reference(const char *name, uint8_t cable, const uint8_t *stream, uint32_t len) {
+    static uint8_t expected[PACKETS_MAX * USB_MIDI_PACKET_LEN];
+    static uint8_t packets[PACKETS_MAX * USB_MIDI_PACKET_LEN];
+    reference_stream_t reference = {0};
+    uint32_t expected_count = reference_write(&reference, cable, stream, len, expected);
+    char label[64];
+
+    usb_midi_packer_t whole = {0};
+    uint32_t count = usb_midi_pack(&whole, cable, stream, len, packets);
+    snprintf(label, sizeof(label), "%s, whole", name);
+    compare_packets(label, expected, expected_count, packets, count);
+    CHECK(usb_midi_packer_idle(&whole), "%s: packer not idle after the stream", label);
+
+    usb_midi_packer_t pieces = {0};
+    count = 0;
+    for (uint32_t i = 0; i < len;) {
+        uint32_t n = 1 + rng_next() % 16;
+        if (n > len - i)
+            n = len - i;
+        count += usb_midi_pack(&pieces, cable, stream + i, n, &packets[count * USB_MIDI_PACKET_LEN]);
+        i += n;
+    }
+    snprintf(label, sizeof(label), "%s, pieces", name);
+    compare_packets(label, expected, expected_count, packets, count);
+
+    usb_midi_packer_t bytes = {0};
+    count = 0;
+    for (uint32_t i = 0; i < len; i++)
+        count += usb_midi_pack(&bytes, cable, stream + i, 1, &packets[count * USB_MIDI_PACKET_LEN]);
+    snprintf(label, sizeof(label), "%s, bytewise", name);
+    compare_packets(label, expected, expected_count, packets, count);
+}
+
+static void test_pack_streams(void) {
+    static const uint8_t channel[] = {0x90, 0x3C, 0x64, 0x80, 0x3C, 0x00, 0xC5, 0x12, 0xD3, 0x40,
+                                      0xE0, 0x00, 0x40, 0xB1, 0x07, 0x7F, 0xA2, 0x3C, 0x10};
+    static const uint8_t running_status[] = {0x90, 0x3C, 0x64, 0x40, 0x64, 0x43, 0x64,
+                                             0xC0, 0x05, 0x06, 0xB0, 0x07, 0x7F, 0x0A, 0x40};
+    static const uint8_t realtime[] = {0xF8, 0xFA, 0x90, 0x3C, 0x64, 0xF8, 0xFC, 0xFE, 0xFF};
+    static const uint8_t system_common[] = {0xF1, 0x23, 0xF2, 0x10, 0x02, 0xF3, 0x05, 0xF6};
+    static const uint8_t sysex[] = {0xF0, 0xF7,                                      // empty
+                                    0xF0, 0x7E, 0xF7,                                // ends with 2
+                                    0xF0, 0x7E, 0x7F, 0xF7,                          // ends with 3
+                                    0xF0, 0x7E, 0x7F, 0x06, 0xF7,                    // ends with 1
+                                    0xF0, 0x00, 0x20, 0x29, 0x02, 0x14, 0x0F, 0xF7,  // Launchkey DAW mode
+                                    0x90, 0x3C, 0x64};
+
+    pack_like_reference("channel", 0, channel, sizeof(channel));
+    pack_like_reference("running status", 0, running_status, sizeof(running_status));
+    pack_like_reference("real-time", 0, realtime, sizeof(realtime));
+    pack_like_reference("system common", 0, system_common, sizeof(system_common));
+    pack_like_reference("sysex", 0, sysex, sizeof(sysex));
+    pack_like_reference("sysex, cable 1", 1, sysex, sizeof(sysex));
+
+    static uint8_t stream[STREAM_MAX];
+    uint32_t len = random_stream(stream, sizeof(stream), 40);
+    pack_like_reference("random", 0, stream, len);
+}
+
+// A real-time byte inside a SysEx is a packet of its own and the SysEx goes on,
+// where the TinyUSB stream parser would have packed it into the SysEx.
+static void test_pack_realtime_in_sysex(void) {
+    static const uint8_t stream[] = {0xF0, 0x01, 0xF8, 0x02, 0x03, 0x04, 0xFE, 0xF7};
+    static const uint8_t expected[] = {0x05, 0xF8, 0x00, 0x00, 0x04, 0xF0, 0x01, 0x02,
+                                       0x05, 0xFE, 0x00, 0x00, 0x07, 0x03, 0x04, 0xF7};
+    uint8_t packets[sizeof(stream) * USB_MIDI_PACKET_LEN];
+    usb_midi_packer_t packer = {0};
+    uint32_t count = 0;
+
+    for (uint32_t i = 0; i < sizeof(stream); i++) {
+        count += usb_midi_pack(&packer, 0, &stream[i], 1, &packets[count * USB_MIDI_PACKET_LEN]);
+        CHECK(usb_midi_packer_idle(&packer) == (i == sizeof(stream) - 1), "idle after byte %u", i);
+    }
+    compare_packets("real-time in sysex", expected, sizeof(expected) / USB_MIDI_PACKET_LEN, packets, count);
+}
+
+// Unpacks packet by packet, real-time bytes to one stream and the rest to the other.
+typedef struct {
+    uint8_t bytes[STREAM_MAX];
+    uint32_t len;
+    uint8_t realtime[STREAM_MAX];
+    uint32_t realtime_len;
+    uint32_t split_pieces;  // messages returned while a SysEx was split
+} unpacked_t;
+
+static void unpack_into(usb_midi_unpacker_t *unpacker, const uint8_t *packets, uint32_t count, unpacked_t *out) {
+    for (uint32_t i = 0; i < count; i++) {
+        const uint8_t *message;
+        uint32_t len = usb_midi_unpack(unpacker, &packets[i * USB_MIDI_PACKET_LEN], &message);
+
+        if (len == 1 && message[0] >= 0xF8) {
+            out->realtime[out->realtime_len++] = message[0];
+            continue;
+        }
+        if (len > 0 && !usb_midi_unpacker_idle(unpacker))
+            out->split_pieces++;
+        memcpy(&out->bytes[out->len], message, len);
+        out->len += len;
+    }
+}
+
+static void split_stream(const uint8_t *stream, uint32_t len, unpacked_t *out) {
+    for (uint32_t i = 0; i < len; i++) {
+        if (stream[i] >= 0xF8)
+            out->realtime[out->realtime_len++] = stream[i];
+        else
+            out->bytes[out->len++] = stream[i];
+    }
+}
+
+// The random streams, running status included: a data byte without its
+// status goes in a packet of its own (CIN 0xF), the unpacker has nothing to
+// hang it on and drops it. Everything else comes back.
+static void test_unpack_replay(const char *name, uint32_t sysex_max) {
+    static uint8_t stream[STREAM_MAX];
+    static uint8_t packets[PACKETS_MAX * USB_MIDI_PACKET_LEN];
+    static unpacked_t expected, unpacked;
+    static usb_midi_unpacker_t unpacker;
+    usb_midi_packer_t packer = {0};
+    uint32_t len = random_stream(stream, sizeof(stream), sysex_max);
+    uint32_t count = usb_midi_pack(&packer, 0, stream, len, packets);
+    uint32_t stray = 0;
+
+    memset(&expected, 0, sizeof(expected));
+    memset(&unpacked, 0, sizeof(unpacked));
+    memset(&unpacker, 0, sizeof(unpacker));
+    split_stream(stream, len, &expected);
+    unpack_into(&unpacker, packets, count, &unpacked);
+
+    for (uint32_t i = 0; i < count; i++) {
+        if ((packets[i * USB_MIDI_PACKET_LEN] & 0x0F) == 0xF)
+            stray++;
+    }
+    CHECK(unpacked.len + stray == expected.len, "%s: %u bytes back, %u stray, expected %u", name, unpacked.len,
+          stray, expected.len);
+    CHECK(unpacked.realtime_len == expected.realtime_len &&
+              memcmp(unpacked.realtime, expected.realtime, expected.realtime_len) == 0,
+          "%s: real-time bytes differ", name);
+    CHECK(usb_midi_unpacker_idle(&unpacker) && !unpacker.sysex, "%s: unpacker not idle after the stream", name);
+    if (sysex_max > USB_MIDI_SYSEX_MAX)
+        CHECK(unpacked.split_pieces > 0, "%s: no SysEx came out split", name);
+    else
+        CHECK(unpacked.split_pieces == 0, "%s: %u pieces of a split SysEx", name, unpacked.split_pieces);
+}
+
+// Channel and SysEx traffic as complete messages only, so nothing is stray
+// and every byte must come back in order.
+static void test_unpack_messages(void) {
+    static uint8_t stream[STREAM_MAX];
+    static uint8_t packets[PACKETS_MAX * USB_MIDI_PACKET_LEN];
+    static unpacked_t expected, unpacked;
+    static usb_midi_unpacker_t unpacker;
+    usb_midi_packer_t packer = {0};
+    uint32_t len = 0;
+
+    while (len + USB_MIDI_SYSEX_MAX * 2 + 8 < sizeof(stream)) {
+        uint32_t kind = rng_next() % 4;
+
+        if (kind == 0) {
+            uint32_t body = rng_next() % (USB_MIDI_SYSEX_MAX * 2);  // up to two pieces and a bit
+            stream[len++] = 0xF0;
+            for (uint32_t i = 0; i < body; i++) {
+                stream[len++] = data_byte();
+                if (rng_next() % 64 == 0)
+                    stream[len++] = 0xF8;  // clock inside the SysEx
+            }
+            stream[len++] = 0xF7;
+        } else if (kind == 1) {
+            stream[len++] = (uint8_t)(0xC0 | (rng_next() & 0x0F));
+            stream[len++] = data_byte();
+        } else {
+            stream[len++] = (uint8_t)(0x90 | (rng_next() & 0x0F));
+            stream[len++] = data_byte();
+            stream[len++] = data_byte();
+        }
+    }
+
+    uint32_t count = usb_midi_pack(&packer, 0, stream, len, packets);
+    memset(&expected, 0, sizeof(expected));
+    memset(&unpacked, 0, sizeof(unpacked));
+    memset(&unpacker, 0, sizeof(unpacker));
+    split_stream(stream, len, &expected);
+    unpack_into(&unpacker, packets, count, &unpacked);
+
+    CHECK(unpacked.len == expected.len && memcmp(unpacked.bytes, expected.bytes, expected.len) == 0,
+          "messages: %u bytes back, expected %u", unpacked.len, expected.len);
+    CHECK(unpacked.realtime_len == expected.realtime_len &&
+              memcmp(unpacked.realtime, expected.realtime, expected.realtime_len) == 0,
+          "messages: real-time bytes differ");
+    CHECK(unpacked.split_pieces > 0, "messages: no SysEx came out split");
+    CHECK(usb_midi_unpacker_idle(&unpacker), "messages: unpacker not idle after the stream");
+}
+
+static uint32_t unpack_bytes(usb_midi_unpacker_t *unpacker, const uint8_t *stream, uint32_t len, uint8_t *out) {
+    uint8_t packets[USB_MIDI_SYSEX_MAX * USB_MIDI_PACKET_LEN];  // a packet per byte at most
+    usb_midi_packer_t packer = {0};
+    uint32_t count = usb_midi_pack(&packer, 0, stream, len, packets);
+    uint32_t n = 0;
+
+    for (uint32_t i = 0; i < count; i++) {
+        const uint8_t *message;
+        uint32_t m = usb_midi_unpack(unpacker, &packets[i * USB_MIDI_PACKET_LEN], &message);
+        memcpy(&out[n], message, m);
+        n += m;
+    }
+    return n;
+}
+
+// What the forward path does when the UART refuses a piece of a split SysEx.
+static void test_unpack_reset(void) {
+    static usb_midi_unpacker_t unpacker;
+    uint8_t out[USB_MIDI_SYSEX_MAX * 2];
+    uint8_t head[USB_MIDI_SYSEX_MAX];
+    uint32_t n;
+
+    memset(&unpacker, 0, sizeof(unpacker));
+    head[0] = 0xF0;
+    for (uint32_t i = 1; i < sizeof(head); i++)
+        head[i] = (uint8_t)(i & 0x7F);
+
+    // The first piece of a long SysEx comes out, the unpacker is split then.
+    n = unpack_bytes(&unpacker, head, sizeof(head), out);
+    CHECK(n > 0 && out[0] == 0xF0, "reset: no first piece");
+    CHECK(!usb_midi_unpacker_idle(&unpacker) && unpacker.sysex, "reset: not split after the first piece");
+
+    usb_midi_unpacker_reset(&unpacker);
+    CHECK(usb_midi_unpacker_idle(&unpacker) && !unpacker.sysex, "reset: still in the SysEx");
+
+    // The rest of that SysEx is dropped, its end included.
+    static const uint8_t rest[] = {0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0xF7};
+    n = unpack_bytes(&unpacker, rest, sizeof(rest), out);
+    CHECK(n == 0, "reset: %u bytes of the dropped SysEx came out", n);
+
+    // Then a note and a new SysEx come through whole.
+    static const uint8_t next[] = {0x90, 0x3C, 0x64, 0xF0, 0x7E, 0x7F, 0x06, 0x01, 0xF7};
+    n = unpack_bytes(&unpacker, next, sizeof(next), out);
+    CHECK(n == sizeof(next) && memcmp(out, next, sizeof(next)) == 0, "reset: %u bytes after the reset", n);
+    CHECK(usb_midi_unpacker_idle(&unpacker), "reset: not idle after the new SysEx");
+
+    // A channel message ends an unterminated SysEx, what was held is dropped.
+    static const uint8_t cut[] = {0xF0, 0x01, 0x02, 0x03, 0x04, 0x80, 0x3C, 0x00};
+    n = unpack_bytes(&unpacker, cut, sizeof(cut), out);
+    CHECK(n == 3 && out[0] == 0x80, "cut: %u bytes, expected the note off alone", n);
+    CHECK(!unpacker.sysex, "cut: still in the SysEx");
+}
+
+int main(void) {
+    test_pack_streams();
+    test_pack_realtime_in_sysex();
+    test_unpack_replay("replay", 40);
+    test_unpack_replay("replay, long sysex", USB_MIDI_SYSEX_MAX * 2);
+    test_unpack_messages();
+    test_unpack_reset();
+
+    if (failures > 0) {
+        printf("usb_midi_packet_test: %d failed\n", failures);
+        return 1;
+    }
+    printf("usb_midi_packet_test: ok\n");
+    return 0;
+}
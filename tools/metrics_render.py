@@ -0,0 +1,147 @@
+#!/usr/bin/env python3
+#
+# metrics_render.py
+#
+# Queries the firmware metrics over USB MIDI SysEx and prints the counters
+# and histograms, e.g. at soundcheck to see how healthy the box is.
+#
+# The request is F0 7D 4F 4D 01 F7 (F0 7D 4F 4D 02 F7 resets everything),
+# the reply F0 7D 4F 4D 11 <7-bit packed snapshot> F7, see metrics.h.
+#
+# Usage:
+#   metrics_render.py --port hw:1,0     query the device through amidi
+#   metrics_render.py --port hw:1,0 --reset
+#   metrics_render.py reply.syx         render a saved reply
+
+import argparse
+import os
+import struct
+import subprocess
+import sys
+import tempfile
+
+REPLY_HEADER = bytes([0xF0, 0x7D, 0x4F, 0x4D, 0x11])
+QUERY = "F0 7D 4F 4D 01 F7"
+RESET = "F0 7D 4F 4D 02 F7"
+
+# In the order of metrics_counter_t and metrics_histogram_t.
+COUNTERS = ["HID reports", "Notes scheduled", "Note drops (scheduler full)", "Note drops (pending full)",
+            "BLE connection events", "Looper ticks", "Host MIDI transfers"]
+HISTOGRAMS = [("HID report -> MIDI out", "us"), ("Looper tick jitter", "us"), ("Note scheduler depth", "notes"),
+              ("UART TX queue", "bytes"), ("BLE packets per connection event", "packets"),
+              ("Looper tick duration", "us"), ("Host MIDI staged at flush", "bytes"),
+              ("Host MIDI transfers per second", "transfers")]
+
+BAR_WIDTH = 40
+
+
+def unpack_7bit(data):
+    out = bytearray()
+    for i in range(0, len(data), 8):
+        group = data[i:i + 8]
+        for j, byte in enumerate(group[1:]):
+            out.append(byte | (((group[0] >> j) & 1) << 7))
+    return bytes(out)
+
+
+def find_reply(data):
+    start = data.rfind(REPLY_HEADER)
+    if start < 0:
+        return None
+    end = data.find(b"\xF7", start)
+    if end < 0:
+        return None
+    return unpack_7bit(data[start + len(REPLY_HEADER):end])
+
+
+def bucket_range(b, last):
+    if b == 0:
+        return "0"
+    low = 1 << (b - 1)
+    if b == last:
+        return ">= %d" % low
+    high = (1 << b) - 1
+    return str(low) if low == high else "%d-%d" % (low, high)
+
+
+def percentile(buckets, fraction):
+    total = sum(buckets)
+    if total == 0:
+        return None
+    seen = 0
+    for b, count in enumerate(buckets):
+        seen += count
+        if seen >= total * fraction:
+            return b
+    return len(buckets) - 1
+
+
+def render(snapshot, out):
+    version, n_counters, n_histograms, n_buckets = snapshot[:4]
+    if version != 1:
+        raise ValueError("unknown metrics version %d" % version)
+    values = struct.unpack_from("<%dI" % (n_counters + n_histograms * n_buckets), snapshot, 4)
+
+    print("Counters", file=out)
+    for i in range(n_counters):
+        name = COUNTERS[i] if i < len(COUNTERS) else "counter %d" % i
+        print("  %-30s %10d" % (name, values[i]), file=out)
+
+    for h in range(n_histograms):
+        name, unit = HISTOGRAMS[h] if h < len(HISTOGRAMS) else ("histogram %d" % h, "")
+        buckets = values[n_counters + h * n_buckets:n_counters + (h + 1) * n_buckets]
+        total = sum(buckets)
+        print("", file=out)
+        print("%s (%s), %d samples" % (name, unit, total), file=out)
+        if total == 0:
+            continue
+
+        last = n_buckets - 1
+        used = [b for b, count in enumerate(buckets) if count]
+        peak = max(buckets)
+        for b in range(used[0], used[-1] + 1):
+            bar = "#" * max(1 if buckets[b] else 0, buckets[b] * BAR_WIDTH // peak)
+            print("  %12s | %-*s %d" % (bucket_range(b, last), BAR_WIDTH, bar, buckets[b]), file=out)
+        p50 = percentile(buckets, 0.5)
+        p99 = percentile(buckets, 0.99)
+        print("  p50 in %s, p99 in %s, worst in %s" % (bucket_range(p50, last), bucket_range(p99, last),
+                                                       bucket_range(used[-1], last)), file=out)
+
+
+def query(port, request):
+    with tempfile.TemporaryDirectory() as tmp:
+        path = os.path.join(tmp, "reply.syx")
+        subprocess.run(["amidi", "-p", port, "-S", request, "-r", path, "-t", "1"], check=True,
+                       stdout=subprocess.DEVNULL)
+        with open(path, "rb") as f:
+            return f.read()
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Render Orinayo metrics")
+    parser.add_argument("reply", nargs="?", help="saved SysEx reply to render")
+    parser.add_argument("--port", help="ALSA raw MIDI port of the device, e.g. hw:1,0")
+    parser.add_argument("--reset", action="store_true", help="clear the metrics on the device")
+    args = parser.parse_args()
+
+    if args.port and args.reset:
+        subprocess.run(["amidi", "-p", args.port, "-S", RESET], check=True)
+        return 0
+    if args.port:
+        data = query(args.port, QUERY)
+    elif args.reply:
+        with open(args.reply, "rb") as f:
+            data = f.read()
+    else:
+        parser.error("give a saved reply or --port")
+
+    snapshot = find_reply(data)
+    if snapshot is None:
+        print("no metrics reply found", file=sys.stderr)
+        return 1
+    render(snapshot, sys.stdout)
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,175 @@
+#!/usr/bin/env python3
+#
+# trace_decode.py
+#
+# Turns a capture of the firmware trace stream into a Chrome trace JSON file
+# that chrome://tracing or https://ui.perfetto.dev can open.
+#
+# Build the firmware with -DTRACE_ENABLED=ON. The device records nothing until
+# the computer asks for the stream with SysEx F0 7D 4F 54 01 F7 on the USB
+# MIDI port (F0 7D 4F 54 00 F7 stops it). Each record is 16 bytes, see
+# trace.h, sent 7 bits at a time in F0 7D 4F 54 10 ... F7 messages.
+#
+# Usage, with the device on ALSA port hw:1,0:
+#   amidi -p hw:1,0 -S 'F0 7D 4F 54 01 F7'
+#   amidi -p hw:1,0 -r trace.syx        (Ctrl-C to stop)
+#   amidi -p hw:1,0 -S 'F0 7D 4F 54 00 F7'
+#   trace_decode.py trace.syx -o trace.json
+#
+# Any other MIDI in the capture is skipped.
+
+import argparse
+import json
+import struct
+import sys
+
+SYSEX_HEADER = bytes([0xF0, 0x7D, 0x4F, 0x54, 0x10])
+RECORD = struct.Struct("<IBBHII")
+
+SYNC, DROPPED, TICK_BEGIN, TICK_END, NOTE_SCHEDULE, NOTE_DISPATCH, HID_REPORT, MIDI_IN, MIDI_OUT, \
+    FLASH_BEGIN, FLASH_END, GHOST_BEGIN, GHOST_END = range(13)
+
+# MIDI_SINK_* bits from midi_pipeline.h
+SINKS = {0x01: "USB device", 0x02: "USB host", 0x04: "Launchkey DAW", 0x08: "UART", 0x10: "WAV Trigger"}
+SINK_TID_BASE = 10
+
+
+def sysex_messages(data):
+    start = None
+    for i, byte in enumerate(data):
+        if byte == 0xF0:
+            start = i
+        elif byte == 0xF7 and start is not None:
+            yield data[start:i + 1]
+            start = None
+
+
+def unpack_7bit(data):
+    out = bytearray()
+    for i in range(0, len(data), 8):
+        group = data[i:i + 8]
+        msbs = group[0]
+        for j, byte in enumerate(group[1:]):
+            out.append(byte | (((msbs >> j) & 1) << 7))
+    return bytes(out)
+
+
+def records(data):
+    for msg in sysex_messages(data):
+        if not msg.startswith(SYSEX_HEADER):
+            continue
+        payload = unpack_7bit(msg[len(SYSEX_HEADER):-1])
+        for offset in range(0, len(payload) - RECORD.size + 1, RECORD.size):
+            yield RECORD.unpack_from(payload, offset)
+
+
+class CoreClock:
+    """Maps one core's 32-bit cycle counter onto microseconds."""
+
+    def __init__(self):
+        self.synced = False
+        self.cycles = 0      # unwrapped cycles of the last record
+        self.sync_cycles = 0
+        self.sync_us = 0     # unwrapped time_us_32() of the last sync
+        self.hz = 1
+
+    def advance(self, cycles):
+        self.cycles += (cycles - self.cycles) & 0xFFFFFFFF
+        return self.cycles
+
+    def sync(self, cycles, time_us, hz):
+        if self.synced:
+            self.advance(cycles)
+            self.sync_us += (time_us - self.sync_us) & 0xFFFFFFFF
+        else:
+            self.cycles = cycles
+            self.sync_us = time_us
+            self.synced = True
+        self.sync_cycles = self.cycles
+        self.hz = hz or 1
+
+    def to_us(self, cycles):
+        return self.sync_us + (self.advance(cycles) - self.sync_cycles) * 1e6 / self.hz
+
+
+def decode(data):
+    clocks = {}
+    events = []
+    skipped = 0
+    tracks = set()
+
+    for cycles, event, core, _, arg0, arg1 in records(data):
+        clock = clocks.setdefault(core, CoreClock())
+        if event == SYNC:
+            clock.sync(cycles, arg0, arg1)
+            continue
+        if not clock.synced:
+            skipped += 1
+            continue
+
+        ts = clock.to_us(cycles)
+        tid = core
+        tracks.add((tid, "core %d" % core))
+        common = {"ts": ts, "pid": 0, "tid": tid}
+
+        if event in (TICK_BEGIN, TICK_END):
+            events.append(dict(common, name="tick", ph="B" if event == TICK_BEGIN else "E", args={"step": arg0}))
+        elif event in (GHOST_BEGIN, GHOST_END):
+            events.append(dict(common, name="ghost notes", ph="B" if event == GHOST_BEGIN else "E",
+                               args={"step": arg0}))
+        elif event in (FLASH_BEGIN, FLASH_END):
+            name = "flash erase" if arg0 else "flash program"
+            events.append(dict(common, name=name, ph="B" if event == FLASH_BEGIN else "E",
+                               args={"offset": hex(arg1)}))
+        elif event == NOTE_SCHEDULE:
+            events.append(dict(common, name="note schedule", ph="i", s="t",
+                               args={"channel": arg0 >> 8, "note": arg0 & 0xFF, "due_us": arg1}))
+        elif event == NOTE_DISPATCH:
+            events.append(dict(common, name="note dispatch", ph="i", s="t",
+                               args={"channel": arg0 >> 8, "note": arg0 & 0xFF, "velocity": arg1}))
+        elif event == HID_REPORT:
+            events.append(dict(common, name="HID report", ph="i", s="t", args={"buttons": hex(arg0)}))
+        elif event in (MIDI_IN, MIDI_OUT):
+            sink = SINKS.get(arg0, hex(arg0))
+            direction = "in" if event == MIDI_IN else "out"
+            tid = SINK_TID_BASE + arg0.bit_length()
+            tracks.add((tid, "MIDI %s" % sink))
+            if event == MIDI_IN:
+                args = {"byte": hex(arg1)}
+            else:
+                args = {"status": hex(arg1 & 0xFF), "len": arg1 >> 8}
+            events.append(dict(common, tid=tid, name="MIDI %s" % direction, ph="i", s="t", args=args))
+        elif event == DROPPED:
+            events.append(dict(common, name="dropped", ph="i", s="p", args={"records": arg0}))
+
+    for tid, name in sorted(tracks):
+        events.append({"name": "thread_name", "ph": "M", "pid": 0, "tid": tid, "args": {"name": name}})
+    events.append({"name": "process_name", "ph": "M", "pid": 0, "args": {"name": "Orinayo"}})
+    return events, skipped
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Decode an Orinayo trace capture to Chrome trace JSON")
+    parser.add_argument("capture", help="raw MIDI capture, e.g. from amidi -r ('-' for stdin)")
+    parser.add_argument("-o", "--output", help="JSON file to write (default: stdout)")
+    args = parser.parse_args()
+
+    if args.capture == "-":
+        data = sys.stdin.buffer.read()
+    else:
+        with open(args.capture, "rb") as f:
+            data = f.read()
+
+    events, skipped = decode(data)
+    if skipped:
+        print("%d records before the first sync point skipped" % skipped, file=sys.stderr)
+
+    out = open(args.output, "w") if args.output else sys.stdout
+    json.dump({"traceEvents": events, "displayTimeUnit": "ms"}, out)
+    if args.output:
+        out.close()
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,159 @@
+/**
+ * Hot-path tracing
+ *
+ * TRACE() writes a fixed 16-byte record with the DWT cycle counter, an event
+ * id and two arguments into a RAM ring owned by the recording core. Nothing
+ * is formatted on the device: core 1 packs the records 7 bits at a time into
+ * SysEx messages on the USB MIDI device port, and tools/trace_decode.py turns
+ * a capture into a Chrome trace / Perfetto timeline.
+ *
+ * Recording only runs while the computer has asked for the stream, so the
+ * rings never hold stale records. Every core starts with a sync record that
+ * pairs its cycle counter with the microsecond timer, and writes another one
+ * before the counter could wrap unnoticed between two records.
+ *
+ * Build with -DTRACE_ENABLED=ON; without it TRACE() compiles to nothing.
+ */
+#include "trace.h"
+
+#ifdef TRACE_ENABLED
+
+#include "hardware/clocks.h"
+#include "hardware/structs/m33.h"
+#include "hardware/sync.h"
+#include "pico/platform.h"
+#include "pico/time.h"
+
+#include "sysex.h"
+
+#define TRACE_RING_LEN 256
+#define TRACE_CORES    2
+#define TRACE_SYSEX_RECORDS_PER_MSG 8
+#define TRACE_SYNC_INTERVAL_CYCLES  0x40000000u
+
+#define TRACE_SYSEX_MAX_LEN \
+    (SYSEX_HEADER_LEN + SYSEX_PACKED_LEN(TRACE_SYSEX_RECORDS_PER_MSG * sizeof(trace_record_t)) + 1)
+
+typedef struct {
+    trace_record_t records[TRACE_RING_LEN];
+    volatile uint32_t head;  // advanced by core 1
+    volatile uint32_t tail;  // advanced by the recording core
+    uint32_t last_cycles;
+    uint32_t dropped;
+    volatile bool need_sync;
+} trace_ring_t;
+
+static trace_ring_t rings[TRACE_CORES];
+static uint32_t sys_hz;
+static volatile bool streaming = false;
+
+static uint8_t message[TRACE_SYSEX_MAX_LEN];
+static uint32_t message_len;
+static uint32_t message_pos;
+
+void trace_init_core(void) {
+    m33_hw->demcr |= M33_DEMCR_TRCENA_BITS;
+    m33_hw->dwt_cyccnt = 0;
+    m33_hw->dwt_ctrl |= M33_DWT_CTRL_CYCCNTENA_BITS;
+
+    sys_hz = clock_get_hz(clk_sys);
+    rings[get_core_num()].need_sync = true;
+}
+
+static inline bool ring_put(trace_ring_t *ring, uint32_t cycles, uint8_t event, uint32_t arg0, uint32_t arg1) {
+    uint32_t tail = ring->tail;
+
+    if (tail - ring->head == TRACE_RING_LEN)
+        return false;
+
+    trace_record_t *record = &ring->records[tail % TRACE_RING_LEN];
+    record->cycles = cycles;
+    record->event = event;
+    record->core = (uint8_t)get_core_num();
+    record->reserved = 0;
+    record->arg0 = arg0;
+    record->arg1 = arg1;
+    __dmb();
+    ring->tail = tail + 1;
+    return true;
+}
+
+// In RAM: also called around flash operations, with XIP disabled.
+void __not_in_flash_func(trace_record)(trace_event_t event, uint32_t arg0, uint32_t arg1) {
+    if (!streaming)
+        return;
+
+    trace_ring_t *ring = &rings[get_core_num()];
+    uint32_t save = save_and_disable_interrupts();
+    uint32_t cycles = m33_hw->dwt_cyccnt;
+
+    // A sync point keeps the decoder's cycle unwrapping unambiguous.
+    if (ring->need_sync || cycles - ring->last_cycles >= TRACE_SYNC_INTERVAL_CYCLES) {
+        if (ring_put(ring, cycles, TRACE_SYNC, time_us_32(), sys_hz))
+            ring->need_sync = false;
+    }
+    if (ring->dropped > 0 && ring_put(ring, cycles, TRACE_DROPPED, ring->dropped, 0))
+        ring->dropped = 0;
+
+    if (ring->dropped > 0 || !ring_put(ring, cycles, (uint8_t)event, arg0, arg1))
+        ring->dropped++;
+    ring->last_cycles = cycles;
+
+    restore_interrupts(save);
+}
+
+void trace_request(uint8_t cmd) {
+    if (cmd == TRACE_SYSEX_START && !streaming) {
+        for (int i = 0; i < TRACE_CORES; i++)
+            rings[i].need_sync = true;
+        streaming = true;
+    } else if (cmd == TRACE_SYSEX_STOP) {
+        streaming = false;
+    }
+}
+
+static uint32_t build_message(void) {
+    trace_record_t batch[TRACE_SYSEX_RECORDS_PER_MSG];
+    uint32_t count = 0;
+
+    for (int i = 0; i < TRACE_CORES && count < TRACE_SYSEX_RECORDS_PER_MSG; i++) {
+        trace_ring_t *ring = &rings[i];
+        uint32_t head = ring->head;
+
+        while (head != ring->tail && count < TRACE_SYSEX_RECORDS_PER_MSG) {
+            __dmb();
+            batch[count++] = ring->records[head % TRACE_RING_LEN];
+            head++;
+        }
+        __dmb();
+        ring->head = head;
+    }
+    if (count == 0)
+        return 0;
+
+    uint32_t len = sysex_header(message, SYSEX_TRACE, TRACE_SYSEX_RECORDS);
+    len += sysex_pack_7bit(&message[len], (const uint8_t *)batch, count * sizeof(trace_record_t));
+    message[len++] = 0xF7;
+    return len;
+}
+
+uint32_t trace_stream_peek(const uint8_t **data) {
+    // A message already started is always finished, even after a stop request.
+    if (message_pos == message_len) {
+        message_pos = 0;
+        message_len = streaming ? build_message() : 0;
+    }
+
+    *data = &message[message_pos];
+    return message_len - message_pos;
+}
+
+void trace_stream_consume(uint32_t len) {
+    message_pos += len;
+}
+
+bool trace_stream_open(void) {
+    return message_pos != 0 && message_pos < message_len;
+}
+
+#endif  // TRACE_ENABLED
@@ -0,0 +1,69 @@
+#ifndef TRACE_H_
+#define TRACE_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Trace records streamed as SysEx: F0 7D 4F 54 <cmd> ... F7, see sysex.h
+#define TRACE_SYSEX_STOP    0x00  // host -> device
+#define TRACE_SYSEX_START   0x01  // host -> device
+#define TRACE_SYSEX_RECORDS 0x10  // device -> host, 7-bit packed records
+
+typedef enum {
+    TRACE_SYNC = 0,       // arg0: time_us_32(), arg1: clk_sys in Hz
+    TRACE_DROPPED,        // arg0: records lost while the ring was full
+    TRACE_TICK_BEGIN,     // arg0: step
+    TRACE_TICK_END,
+    TRACE_NOTE_SCHEDULE,  // arg0: channel << 8 | note, arg1: due time_us_32()
+    TRACE_NOTE_DISPATCH,  // arg0: channel << 8 | note, arg1: velocity
+    TRACE_HID_REPORT,     // arg0: buttons
+    TRACE_MIDI_IN,        // arg0: MIDI_SINK_* it came from, arg1: byte
+    TRACE_MIDI_OUT,       // arg0: MIDI_SINK_*, arg1: len << 8 | first byte
+    TRACE_FLASH_BEGIN,    // arg0: 1 erase, 0 program, arg1: flash offset
+    TRACE_FLASH_END,
+    TRACE_GHOST_BEGIN,    // arg0: step, ghost_note_maintenance_step()
+    TRACE_GHOST_END,
+} trace_event_t;
+
+// Fixed-size record, written as is into the per-core RAM ring.
+typedef struct {
+    uint32_t cycles;  // DWT cycle counter of the recording core
+    uint8_t event;
+    uint8_t core;
+    uint16_t reserved;
+    uint32_t arg0;
+    uint32_t arg1;
+} trace_record_t;
+
+#ifdef TRACE_ENABLED
+
+#define TRACE(event, arg0, arg1) trace_record((event), (uint32_t)(arg0), (uint32_t)(arg1))
+
+// Each core: start its cycle counter and record a sync point.
+void trace_init_core(void);
+
+void trace_record(trace_event_t event, uint32_t arg0, uint32_t arg1);
+
+// Core 1: a trace SysEx request from the computer.
+void trace_request(uint8_t cmd);
+
+// Core 1: pending bytes of the SysEx stream, consume what the transport took.
+uint32_t trace_stream_peek(const uint8_t **data);
+void trace_stream_consume(uint32_t len);
+
+// Core 1: a message is partly taken, nothing else may go between its bytes.
+bool trace_stream_open(void);
+
+#else
+
+#define TRACE(event, arg0, arg1) ((void)0)
+
+static inline void trace_init_core(void) {}
+static inline void trace_request(uint8_t cmd) { (void)cmd; }
+static inline uint32_t trace_stream_peek(const uint8_t **data) { (void)data; return 0; }
+static inline void trace_stream_consume(uint32_t len) { (void)len; }
+static inline bool trace_stream_open(void) { return false; }
+
+#endif
+
+#endif  // TRACE_H_
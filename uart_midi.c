@@ -0,0 +1,402 @@
+/**
+ * UART MIDI
+ *
+ * Received bytes are moved from the UART FIFO into a ring buffer by the RX
+ * interrupt, so a slow pass of the main loop no longer overruns the 32-byte
+ * hardware FIFO. The interrupt fires at the FIFO threshold or after the line
+ * was idle for 32 bit periods; every byte gets its arrival time estimated
+ * back from the interrupt by its position in the FIFO.
+ *
+ * Transmission is fed by DMA from a ring buffer per UART. The DMA is paced
+ * by a DMA timer slightly below the byte rate of the line, so the hardware
+ * FIFO never runs ahead and a real-time byte written straight to the data
+ * register goes out after at most a few bytes. The DMA cannot see a full
+ * FIFO, so such bypass bytes are limited to what the pacing slack drains
+ * again; beyond that they queue in order. Channel messages are
+ * sent with running status, which saves a third of the bytes of a run of
+ * notes on one channel.
+ */
+#include "uart_midi.h"
+
+#include <string.h>
+
+#include "hardware/clocks.h"
+#include "hardware/dma.h"
+#include "hardware/irq.h"
+#include "hardware/sync.h"
+#include "pico/sync.h"
+#include "pico/time.h"
+
+#include "event_loop.h"
+#include "midi_pipeline.h"
+#include "trace.h"
+
+#define UART_MIDI_RX_RING_LEN   256
+#define UART_MIDI_RX_FIFO_DEPTH 32
+#define UART_MIDI_TX_RING_LEN   512
+#define UART_MIDI_TX_PACE_PERCENT 97  // the rest is left for real-time bypass bytes
+#define UART_MIDI_TX_BYPASS_MAX   8   // bypass bytes above the paced stream in the FIFO
+// Running status is restarted after a pause, for receivers switched on meanwhile.
+#define UART_MIDI_TX_STATUS_REFRESH_US 250000
+
+static uart_inst_t *rx_uart;
+static uint32_t rx_char_us;     // one start + 8 data + one stop bit
+static uint32_t rx_timeout_us;  // receive timeout, 32 bit periods
+
+static uint8_t rx_bytes[UART_MIDI_RX_RING_LEN];
+static uint32_t rx_timestamps[UART_MIDI_RX_RING_LEN];
+static volatile uint32_t rx_head = 0;  // advanced by the main loop
+static volatile uint32_t rx_tail = 0;  // advanced by the interrupt
+
+static uart_midi_rx_stats_t rx_stats;
+
+static void uart_midi_rx_irq_handler(void) {
+    uart_hw_t *hw = uart_get_hw(rx_uart);
+    uint32_t now = time_us_32();
+    bool timeout = (hw->mis & UART_UARTMIS_RTMIS_BITS) != 0;
+    uint32_t data[UART_MIDI_RX_FIFO_DEPTH];
+    uint32_t count = 0;
+
+    while (count < UART_MIDI_RX_FIFO_DEPTH && !(hw->fr & UART_UARTFR_RXFE_BITS))
+        data[count++] = hw->dr;
+    hw->icr = UART_UARTICR_RTIC_BITS | UART_UARTICR_RXIC_BITS;
+
+    // The last byte completed just now, or a receive timeout ago; the ones
+    // before it one character time apart.
+    uint32_t last_us = now - (timeout ? rx_timeout_us : 0);
+    bool queued = false;
+
+    for (uint32_t i = 0; i < count; i++) {
+        uint32_t dr = data[i];
+
+        if (dr & UART_UARTDR_OE_BITS)
+            rx_stats.overruns++;
+        if (dr & UART_UARTDR_BE_BITS) {
+            rx_stats.breaks++;
+            continue;
+        }
+        if (dr & UART_UARTDR_FE_BITS) {
+            rx_stats.framing_errors++;
+            continue;
+        }
+        if (dr & UART_UARTDR_PE_BITS) {
+            rx_stats.parity_errors++;
+            continue;
+        }
+
+        uint32_t tail = rx_tail;
+        uint32_t used = tail - rx_head;
+        if (used == UART_MIDI_RX_RING_LEN) {
+            rx_stats.dropped++;
+            continue;
+        }
+
+        rx_bytes[tail % UART_MIDI_RX_RING_LEN] = (uint8_t)dr;
+        rx_timestamps[tail % UART_MIDI_RX_RING_LEN] = last_us - (count - 1 - i) * rx_char_us;
+        __dmb();
+        rx_tail = tail + 1;
+        TRACE(TRACE_MIDI_IN, MIDI_SINK_UART, dr & 0xFF);
+
+        rx_stats.bytes++;
+        if (used + 1 > rx_stats.high_water)
+            rx_stats.high_water = used + 1;
+        queued = true;
+    }
+
+    if (queued)
+        event_loop_signal(EVENT_LOOP_UART_RX);
+}
+
+void uart_midi_rx_init(uart_inst_t *uart, uint baudrate) {
+    rx_uart = uart;
+    rx_char_us = 10000000u / baudrate;
+    rx_timeout_us = 32000000u / baudrate;
+
+    uint irq_num = UART0_IRQ + uart_get_index(uart);
+    irq_set_exclusive_handler(irq_num, uart_midi_rx_irq_handler);
+    // Short handler, run it ahead of the radio so the FIFO cannot overflow.
+    irq_set_priority(irq_num, PICO_HIGHEST_IRQ_PRIORITY);
+    irq_set_enabled(irq_num, true);
+    uart_set_irq_enables(uart, true, false);
+}
+
+bool uart_midi_rx_pop(uint8_t *byte, uint32_t *timestamp_us) {
+    uint32_t head = rx_head;
+
+    if (head == rx_tail)
+        return false;
+
+    __dmb();
+    *byte = rx_bytes[head % UART_MIDI_RX_RING_LEN];
+    uint32_t timestamp = rx_timestamps[head % UART_MIDI_RX_RING_LEN];
+    __dmb();
+    rx_head = head + 1;
+
+    uint32_t delay = time_us_32() - timestamp;
+    if (delay > rx_stats.max_parse_delay_us)
+        rx_stats.max_parse_delay_us = delay;
+    if (timestamp_us != NULL)
+        *timestamp_us = timestamp;
+    return true;
+}
+
+void uart_midi_rx_get_stats(uart_midi_rx_stats_t *stats) {
+    *stats = rx_stats;
+}
+
+typedef struct {
+    uart_inst_t *uart;
+    int dma_chan;
+    critical_section_t cs;
+    uint8_t ring[UART_MIDI_TX_RING_LEN];
+    uint32_t head;        // advanced when a DMA transfer completes
+    uint32_t tail;
+    uint32_t in_flight;   // bytes of the running DMA transfer
+    uint32_t char_us;
+    uint32_t bypass_us;       // the pacing slack drains a bypass byte in this time
+    uint32_t bypass_clear_us; // the bypass bytes so far are drained by then
+    bool paced;               // by the DMA timer, not the UART request
+    uint8_t running_status;
+    uint32_t last_write_us;
+    uart_midi_tx_stats_t stats;
+} uart_midi_tx_t;
+
+static uart_midi_tx_t tx_state[NUM_UARTS];
+
+static void tx_start_locked(uart_midi_tx_t *tx) {
+    if (tx->in_flight > 0 || tx->head == tx->tail)
+        return;
+
+    uint32_t offset = tx->head % UART_MIDI_TX_RING_LEN;
+    uint32_t n = tx->tail - tx->head;
+    if (n > UART_MIDI_TX_RING_LEN - offset)
+        n = UART_MIDI_TX_RING_LEN - offset;
+
+    tx->in_flight = n;
+    dma_channel_transfer_from_buffer_now(tx->dma_chan, &tx->ring[offset], n);
+}
+
+static void uart_midi_tx_dma_irq_handler(void) {
+    for (int i = 0; i < NUM_UARTS; i++) {
+        uart_midi_tx_t *tx = &tx_state[i];
+
+        if (tx->uart == NULL || !dma_irqn_get_channel_status(1, tx->dma_chan))
+            continue;
+        dma_irqn_acknowledge_channel(1, tx->dma_chan);
+
+        critical_section_enter_blocking(&tx->cs);
+        tx->head += tx->in_flight;
+        tx->in_flight = 0;
+        tx_start_locked(tx);
+        critical_section_exit(&tx->cs);
+    }
+}
+
+void uart_midi_tx_init(uart_inst_t *uart, uint baudrate) {
+    uart_midi_tx_t *tx = &tx_state[uart_get_index(uart)];
+    uint32_t byte_rate = baudrate / 10;
+    uint32_t sys_hz = clock_get_hz(clk_sys);
+
+    critical_section_init(&tx->cs);
+    tx->char_us = 10000000u / baudrate;
+    tx->bypass_us = tx->char_us * 100 / (100 - UART_MIDI_TX_PACE_PERCENT);
+    tx->bypass_clear_us = time_us_32();
+    tx->dma_chan = dma_claim_unused_channel(true);
+
+    dma_channel_config config = dma_channel_get_default_config(tx->dma_chan);
+    channel_config_set_transfer_data_size(&config, DMA_SIZE_8);
+    channel_config_set_read_increment(&config, true);
+    channel_config_set_write_increment(&config, false);
+
+    // Pace below the byte rate of the line; too slow a line for the timer
+    // fraction falls back to the UART request, which fills the FIFO.
+    uint32_t denominator =
+        (uint32_t)(((uint64_t)sys_hz * 100) / ((uint64_t)byte_rate * UART_MIDI_TX_PACE_PERCENT));
+    int timer = denominator <= 0xFFFF ? dma_claim_unused_timer(false) : -1;
+    if (timer >= 0) {
+        dma_timer_set_fraction(timer, 1, (uint16_t)denominator);
+        channel_config_set_dreq(&config, dma_get_timer_dreq(timer));
+        tx->paced = true;
+    } else {
+        channel_config_set_dreq(&config, uart_get_dreq(uart, true));
+    }
+
+    dma_channel_configure(tx->dma_chan, &config, &uart_get_hw(uart)->dr, NULL, 0, false);
+
+    dma_irqn_set_channel_enabled(1, tx->dma_chan, true);
+    irq_add_shared_handler(DMA_IRQ_1, uart_midi_tx_dma_irq_handler, PICO_SHARED_IRQ_HANDLER_DEFAULT_ORDER_PRIORITY);
+    irq_set_enabled(DMA_IRQ_1, true);
+
+    tx->uart = uart;
+}
+
+static uart_midi_tx_t *tx_get(uart_inst_t *uart) {
+    uart_midi_tx_t *tx = &tx_state[uart_get_index(uart)];
+    return tx->uart != NULL ? tx : NULL;
+}
+
+static void tx_put_locked(uart_midi_tx_t *tx, uint8_t byte) {
+    tx->ring[tx->tail % UART_MIDI_TX_RING_LEN] = byte;
+    tx->tail++;
+    tx->stats.bytes_out++;
+}
+
+static bool tx_reserve_locked(uart_midi_tx_t *tx, uint32_t len) {
+    uint32_t used = tx->tail - tx->head;
+
+    if (used + len > UART_MIDI_TX_RING_LEN) {
+        tx->stats.dropped++;
+        return false;
+    }
+    return true;
+}
+
+static void tx_finish_locked(uart_midi_tx_t *tx, uint32_t now) {
+    uint32_t used = tx->tail - tx->head;
+
+    if (used > tx->stats.high_water)
+        tx->stats.high_water = used;
+    tx->last_write_us = now;
+    tx_start_locked(tx);
+}
+
+// A real-time byte may go straight to the FIFO: it has room, and the paced
+// DMA will not fill it meanwhile. A DMA on the UART request keeps the FIFO
+// full, a byte written between its requests would be lost.
+static bool tx_bypass_locked(uart_midi_tx_t *tx, uart_hw_t *hw, uint32_t now) {
+    if (hw->fr & UART_UARTFR_TXFE_BITS)
+        tx->bypass_clear_us = now;
+    if (hw->fr & UART_UARTFR_TXFF_BITS)
+        return false;
+    if (tx->in_flight > 0 && !tx->paced)
+        return false;
+
+    int32_t excess_us = (int32_t)(tx->bypass_clear_us - now);
+    if (excess_us < 0)
+        excess_us = 0;
+    if ((uint32_t)excess_us + tx->bypass_us > UART_MIDI_TX_BYPASS_MAX * tx->bypass_us)
+        return false;
+    tx->bypass_clear_us = now + excess_us + tx->bypass_us;
+    return true;
+}
+
+bool uart_midi_tx_write(uart_inst_t *uart, const uint8_t *buffer, uint32_t len) {
+    uart_midi_tx_t *tx = tx_get(uart);
+    uart_hw_t *hw = uart_get_hw(uart);
+    uint32_t now = time_us_32();
+
+    if (tx == NULL || buffer == NULL)
+        return false;
+
+    critical_section_enter_blocking(&tx->cs);
+
+    if (!tx_reserve_locked(tx, len)) {
+        critical_section_exit(&tx->cs);
+        return false;
+    }
+
+    if (now - tx->last_write_us >= UART_MIDI_TX_STATUS_REFRESH_US)
+        tx->running_status = 0;
+
+    for (uint32_t i = 0; i < len; i++) {
+        uint8_t b = buffer[i];
+        tx->stats.bytes_in++;
+
+        if (b >= 0xF8) {
+            // Real-time bytes may go anywhere in the stream, the paced DMA
+            // keeps the FIFO short so this one is close to next on the wire.
+            if (tx_bypass_locked(tx, hw, now)) {
+                hw->dr = b;
+                tx->stats.realtime_bypass++;
+            } else {
+                tx_put_locked(tx, b);
+            }
+            continue;
+        }
+
+        if (b >= 0xF0) {
+            // System exclusive and system common cancel running status.
+            tx->running_status = 0;
+        } else if (b >= 0x80) {
+            if (b == tx->running_status) {
+                tx->stats.status_saved++;
+                continue;
+            }
+            tx->running_status = b;
+        }
+        tx_put_locked(tx, b);
+    }
+
+    tx_finish_locked(tx, now);
+    critical_section_exit(&tx->cs);
+    return true;
+}
+
+bool uart_midi_tx_write_raw(uart_inst_t *uart, const uint8_t *buffer, uint32_t len) {
+    uart_midi_tx_t *tx = tx_get(uart);
+
+    if (tx == NULL || buffer == NULL)
+        return false;
+
+    critical_section_enter_blocking(&tx->cs);
+
+    if (!tx_reserve_locked(tx, len)) {
+        critical_section_exit(&tx->cs);
+        return false;
+    }
+
+    for (uint32_t i = 0; i < len; i++)
+        tx_put_locked(tx, buffer[i]);
+    tx->stats.bytes_in += len;
+    tx->running_status = 0;
+
+    tx_finish_locked(tx, time_us_32());
+    critical_section_exit(&tx->cs);
+    return true;
+}
+
+uint32_t uart_midi_tx_queued(uart_inst_t *uart) {
+    uart_midi_tx_t *tx = tx_get(uart);
+
+    return tx != NULL ? tx->tail - tx->head : 0;
+}
+
+uint32_t uart_midi_tx_free(uart_inst_t *uart) {
+    uart_midi_tx_t *tx = tx_get(uart);
+
+    return tx != NULL ? UART_MIDI_TX_RING_LEN - (tx->tail - tx->head) : 0;
+}
+
+uint32_t uart_midi_tx_backlog_us(uart_inst_t *uart) {
+    uart_midi_tx_t *tx = tx_get(uart);
+
+    if (tx == NULL)
+        return 0;
+
+    // Bytes of the running transfer the DMA already moved on are in the FIFO,
+    // at most a few ahead of the line at the paced rate.
+    critical_section_enter_blocking(&tx->cs);
+    uint32_t queued = tx->tail - tx->head;
+    if (tx->in_flight > 0) {
+        uint32_t remaining = dma_channel_hw_addr(tx->dma_chan)->transfer_count;
+#ifdef DMA_CH0_TRANS_COUNT_COUNT_BITS
+        remaining &= DMA_CH0_TRANS_COUNT_COUNT_BITS;  // the top bits hold the trigger mode
+#endif
+        if (remaining < tx->in_flight)
+            queued -= tx->in_flight - remaining;
+    }
+    critical_section_exit(&tx->cs);
+    return queued * tx->char_us;
+}
+
+void uart_midi_tx_get_stats(uart_inst_t *uart, uart_midi_tx_stats_t *stats) {
+    uart_midi_tx_t *tx = &tx_state[uart_get_index(uart)];
+
+    if (tx->uart == NULL) {
+        memset(stats, 0, sizeof(*stats));
+        return;
+    }
+    critical_section_enter_blocking(&tx->cs);
+    *stats = tx->stats;
+    critical_section_exit(&tx->cs);
+}
@@ -0,0 +1,59 @@
+#ifndef UART_MIDI_H_
+#define UART_MIDI_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "hardware/uart.h"
+
+typedef struct {
+    uint32_t bytes;             // bytes received
+    uint32_t overruns;          // hardware FIFO overflowed, bytes lost
+    uint32_t framing_errors;    // byte dropped, bad stop bit
+    uint32_t parity_errors;     // byte dropped
+    uint32_t breaks;            // line held low
+    uint32_t dropped;           // ring buffer full
+    uint32_t high_water;        // ring buffer high-water mark
+    uint32_t max_parse_delay_us;  // arrival -> handed to the parser
+} uart_midi_rx_stats_t;
+
+// Call after uart_init(), the RX interrupt is handled on the calling core.
+void uart_midi_rx_init(uart_inst_t *uart, uint baudrate);
+
+// Main loop: next received byte and the time it arrived on the wire.
+bool uart_midi_rx_pop(uint8_t *byte, uint32_t *timestamp_us);
+
+void uart_midi_rx_get_stats(uart_midi_rx_stats_t *stats);
+
+typedef struct {
+    uint32_t bytes_in;          // MIDI bytes written
+    uint32_t bytes_out;         // bytes queued for the wire
+    uint32_t status_saved;      // status bytes left out by running status
+    uint32_t realtime_bypass;   // real-time bytes written ahead of the queue
+    uint32_t dropped;           // writes refused, ring buffer full
+    uint32_t high_water;        // ring buffer high-water mark
+} uart_midi_tx_stats_t;
+
+// Call after uart_init(), the DMA interrupt is handled on the calling core.
+void uart_midi_tx_init(uart_inst_t *uart, uint baudrate);
+
+// Queue a MIDI byte stream. Status bytes repeating the running status are left
+// out and real-time bytes go out ahead of anything queued, as far as the DMA
+// pacing leaves room for them. A write is queued whole or dropped.
+bool uart_midi_tx_write(uart_inst_t *uart, const uint8_t *buffer, uint32_t len);
+
+// Queue bytes unchanged, running status starts over afterwards.
+bool uart_midi_tx_write_raw(uart_inst_t *uart, const uint8_t *buffer, uint32_t len);
+
+// Bytes in the ring not yet handed to the DMA.
+uint32_t uart_midi_tx_queued(uart_inst_t *uart);
+
+// Bytes a write can queue now.
+uint32_t uart_midi_tx_free(uart_inst_t *uart);
+
+// Time until the bytes queued so far have left the wire.
+uint32_t uart_midi_tx_backlog_us(uart_inst_t *uart);
+
+void uart_midi_tx_get_stats(uart_inst_t *uart, uart_midi_tx_stats_t *stats);
+
+#endif  // UART_MIDI_H_
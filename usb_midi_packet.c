@@ -0,0 +1,195 @@
+/**
+ * USB-MIDI event packets
+ *
+ * Our messages are complete when they are written, so they are packed into
+ * 4-byte USB-MIDI event packets by their status byte, a whole message at a
+ * time, rather than fed byte by byte through the TinyUSB stream parser. The
+ * packets of a pass then go to the endpoint FIFO in one call.
+ *
+ * A message may still span writes: the pipeline splits a long SysEx into
+ * chunks, and MIDI passed through from the DIN and BLE inputs arrives a byte
+ * at a time. Up to two bytes wait for the rest of their packet, as in the
+ * TinyUSB stream parser.
+ *
+ * Packets from the computer go the other way, to the DIN port: the code
+ * index number says how many of the three bytes are MIDI, and SysEx is put
+ * back together so it can be merged with our own messages as one.
+ */
+#include "usb_midi_packet.h"
+
+// MIDI bytes per code index number, USB-MIDI 1.0 table 4-1.
+static const uint8_t cin_size[16] = {0, 0, 2, 3, 3, 1, 2, 3, 3, 3, 3, 3, 2, 2, 3, 1};
+
+static uint8_t message_len(uint8_t status) {
+    switch (status >> 4) {
+        case 0x8: case 0x9: case 0xA: case 0xB: case 0xE:
+            return 3;
+        case 0xC: case 0xD:
+            return 2;
+        default:
+            break;
+    }
+    switch (status) {
+        case 0xF1: case 0xF3:
+            return 2;
+        case 0xF2:
+            return 3;
+        default:
+            return 1;  // tune request, undefined
+    }
+}
+
+static uint8_t message_cin(uint8_t status, uint8_t len) {
+    if (status < 0xF0)
+        return status >> 4;
+    if (len == 1)
+        return 0x5;  // single-byte system common
+    return len;      // 0x2 and 0x3, two- and three-byte system common
+}
+
+static inline uint8_t *emit(uint8_t *packet, uint8_t header, uint8_t b1, uint8_t b2, uint8_t b3) {
+    packet[0] = header;
+    packet[1] = b1;
+    packet[2] = b2;
+    packet[3] = b3;
+    return packet + USB_MIDI_PACKET_LEN;
+}
+
+uint32_t usb_midi_pack(usb_midi_packer_t *packer, uint8_t cable, const uint8_t *data, uint32_t len,
+                       uint8_t *packets) {
+    uint8_t *out = packets;
+    uint8_t cn = (uint8_t)(cable << 4);
+
+    for (uint32_t i = 0; i < len; i++) {
+        uint8_t byte = data[i];
+
+        // Real-time bytes are a packet of their own, even inside a message,
+        // with the single-byte code TinyUSB has always sent them with.
+        if (byte >= 0xF8) {
+            out = emit(out, cn | 0x5, byte, 0, 0);
+            continue;
+        }
+
+        if (packer->sysex) {
+            if (byte == 0xF7) {
+                // SysEx ends with 1, 2 or 3 bytes
+                packer->held[packer->held_len++] = byte;
+                out = emit(out, cn | (0x4 + packer->held_len), packer->held[0],
+                           packer->held_len > 1 ? packer->held[1] : 0, packer->held_len > 2 ? packer->held[2] : 0);
+                packer->sysex = false;
+                packer->held_len = 0;
+                continue;
+            }
+            if (byte < 0x80) {
+                packer->held[packer->held_len++] = byte;
+                if (packer->held_len == 3) {
+                    out = emit(out, cn | 0x4, packer->held[0], packer->held[1], packer->held[2]);
+                    packer->held_len = 0;
+                }
+                continue;
+            }
+            // A status byte ends an unterminated SysEx, what is held is dropped.
+            packer->sysex = false;
+            packer->held_len = 0;
+        }
+
+        if (byte == 0xF0) {
+            packer->sysex = true;
+            packer->held[0] = byte;
+            packer->held_len = 1;
+            packer->expected = 0;
+            continue;
+        }
+
+        if (byte >= 0x80) {
+            // A status byte starts a message, one left unfinished is dropped.
+            uint8_t n = message_len(byte);
+            if (n == 1) {
+                out = emit(out, cn | message_cin(byte, 1), byte, 0, 0);
+                packer->expected = 0;
+            } else {
+                packer->held[0] = byte;
+                packer->held_len = 1;
+                packer->expected = n;
+            }
+            continue;
+        }
+
+        if (packer->expected == 0) {
+            // Without a status there is nothing to pack it with.
+            out = emit(out, cn | 0xF, byte, 0, 0);
+            continue;
+        }
+
+        packer->held[packer->held_len++] = byte;
+        if (packer->held_len == packer->expected) {
+            out = emit(out, cn | message_cin(packer->held[0], packer->expected), packer->held[0], packer->held[1],
+                       packer->expected > 2 ? packer->held[2] : 0);
+            packer->expected = 0;
+            packer->held_len = 0;
+        }
+    }
+    return (uint32_t)(out - packets) / USB_MIDI_PACKET_LEN;
+}
+
+uint8_t usb_midi_packet_size(const uint8_t packet[USB_MIDI_PACKET_LEN]) {
+    return cin_size[packet[0] & 0x0F];
+}
+
+uint32_t usb_midi_unpack(usb_midi_unpacker_t *unpacker, const uint8_t packet[USB_MIDI_PACKET_LEN],
+                         const uint8_t **message) {
+    uint8_t cin = packet[0] & 0x0F;
+    uint8_t n = cin_size[cin];
+    const uint8_t *data = &packet[1];
+
+    if (n == 0)
+        return 0;
+
+    // Real-time, in a packet of its own or as a single byte
+    if (data[0] >= 0xF8) {
+        *message = data;
+        return 1;
+    }
+
+    bool sysex_bytes = cin == 0x4 || cin == 0x6 || cin == 0x7 || (cin == 0x5 && data[0] == 0xF7) ||
+                       (cin == 0xF && unpacker->sysex && data[0] < 0x80);
+    if (!sysex_bytes) {
+        // Any other status ends an unterminated SysEx, what was not sent is dropped.
+        if (unpacker->sysex)
+            usb_midi_unpacker_reset(unpacker);
+        if (data[0] < 0x80)
+            return 0;  // nothing to hang a stray data byte on
+        *message = data;
+        return n;
+    }
+
+    if (data[0] == 0xF0) {
+        unpacker->sysex = true;
+        unpacker->split = false;
+        unpacker->sysex_len = 0;
+    } else if (!unpacker->sysex) {
+        return 0;  // the start of this SysEx was never seen
+    }
+
+    bool end = cin != 0x4 && cin != 0xF;
+    for (uint8_t i = 0; i < n; i++)
+        unpacker->sysex_buf[unpacker->sysex_len++] = data[i];
+
+    *message = unpacker->sysex_buf;
+    if (end) {
+        uint32_t len = unpacker->sysex_len;
+        unpacker->sysex = false;
+        unpacker->split = false;
+        unpacker->sysex_len = 0;
+        return len;
+    }
+
+    // Full, out goes what there is; the rest follows as it comes.
+    if (unpacker->sysex_len > USB_MIDI_SYSEX_MAX - 3) {
+        uint32_t len = unpacker->sysex_len;
+        unpacker->split = true;
+        unpacker->sysex_len = 0;
+        return len;
+    }
+    return 0;
+}
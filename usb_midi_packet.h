@@ -0,0 +1,63 @@
+#ifndef USB_MIDI_PACKET_H_
+#define USB_MIDI_PACKET_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// USB-MIDI 1.0 event packet: cable << 4 | code index number, then 3 bytes.
+#define USB_MIDI_PACKET_LEN 4
+
+typedef struct {
+    bool sysex;        // inside a SysEx, continued by the next write
+    uint8_t held[3];   // bytes waiting for a full packet
+    uint8_t held_len;
+    uint8_t expected;  // length of the channel or system common message held, 0 for none
+} usb_midi_packer_t;
+
+// Packs MIDI messages into event packets, one per message and per 3 bytes of
+// SysEx. `packets` needs room for `len` packets. A message may be split over
+// several writes, down to a byte each; the packets of a write are complete,
+// bytes of an unfinished packet are held for the next one. Returns the
+// packets written.
+uint32_t usb_midi_pack(usb_midi_packer_t *packer, uint8_t cable, const uint8_t *data, uint32_t len,
+                       uint8_t *packets);
+
+// True unless the last write left a SysEx open. Held bytes of a shorter
+// message are not on the wire yet, other packets may go first.
+static inline bool usb_midi_packer_idle(const usb_midi_packer_t *packer) {
+    return !packer->sysex;
+}
+
+// MIDI bytes carried by a packet, by its code index number: 0 for reserved ones.
+uint8_t usb_midi_packet_size(const uint8_t packet[USB_MIDI_PACKET_LEN]);
+
+// Longest SysEx reassembled whole, a longer one leaves in pieces.
+#define USB_MIDI_SYSEX_MAX 256
+
+typedef struct {
+    bool sysex;        // inside a SysEx
+    bool split;        // part of the SysEx has been returned already
+    uint16_t sysex_len;
+    uint8_t sysex_buf[USB_MIDI_SYSEX_MAX];
+} usb_midi_unpacker_t;
+
+// Turns event packets back into a MIDI byte stream without the header and
+// padding bytes, a whole message at a time: returns its length and points
+// `message` at it, or 0 while a SysEx is still coming. Real-time bytes come
+// out on their own, even inside a SysEx.
+uint32_t usb_midi_unpack(usb_midi_unpacker_t *unpacker, const uint8_t packet[USB_MIDI_PACKET_LEN],
+                         const uint8_t **message);
+
+// True when the stream returned so far ends on a message boundary.
+static inline bool usb_midi_unpacker_idle(const usb_midi_unpacker_t *unpacker) {
+    return !unpacker->split;
+}
+
+// Drops an unfinished SysEx, its sender went quiet.
+static inline void usb_midi_unpacker_reset(usb_midi_unpacker_t *unpacker) {
+    unpacker->sysex = false;
+    unpacker->split = false;
+    unpacker->sysex_len = 0;
+}
+
+#endif  // USB_MIDI_PACKET_H_
@@ -0,0 +1,286 @@
+/**
+ * WAV Trigger Pro I2C transport
+ *
+ * Commands are queued and clocked out by the I2C interrupt, so a note sent
+ * to the WAV Trigger Pro no longer busy-waits for the bus inside
+ * midi_n_stream_write().  The Qwiic protocol carries one command per write
+ * transaction, so consecutive MIDI messages go out back to back from the
+ * interrupt; a Control Change still waiting in the queue is updated in place
+ * instead of queueing a second one for the same controller.
+ *
+ * A command that expects a response keeps the bus: an alarm starts the read
+ * once the module had time to prepare the answer, and the caller polls
+ * wav_trigger_i2c_query_result() instead of sleeping.
+ */
+#include "wav_trigger_i2c.h"
+
+#include <string.h>
+
+#include "hardware/irq.h"
+#include "pico/sync.h"
+#include "pico/time.h"
+
+#define WAV_TRIGGER_I2C_QUEUE_LEN         32
+#define WAV_TRIGGER_I2C_FIFO_DEPTH        16
+#define WAV_TRIGGER_I2C_RESPONSE_DELAY_US 2000
+
+typedef struct {
+    uint8_t len;
+    uint8_t response_len;
+    uint8_t data[WAV_TRIGGER_I2C_MAX_MESSAGE_LEN];
+} wav_trigger_i2c_msg_t;
+
+typedef enum {
+    PHASE_IDLE,
+    PHASE_WRITE,
+    PHASE_WAIT_RESPONSE,
+    PHASE_READ,
+} transfer_phase_t;
+
+static i2c_inst_t *i2c_inst;
+static critical_section_t queue_cs;
+
+static wav_trigger_i2c_msg_t queue[WAV_TRIGGER_I2C_QUEUE_LEN];
+static size_t queue_head = 0;
+static size_t queue_count = 0;
+
+static wav_trigger_i2c_msg_t current;
+static volatile transfer_phase_t phase = PHASE_IDLE;
+static size_t tx_pos;
+static size_t rx_cmd_pos;
+static size_t rx_pos;
+static uint32_t transfer_start_us;
+
+static uint8_t response[WAV_TRIGGER_I2C_MAX_RESPONSE_LEN];
+static volatile wav_trigger_i2c_query_state_t query_state = WAV_TRIGGER_I2C_QUERY_IDLE;
+
+static wav_trigger_i2c_stats_t stats;
+
+static void start_next_locked(void);
+
+static void finish_transfer_locked(bool ok) {
+    i2c_inst->hw->intr_mask = 0;
+    stats.busy_us += time_us_32() - transfer_start_us;
+    if (ok)
+        stats.sent++;
+    else
+        stats.aborted++;
+
+    if (current.response_len > 0)
+        query_state = ok ? WAV_TRIGGER_I2C_QUERY_DONE : WAV_TRIGGER_I2C_QUERY_FAILED;
+
+    phase = PHASE_IDLE;
+    start_next_locked();
+}
+
+static void fill_tx_fifo(void) {
+    i2c_hw_t *hw = i2c_inst->hw;
+
+    if (phase == PHASE_WRITE) {
+        while (tx_pos < current.len && hw->txflr < WAV_TRIGGER_I2C_FIFO_DEPTH) {
+            bool last = tx_pos == current.len - 1u;
+            hw->data_cmd = current.data[tx_pos++] | (last ? I2C_IC_DATA_CMD_STOP_BITS : 0);
+        }
+        if (tx_pos == current.len)
+            hw->intr_mask &= ~I2C_IC_INTR_MASK_M_TX_EMPTY_BITS;
+    } else if (phase == PHASE_READ) {
+        while (rx_cmd_pos < current.response_len && hw->txflr < WAV_TRIGGER_I2C_FIFO_DEPTH) {
+            bool last = rx_cmd_pos == current.response_len - 1u;
+            hw->data_cmd = I2C_IC_DATA_CMD_CMD_BITS | (last ? I2C_IC_DATA_CMD_STOP_BITS : 0);
+            rx_cmd_pos++;
+        }
+        if (rx_cmd_pos == current.response_len)
+            hw->intr_mask &= ~I2C_IC_INTR_MASK_M_TX_EMPTY_BITS;
+    }
+}
+
+static void start_next_locked(void) {
+    if (phase != PHASE_IDLE || queue_count == 0)
+        return;
+
+    current = queue[queue_head];
+    queue_head = (queue_head + 1) % WAV_TRIGGER_I2C_QUEUE_LEN;
+    queue_count--;
+
+    tx_pos = 0;
+    transfer_start_us = time_us_32();
+    phase = PHASE_WRITE;
+    i2c_inst->hw->intr_mask =
+        I2C_IC_INTR_MASK_M_TX_EMPTY_BITS | I2C_IC_INTR_MASK_M_TX_ABRT_BITS | I2C_IC_INTR_MASK_M_STOP_DET_BITS;
+    fill_tx_fifo();
+}
+
+static int64_t response_ready_alarm(alarm_id_t id, void *user_data) {
+    (void)id;
+    (void)user_data;
+
+    critical_section_enter_blocking(&queue_cs);
+    if (phase == PHASE_WAIT_RESPONSE) {
+        rx_cmd_pos = 0;
+        rx_pos = 0;
+        phase = PHASE_READ;
+        i2c_inst->hw->rx_tl = 0;
+        i2c_inst->hw->intr_mask = I2C_IC_INTR_MASK_M_TX_EMPTY_BITS | I2C_IC_INTR_MASK_M_RX_FULL_BITS |
+                                  I2C_IC_INTR_MASK_M_TX_ABRT_BITS | I2C_IC_INTR_MASK_M_STOP_DET_BITS;
+        fill_tx_fifo();
+    }
+    critical_section_exit(&queue_cs);
+    return 0;
+}
+
+static void wav_trigger_i2c_irq_handler(void) {
+    i2c_hw_t *hw = i2c_inst->hw;
+    uint32_t status = hw->intr_stat;
+
+    critical_section_enter_blocking(&queue_cs);
+
+    if (status & I2C_IC_INTR_STAT_R_TX_ABRT_BITS) {
+        (void)hw->clr_tx_abrt;
+        (void)hw->clr_stop_det;
+        finish_transfer_locked(false);
+        critical_section_exit(&queue_cs);
+        return;
+    }
+
+    // Drain on STOP_DET as well, the last bytes may arrive together with it.
+    if (phase == PHASE_READ) {
+        while (hw->rxflr > 0) {
+            uint8_t byte = (uint8_t)hw->data_cmd;
+            if (rx_pos < current.response_len)
+                response[rx_pos++] = byte;
+        }
+    }
+
+    if (status & I2C_IC_INTR_STAT_R_TX_EMPTY_BITS)
+        fill_tx_fifo();
+
+    if (status & I2C_IC_INTR_STAT_R_STOP_DET_BITS) {
+        (void)hw->clr_stop_det;
+        if (phase == PHASE_WRITE && current.response_len > 0) {
+            // Hold the bus until the answer to this command has been read back.
+            hw->intr_mask = 0;
+            phase = PHASE_WAIT_RESPONSE;
+            add_alarm_in_us(WAV_TRIGGER_I2C_RESPONSE_DELAY_US, response_ready_alarm, NULL, true);
+        } else if (phase == PHASE_WRITE) {
+            finish_transfer_locked(true);
+        } else if (phase == PHASE_READ) {
+            finish_transfer_locked(rx_pos == current.response_len);
+        }
+    }
+
+    critical_section_exit(&queue_cs);
+}
+
+void wav_trigger_i2c_init(i2c_inst_t *i2c, uint8_t addr) {
+    // i2c_init() and pin setup are done by the caller.
+    i2c_inst = i2c;
+    critical_section_init(&queue_cs);
+
+    i2c->hw->enable = 0;
+    i2c->hw->tar = addr;
+    i2c->hw->tx_tl = 0;
+    i2c->hw->intr_mask = 0;
+    i2c->hw->enable = 1;
+
+    uint irq_num = I2C0_IRQ + i2c_get_index(i2c);
+    irq_set_exclusive_handler(irq_num, wav_trigger_i2c_irq_handler);
+    irq_set_enabled(irq_num, true);
+}
+
+static bool enqueue_locked(const uint8_t *buffer, size_t len, size_t response_len) {
+    if (queue_count == WAV_TRIGGER_I2C_QUEUE_LEN) {
+        stats.dropped++;
+        return false;
+    }
+
+    wav_trigger_i2c_msg_t *msg = &queue[(queue_head + queue_count) % WAV_TRIGGER_I2C_QUEUE_LEN];
+    msg->len = (uint8_t)len;
+    msg->response_len = (uint8_t)response_len;
+    memcpy(msg->data, buffer, len);
+
+    queue_count++;
+    stats.queued++;
+    if (queue_count > stats.max_depth)
+        stats.max_depth = queue_count;
+
+    start_next_locked();
+    return true;
+}
+
+bool wav_trigger_i2c_write(const uint8_t *buffer, size_t len) {
+    if (i2c_inst == NULL || buffer == NULL || len == 0 || len > WAV_TRIGGER_I2C_MAX_MESSAGE_LEN)
+        return false;
+
+    critical_section_enter_blocking(&queue_cs);
+    bool ok = enqueue_locked(buffer, len, 0);
+    critical_section_exit(&queue_cs);
+    return ok;
+}
+
+bool wav_trigger_i2c_write_midi(uint8_t midi_cmd, const uint8_t msg[3]) {
+    uint8_t buffer[4] = {midi_cmd, msg[0], msg[1], msg[2]};
+
+    if (i2c_inst == NULL)
+        return false;
+
+    critical_section_enter_blocking(&queue_cs);
+
+    // Only the latest value of a controller matters: refresh a CC that is the
+    // last one queued rather than queueing another transaction behind it. An
+    // older one stays, it must not move ahead of the notes queued after it.
+    if ((msg[0] & 0xF0) == 0xB0 && queue_count > 0) {
+        wav_trigger_i2c_msg_t *pending = &queue[(queue_head + queue_count - 1) % WAV_TRIGGER_I2C_QUEUE_LEN];
+        if (pending->len == sizeof(buffer) && pending->data[0] == midi_cmd && pending->data[1] == msg[0] &&
+            pending->data[2] == msg[1]) {
+            pending->data[3] = msg[2];
+            stats.coalesced++;
+            critical_section_exit(&queue_cs);
+            return true;
+        }
+    }
+
+    bool ok = enqueue_locked(buffer, sizeof(buffer), 0);
+    critical_section_exit(&queue_cs);
+    return ok;
+}
+
+bool wav_trigger_i2c_query(const uint8_t *buffer, size_t len, size_t response_len) {
+    if (i2c_inst == NULL || buffer == NULL || len == 0 || len > WAV_TRIGGER_I2C_MAX_MESSAGE_LEN)
+        return false;
+    if (response_len == 0 || response_len > WAV_TRIGGER_I2C_MAX_RESPONSE_LEN)
+        return false;
+
+    critical_section_enter_blocking(&queue_cs);
+    bool ok = query_state != WAV_TRIGGER_I2C_QUERY_PENDING;
+    if (ok) {
+        query_state = WAV_TRIGGER_I2C_QUERY_PENDING;
+        ok = enqueue_locked(buffer, len, response_len);
+        if (!ok)
+            query_state = WAV_TRIGGER_I2C_QUERY_FAILED;
+    }
+    critical_section_exit(&queue_cs);
+    return ok;
+}
+
+wav_trigger_i2c_query_state_t wav_trigger_i2c_query_result(uint8_t *dst, size_t len) {
+    wav_trigger_i2c_query_state_t state = query_state;
+
+    if (state == WAV_TRIGGER_I2C_QUERY_DONE && dst != NULL) {
+        if (len > WAV_TRIGGER_I2C_MAX_RESPONSE_LEN)
+            len = WAV_TRIGGER_I2C_MAX_RESPONSE_LEN;
+        memcpy(dst, response, len);
+    }
+    if (state == WAV_TRIGGER_I2C_QUERY_DONE || state == WAV_TRIGGER_I2C_QUERY_FAILED)
+        query_state = WAV_TRIGGER_I2C_QUERY_IDLE;
+    return state;
+}
+
+size_t wav_trigger_i2c_queue_depth(void) {
+    return queue_count + (phase != PHASE_IDLE ? 1 : 0);
+}
+
+void wav_trigger_i2c_get_stats(wav_trigger_i2c_stats_t *stats_out) {
+    critical_section_enter_blocking(&queue_cs);
+    *stats_out = stats;
+    critical_section_exit(&queue_cs);
+}
@@ -0,0 +1,38 @@
+#ifndef WAV_TRIGGER_I2C_H_
+#define WAV_TRIGGER_I2C_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "hardware/i2c.h"
+
+#define WAV_TRIGGER_I2C_MAX_MESSAGE_LEN  32
+#define WAV_TRIGGER_I2C_MAX_RESPONSE_LEN 16
+
+typedef enum {
+    WAV_TRIGGER_I2C_QUERY_IDLE,
+    WAV_TRIGGER_I2C_QUERY_PENDING,
+    WAV_TRIGGER_I2C_QUERY_DONE,
+    WAV_TRIGGER_I2C_QUERY_FAILED,
+} wav_trigger_i2c_query_state_t;
+
+typedef struct {
+    uint32_t queued;        // commands accepted
+    uint32_t sent;          // transactions completed
+    uint32_t coalesced;     // CC updates merged into a pending command
+    uint32_t dropped;       // queue full
+    uint32_t aborted;       // NACK / arbitration lost
+    uint32_t max_depth;     // queue high-water mark
+    uint64_t busy_us;       // time the bus spent on transactions
+} wav_trigger_i2c_stats_t;
+
+void wav_trigger_i2c_init(i2c_inst_t *i2c, uint8_t addr);
+bool wav_trigger_i2c_write(const uint8_t *buffer, size_t len);
+bool wav_trigger_i2c_write_midi(uint8_t midi_cmd, const uint8_t msg[3]);
+bool wav_trigger_i2c_query(const uint8_t *buffer, size_t len, size_t response_len);
+wav_trigger_i2c_query_state_t wav_trigger_i2c_query_result(uint8_t *response, size_t response_len);
+size_t wav_trigger_i2c_queue_depth(void);
+void wav_trigger_i2c_get_stats(wav_trigger_i2c_stats_t *stats);
+
+#endif  // WAV_TRIGGER_I2C_H_